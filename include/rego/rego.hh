@@ -7,7 +7,10 @@
 #include "trieste/logging.h"
 #include "trieste/token.h"
 
+#include <atomic>
+#include <chrono>
 #include <initializer_list>
+#include <mutex>
 #include <trieste/trieste.h>
 
 /// This namespace provides the C++ API for the library.
@@ -755,6 +758,14 @@ namespace rego
     /// @brief Whether the builtin is available.
     bool available;
 
+    /// @brief Whether the builtin is pure, i.e. whether it always produces the
+    /// same result for the same arguments and has no side effects.
+    ///
+    /// Calls to pure built-ins whose arguments are all constants are evaluated
+    /// when the bundle is built, and the result is stored in the plan. This is
+    /// false by default for custom built-ins, which can opt in by setting it.
+    bool pure;
+
     /// @brief Constructor.
     BuiltInDef(
       Location name_, Node decl_, BuiltInBehavior behavior_, bool available_);
@@ -804,6 +815,26 @@ namespace rego
       const Location& name, Node decl, const std::string& message);
   };
 
+  /// @brief Where the output of the print built-in is sent.
+  enum class PrintMode : regoEnum
+  {
+    /// Each line is written to standard output.
+    Stdout = REGO_PRINT_STDOUT,
+    /// The lines printed by each evaluation are collected and returned with
+    /// its results (see EvalContext::print_output).
+    Buffer = REGO_PRINT_BUFFER,
+    /// Each line is passed to the print handler (see
+    /// BuiltInsDef::print_handler).
+    Callback = REGO_PRINT_CALLBACK,
+    /// Nothing is printed, and the arguments are not serialised.
+    Discard = REGO_PRINT_DISCARD
+  };
+
+  /// @brief Receives each line written by the print built-in.
+  using PrintHandler = std::function<void(const std::string&)>;
+
+  class PrintSink;
+
   /// @brief Manages the set of builtins used by an interpreter to resolve
   /// built-in calls.
   class BuiltInsDef
@@ -863,6 +894,23 @@ namespace rego
     /// @return A reference to this instance.
     BuiltInsDef& strict_errors(bool strict_errors);
 
+    /// @brief Gets where the output of the print built-in is sent.
+    /// @return The print mode.
+    PrintMode print_mode() const;
+
+    /// @brief Sets where the output of the print built-in is sent.
+    /// @param mode The print mode.
+    /// @return A reference to this instance.
+    BuiltInsDef& print_mode(PrintMode mode);
+
+    /// @brief Sends the output of the print built-in to a handler.
+    /// @details
+    /// This also sets the print mode to PrintMode::Callback. The handler may
+    /// be called from any thread which is evaluating a query.
+    /// @param handler The function which receives each printed line.
+    /// @return A reference to this instance.
+    BuiltInsDef& print_handler(PrintHandler handler);
+
     /// @brief Registers a set of built-ins.
     /// @param built_ins The built-ins to register.
     /// @return A reference to this instance.
@@ -898,8 +946,11 @@ namespace rego
     std::map<Location, BuiltIn>::const_iterator end() const;
 
   private:
+    PrintSink& print_sink();
+
     std::map<Location, BuiltIn> m_builtins;
     bool m_strict_errors;
+    std::shared_ptr<PrintSink> m_print_sink;
   };
 
   /// @cond
@@ -915,6 +966,7 @@ namespace rego
   const std::string WellFormedError = "wellformed_error";
   const std::string RuntimeError = "runtime_error";
   const std::string RecursionError = "rego_recursion_error";
+  const std::string EvalCancelError = "eval_cancel_error";
   const std::string DefaultVersion = "v1";
   /// @endcond
 
@@ -936,6 +988,21 @@ namespace rego
   Node err(
     Node node, const std::string& msg, const std::string& code = UnknownError);
 
+  /// @brief Generates an error node, formatting the message lazily.
+  /// @details
+  /// The message is only formatted if the error will be reported. Errors
+  /// returned by built-ins are discarded unless strict errors are enabled
+  /// (see BuiltInsDef::strict_errors), so built-ins should use this overload
+  /// when the message is expensive to build.
+  /// @param node The node for which the error occurred.
+  /// @param msg Returns the error message.
+  /// @param code The error code.
+  /// @return The generated error node.
+  Node err(
+    Node node,
+    const std::function<std::string()>& msg,
+    const std::string& code = UnknownError);
+
   /// @brief Returns a node representing the version of the library.
   /// @details
   ///
@@ -1112,14 +1179,39 @@ namespace rego
       Block block;
     };
 
+    /// @brief Additional information for Dot statements whose source is a
+    /// constant path into the base data document
+    struct DataRefExt
+    {
+      /// @brief The value which the statement looks up in the base data
+      /// document, or nullptr if there is no such value.
+      Node value;
+    };
+
     /// @brief Additional information for Call, CallDynamic, With, Block, Not,
-    /// and Scan statements
+    /// and Scan statements, and for resolved Dot statements.
     struct StatementExt
     {
       /// @brief The contents of the extension
-      std::variant<CallExt, CallDynamicExt, WithExt, std::vector<Block>, Block>
+      std::variant<
+        CallExt,
+        CallDynamicExt,
+        WithExt,
+        std::vector<Block>,
+        Block,
+        DataRefExt>
         contents;
 
+      /// @brief Whether the iterations of a Scan are independent of one
+      /// another (see BundleDef::optimize), such that they may be evaluated
+      /// in parallel.
+      bool independent = false;
+
+      /// @brief The locals, defined outside an independent Scan, to which its
+      /// body adds values (by way of ArrayAppend, SetAdd, ObjectInsert or
+      /// ObjectInsertOnce).
+      std::vector<size_t> collectors;
+
       /// @brief Returns this extension as a CallExt
       /// @return The CallExt contents
       const CallExt& call() const;
@@ -1135,6 +1227,9 @@ namespace rego
       /// @brief Returns this extension as a Block
       /// @return The Block contents
       const Block& block() const;
+      /// @brief Returns this extension as a DataRefExt
+      /// @return The DataRefExt contents
+      const DataRefExt& data_ref() const;
 
       /// @brief Constructs a StatementExt from a CallExt
       StatementExt(CallExt&& ext);
@@ -1146,6 +1241,8 @@ namespace rego
       StatementExt(std::vector<Block>&& blocks);
       /// @brief Constructs a StatementExt from a Block
       StatementExt(Block&& block);
+      /// @brief Constructs a StatementExt from a DataRefExt
+      StatementExt(DataRefExt&& ext);
     };
 
     /// @brief Represents a single IR statement.
@@ -1175,6 +1272,14 @@ namespace rego
       /// @brief The (optional) extended information for the statement
       std::shared_ptr<const StatementExt> ext;
 
+      /// @brief The position of the statement in a walk of the bundle
+      /// @details
+      /// Assigned by BundleDef::optimize, which numbers the statements of
+      /// every function and then every plan (each before those nested within
+      /// it). Identifies the statement in a VM trace (see
+      /// BundleDef::find_statement).
+      std::uint32_t id;
+
       /// @brief Default constructor
       Statement();
 
@@ -1186,6 +1291,9 @@ namespace rego
         std::ostream& stream, const Statement& stmt);
     };
 
+    /// @brief A path into the input document, as a sequence of object keys.
+    typedef std::vector<std::string> InputPath;
+
     /// @brief Represents a plan in the IR.
     struct Plan
     {
@@ -1193,6 +1301,16 @@ namespace rego
       Location name;
       /// @brief The blocks which make up the plan
       std::vector<Block> blocks;
+      /// @brief The paths into the input document which the plan can read
+      /// @details
+      /// Computed by BundleDef::optimize. The plan only ever reads the
+      /// subtrees of the input found at these paths (and whether the keys
+      /// along them are present). An empty path means that the plan may read
+      /// the whole input. See Interpreter::set_input_json.
+      std::vector<InputPath> input_paths;
+      /// @brief The number of frame slots the plan needs (including the two
+      /// shared slots for input and data)
+      size_t local_count = 0;
     };
 
     /// @brief Represents a function in the IR.
@@ -1212,10 +1330,227 @@ namespace rego
       std::vector<Block> blocks;
       /// @brief Whether the function result can be cached
       bool cacheable;
+      /// @brief Whether the function result depends only on the base data
+      /// document
+      /// @details
+      /// Computed by BundleDef::optimize. True for cacheable functions which
+      /// neither read the input document themselves nor call a function
+      /// which does (or may, as with CallDynamic). Such results are shared
+      /// between evaluations (see BundleDef::result_cache), so long as the
+      /// function is also free of impure built-ins.
+      bool data_only = false;
+      /// @brief The number of frame slots the function needs (including the
+      /// two shared slots for input and data)
+      size_t local_count;
+    };
+
+    /// @brief Statistics reported by BundleDef::optimize.
+    struct OptimizeStats
+    {
+      /// @brief The number of statements (including those in nested blocks)
+      /// before optimization
+      size_t statements_before = 0;
+      /// @brief The number of statements after optimization
+      size_t statements_after = 0;
+      /// @brief The number of passes made over the bundle
+      size_t passes = 0;
+      /// @brief The bundle local count before slots were compacted
+      size_t local_count_before = 0;
+      /// @brief The size of the largest frame after slots were compacted
+      size_t local_count_after = 0;
+      /// @brief The number of Scan statements marked as independent
+      size_t independent_scans = 0;
+      /// @brief The number of Dot statements resolved against the base data
+      /// document
+      size_t data_paths = 0;
+      /// @brief The number of functions whose results depend only on the base
+      /// data document
+      size_t data_only_functions = 0;
+    };
+
+    /// @brief Holds the results of data-only functions (see
+    /// Function::data_only) between evaluations of a bundle.
+    /// @details
+    /// Results are recorded against the identity of the data document they
+    /// were computed from, and the cache empties itself if asked about a
+    /// different document. It is safe to use from multiple threads. Two
+    /// evaluations which miss at once may both compute a result, but as the
+    /// functions are deterministic only the first one stored is kept.
+    ///
+    /// Each result is stored once, as the only child of a holder node, and
+    /// every evaluation which finds it reads that same value. As it already
+    /// has a parent, an evaluation which adds it to a collection copies it
+    /// (see VirtualMachine::to_term) rather than taking it, so it is never
+    /// changed. Whether a function may use the cache at all depends on the
+    /// built-ins of the VM evaluating it, so that is for the VM to check.
+    class ResultCache
+    {
+    public:
+      /// @brief Finds the result of a function.
+      /// @details
+      /// The caller must keep the holder for as long as it uses the result,
+      /// as the cache may let go of it if it is cleared.
+      /// @param name The name of the function.
+      /// @param data The data document the result was computed from.
+      /// @return The holder of the result, or nullptr if there is none.
+      Node find(const Location& name, const Node& data) const;
+
+      /// @brief Records the result of a function.
+      /// @param name The name of the function.
+      /// @param data The data document the result was computed from.
+      /// @param value The result.
+      void insert(const Location& name, const Node& data, Node value);
+
+      /// @brief Removes every result.
+      void clear();
+
+      /// @brief The number of results held.
+      size_t size() const;
+
+    private:
+      void reset(const Node& data);
+
+      mutable std::mutex m_mutex;
+      Node m_data;
+      std::map<Location, Node> m_results;
+    };
+
+    /// @brief Holds the indexes which built-ins build over collections in the
+    /// data document of a bundle (e.g. the tries used by
+    /// `strings.any_prefix_match`), so that each is built once per bundle
+    /// rather than once per evaluation.
+    /// @details
+    /// The data document does not change once the bundle is loaded, so an
+    /// index is kept for as long as the bundle is, keyed on the identity of
+    /// the collection it was built over and on the kind of index. It is safe
+    /// to use from multiple threads. Indexes over the input, or over values
+    /// computed during an evaluation, are not held here.
+    class DataIndexCache
+    {
+    public:
+      /// @brief Finds an index.
+      /// @param node The collection the index was built over.
+      /// @param kind The kind of index.
+      /// @return The index, or nullptr if there is none.
+      std::shared_ptr<const void>
+      find(const Node& node, const std::string& kind) const;
+
+      /// @brief Records an index.
+      /// @details
+      /// If another thread has already recorded an index of the same kind
+      /// over the collection, that index is kept instead.
+      /// @param node The collection the index was built over.
+      /// @param kind The kind of index.
+      /// @param index The index.
+      /// @return The index held by the cache.
+      std::shared_ptr<const void> insert(
+        const Node& node,
+        const std::string& kind,
+        std::shared_ptr<const void> index);
+
+      /// @brief Removes every index.
+      void clear();
+
+      /// @brief The number of indexes held.
+      size_t size() const;
+
+    private:
+      struct Entry
+      {
+        Node node;
+        std::shared_ptr<const void> index;
+      };
+
+      mutable std::mutex m_mutex;
+      std::map<std::pair<const NodeDef*, std::string>, Entry> m_indexes;
+    };
+
+    /// @brief Holds the results of entrypoint evaluations, so that repeated
+    /// queries with the same input are answered without evaluating the plan.
+    /// @details
+    /// Entries are keyed on the entrypoint and a structural hash of the input,
+    /// and are checked against the input they were computed from, so a hash
+    /// collision is a miss rather than a wrong decision. The cache is split
+    /// into shards, each with its own lock and least-recently-used eviction,
+    /// so that it is safe and cheap to use from multiple threads. Results are
+    /// recorded against the identity of the data document, as with
+    /// ResultCache, and the cache holds its own copies of the inputs and
+    /// results, handing out a fresh copy of the results on each hit.
+    ///
+    /// Each VM only uses the cache for entrypoints which cannot reach a
+    /// non-deterministic built-in of its own. If the cache has a time-to-live,
+    /// then entrypoints which read the clock (e.g. with `time.now_ns`) are
+    /// cached too, as their decisions are allowed to be up to that old.
+    class DecisionCache
+    {
+    public:
+      /// @brief The counters of a decision cache.
+      struct Stats
+      {
+        /// @brief Lookups which found a result
+        size_t hits = 0;
+        /// @brief Lookups which did not find a (live) result
+        size_t misses = 0;
+        /// @brief Results removed to make room for others
+        size_t evictions = 0;
+        /// @brief The number of results held
+        size_t size = 0;
+      };
+
+      /// @brief Constructor.
+      /// @param capacity The maximum number of results held.
+      /// @param ttl How long a result may be used for. The default of 0 means
+      /// that results do not expire.
+      /// @param shards The number of independently locked shards.
+      DecisionCache(
+        size_t capacity,
+        std::chrono::milliseconds ttl = std::chrono::milliseconds(0),
+        size_t shards = 16);
+      ~DecisionCache();
+
+      /// @brief Finds the result of an entrypoint.
+      /// @param entrypoint The name of the entrypoint.
+      /// @param input The input the result was computed from.
+      /// @param data The data document the result was computed from.
+      /// @return The result values, or std::nullopt if there are none.
+      std::optional<Nodes> find(
+        const Location& entrypoint, const Node& input, const Node& data);
+
+      /// @brief Records the result of an entrypoint.
+      /// @param entrypoint The name of the entrypoint.
+      /// @param input The input the result was computed from.
+      /// @param data The data document the result was computed from.
+      /// @param values The result values.
+      void insert(
+        const Location& entrypoint,
+        const Node& input,
+        const Node& data,
+        const Nodes& values);
+
+      /// @brief How long a result may be used for (0 for no limit).
+      std::chrono::milliseconds ttl() const;
+
+      /// @brief Removes every result.
+      void clear();
+
+      /// @brief Gets the counters of the cache.
+      Stats stats() const;
+
+    private:
+      struct Shard;
+
+      Shard& shard(size_t hash);
+
+      std::chrono::milliseconds m_ttl;
+      std::vector<std::unique_ptr<Shard>> m_shards;
+      std::atomic<size_t> m_hits;
+      std::atomic<size_t> m_misses;
+      std::atomic<size_t> m_evictions;
     };
   }
 
   struct BundleDef;
+  class DataTape;
 
   /// @brief A pointer to a BundleDef
   typedef std::shared_ptr<BundleDef> Bundle;
@@ -1224,7 +1559,14 @@ namespace rego
   struct BundleDef
   {
     /// @brief The merged base data document
+    /// @details
+    /// Constant paths into the document are resolved by `optimize`, so it must
+    /// not be modified afterwards. After `compact_data` it is a view of
+    /// `data_tape` rather than a tree of values.
     Node data;
+    /// @brief The compact encoding of `data`, if `compact_data` has been
+    /// called
+    std::shared_ptr<const DataTape> data_tape;
     /// @brief The built-in functions required by the bundle
     std::map<Location, Node> builtin_functions;
     /// @brief Map from plan names to their indices
@@ -1237,9 +1579,33 @@ namespace rego
     std::vector<bundle::Function> functions;
     /// @brief The string table for the bundle
     std::vector<Location> strings;
+    /// @brief The entries of the string table as JSONString nodes
+    /// @details
+    /// Built by `materialize_constants`. The VM never modifies a value once
+    /// it has been built, so every read of a string operand shares the node
+    /// for its entry rather than allocating a new one. The nodes are children
+    /// of `constants`, so the VM copies one rather than taking it when it is
+    /// added to another value.
+    std::vector<Node> string_values;
+    /// @brief The shared `true` node (see `string_values`)
+    Node true_value;
+    /// @brief The shared `false` node (see `string_values`)
+    Node false_value;
+    /// @brief The shared `null` node (see `string_values`)
+    Node null_value;
+    /// @brief The parent of the shared constant nodes
+    /// @details
+    /// The constants are read by every evaluation of the bundle, including
+    /// those running at the same time on other threads, so they must never
+    /// be given another parent. `data` is also held here if it has no other
+    /// parent.
+    Node constants;
     /// @brief The module source files which were compiled into the bundle
     std::vector<Source> files;
-    /// @brief The number of local variables required by the bundle
+    /// @brief The number of slots in the largest frame of the bundle
+    /// @details
+    /// Each plan and function call gets its own frame, so this is not the
+    /// total number of locals in the bundle. See `bundle::Function`.
     size_t local_count;
     /// @brief The index of the query plan, if one was included
     std::optional<size_t> query_plan;
@@ -1247,6 +1613,21 @@ namespace rego
     /// @brief The query, if one was included
     Source query;
 
+    /// @brief The results of data-only functions, shared by every evaluation
+    /// of the bundle (see bundle::ResultCache)
+    std::shared_ptr<bundle::ResultCache> result_cache =
+      std::make_shared<bundle::ResultCache>();
+
+    /// @brief The indexes built-ins have built over the data document (see
+    /// bundle::DataIndexCache)
+    std::shared_ptr<bundle::DataIndexCache> data_indexes =
+      std::make_shared<bundle::DataIndexCache>();
+
+    /// @brief The results of entrypoint evaluations (see
+    /// bundle::DecisionCache). This is null, disabling the cache, unless it is
+    /// set by the user.
+    std::shared_ptr<bundle::DecisionCache> decision_cache;
+
     /// @brief Finds a plan by name.
     /// @param name The name of the plan to find.
     /// @return The index of the plan if found, otherwise std::nullopt.
@@ -1262,6 +1643,59 @@ namespace rego
     /// @return True if the name refers to a function, otherwise false.
     bool is_function(const Location& name) const;
 
+    /// @brief Optimizes the plans and functions of the bundle in place.
+    /// @details
+    /// Runs a set of semantics-preserving rewrites over the IR until it stops
+    /// changing: removal of Nops and stores to locals which are never read,
+    /// copy propagation, flattening of nested blocks which cannot fail,
+    /// pruning of comparisons between constants (and of Not statements over
+    /// them), and removal of IsDefined checks on locals which were just
+    /// written. Finally, the locals of each plan and function are renumbered
+    /// so that each needs only a small frame of its own, the Scan
+    /// statements whose iterations are independent of one another are marked
+    /// as such, the input paths which each plan can read are computed
+    /// (see `bundle::Plan::input_paths`), and Dot statements which look up
+    /// constant paths in the base data document are resolved against it (see
+    /// `bundle::DataRefExt`), and the functions whose results depend only on
+    /// the data document are marked (see `bundle::Function::data_only`). This
+    /// is called automatically by `from_node` and `load`.
+    /// @return The statement and local counts before and after optimization.
+    bundle::OptimizeStats optimize();
+
+    /// @brief Replaces the tree of values in `data` with a compact encoding.
+    /// @details
+    /// The document is encoded as one read-only tape, in which strings are
+    /// interned and the keys of each object are sorted so that they can be
+    /// binary searched. The VM reads values from the tape in place, and only
+    /// builds them as nodes when they escape into a result, a comparison or a
+    /// built-in, which for a large document greatly reduces the memory used
+    /// and the cost of looking up paths. A container is built at most once,
+    /// and then shared by every later evaluation. Objects built from the tape
+    /// have their items sorted by key. The constant paths resolved by
+    /// `optimize` are resolved again against the tape. Documents in which an
+    /// object has a key which is not a string are left unchanged.
+    /// @return True if the document was encoded (or already had been),
+    /// otherwise false.
+    bool compact_data();
+
+    /// @brief Finds a statement by its id.
+    /// @details
+    /// Used to decode VM traces (see VirtualMachine::trace_capacity). The
+    /// bundle must have been loaded in the same way (e.g. with the same
+    /// entrypoints) as the one which produced the trace.
+    /// @param id The id of the statement (see `bundle::Statement::id`).
+    /// @return The statement, or nullptr if there is no such statement.
+    const bundle::Statement* find_statement(std::uint32_t id) const;
+
+    /// @brief Builds the constant nodes which the VM reads operands from.
+    /// @details
+    /// Populates `string_values` from `strings`, along with `true_value`,
+    /// `false_value` and `null_value`, and makes them (and `data`) children
+    /// of `constants`. This is called automatically by
+    /// `from_node` and `load`, and must be called again if the string table
+    /// is changed.
+    void materialize_constants();
+
     /// @brief Saves the bundle to a stream.
     /// @details
     /// The bundle is saved in Rego Bundle Binary format. To learn
@@ -1300,6 +1734,68 @@ namespace rego
     /// @param path The path to the file to load from.
     /// @return The bundle, or null if the bundle could not be loaded.
     static Bundle load(const std::filesystem::path& path);
+
+    /// @brief Loads the parts of a bundle needed by some entrypoints.
+    /// @details
+    /// Only the plans for the given entrypoints are decoded, along with the
+    /// functions they can call and the strings and built-in declarations
+    /// those use. The module source files are not loaded, so statements
+    /// have no source locations. The data document is always loaded in full.
+    /// If `entrypoints` is empty then the whole bundle is loaded. The stream
+    /// is read once to check the CRC and then again to decode the sections
+    /// which are needed, so it must be seekable. The undecoded sections are
+    /// never held in memory.
+    /// @param stream The stream to load from.
+    /// @param entrypoints The entrypoints which will be evaluated.
+    /// @return The bundle.
+    static Bundle load(
+      std::istream& stream, const std::vector<std::string>& entrypoints);
+
+    /// @brief Loads the parts of a bundle file needed by some entrypoints.
+    /// @details
+    /// See the stream overload for details.
+    /// @param path The path to the file to load from.
+    /// @param entrypoints The entrypoints which will be evaluated.
+    /// @return The bundle, or null if the bundle could not be loaded.
+    static Bundle load(
+      const std::filesystem::path& path,
+      const std::vector<std::string>& entrypoints);
+  };
+
+  /// @cond
+  struct EvalLimits;
+  class WorkerPool;
+  /// @endcond
+
+  /// @brief What a caller can see of a single evaluation.
+  /// @details
+  /// Pass one to VirtualMachine::run_entrypoint (or run_entrypoints, or
+  /// run_query) to receive what the evaluation produced besides its results.
+  /// Each evaluation should have its own context, so evaluations running at
+  /// the same time on other threads do not see each other's output, and
+  /// cancelling one does not stop the others.
+  struct EvalContext
+  {
+    /// @brief The lines printed by the evaluation, in order.
+    /// @details
+    /// Lines are only collected when the print mode is PrintMode::Buffer.
+    std::vector<std::string> print_output;
+
+    /// @brief The number of statements executed by the evaluation.
+    size_t statement_count = 0;
+
+    /// @brief Whether the evaluation has been asked to stop.
+    /// @details
+    /// This may be set from any thread, before or during the evaluation. The
+    /// evaluation stops (with an EvalCancelError) the next time it checks its
+    /// limits.
+    std::atomic<bool> cancelled{false};
+
+    /// @brief Asks the evaluation using this context to stop.
+    void cancel()
+    {
+      cancelled = true;
+    }
   };
 
   /// @brief This class implements a virtual machine that can execute compiled
@@ -1310,6 +1806,36 @@ namespace rego
   class VirtualMachine
   {
   public:
+    /// @brief The outcome of executing a statement or block.
+    enum class Code
+    {
+      Break,
+      Continue,
+      Undefined,
+      MultipleOutputs,
+      Return,
+      Error
+    };
+
+    /// @brief A record of one statement executed by the VM.
+    /// @details
+    /// See VirtualMachine::trace_capacity.
+    struct TraceEntry
+    {
+      /// @brief The id of the statement (see `bundle::Statement::id`)
+      std::uint32_t statement;
+      /// @brief The type of the statement
+      bundle::StatementType type;
+      /// @brief The outcome of the statement
+      Code code;
+      /// @brief When the statement started, in nanoseconds since the start of
+      /// the evaluation
+      std::uint64_t start_ns;
+      /// @brief When the statement finished, in nanoseconds since the start
+      /// of the evaluation
+      std::uint64_t end_ns;
+    };
+
     VirtualMachine();
 
     /// @brief Executes the entrypoint plan in the bundle with the provided
@@ -1319,16 +1845,42 @@ namespace rego
     /// otherwise an error node will be returned.
     /// @param entrypoint The name of the entrypoint plan to execute.
     /// @param input The input to the plan.
+    /// @param context If not null, cancels the evaluation and receives its
+    /// print output and statement count (see EvalContext).
     /// @return The result of executing the plan.
-    Node run_entrypoint(const Location& entrypoint, Node input) const;
+    Node run_entrypoint(
+      const Location& entrypoint,
+      Node input,
+      EvalContext* context = nullptr) const;
+
+    /// @brief Executes several entrypoint plans in the bundle against the
+    /// same input.
+    /// @details
+    /// The plans are run one after another in a single evaluation, so the
+    /// results of functions which only depend on the input and data (such as
+    /// helper rules used by more than one entrypoint) are computed once and
+    /// shared between them. The statement and time limits apply to the
+    /// evaluation as a whole.
+    /// @param entrypoints The names of the entrypoint plans to execute.
+    /// @param input The input to the plans.
+    /// @param context If not null, cancels the evaluation and receives its
+    /// print output and statement count (see EvalContext).
+    /// @return The result of each plan, in the same order as `entrypoints`.
+    /// Each is what `run_entrypoint` would return for that plan.
+    Nodes run_entrypoints(
+      const std::vector<Location>& entrypoints,
+      Node input,
+      EvalContext* context = nullptr) const;
 
     /// @brief Executes the query plan in the bundle with the provided input.
     /// @details
     /// The bundle must have been built with a query plan, otherwise
     /// an error node will be returned.
     /// @param input The input to the query.
+    /// @param context If not null, cancels the evaluation and receives its
+    /// print output and statement count (see EvalContext).
     /// @return The result of executing the query.
-    Node run_query(Node input) const;
+    Node run_query(Node input, EvalContext* context = nullptr) const;
 
     /// @brief Sets the built-in functions to use during execution.
     /// @param builtins The built-in functions to use.
@@ -1347,48 +1899,208 @@ namespace rego
     /// @brief Gets the bundle used during execution.
     Bundle bundle() const;
 
+    /// @brief Sets the number of threads which may evaluate a scan.
+    /// @details
+    /// Scans whose iterations are independent of one another (see
+    /// BundleDef::optimize), which only call pure functions, and which range
+    /// over large collections are split into chunks and evaluated by up to
+    /// this many threads (including the calling thread). The results are then
+    /// combined in iteration order, so the outcome is the same as evaluating
+    /// the scan serially. The other threads are started by the first such
+    /// scan and kept by the virtual machine until it is destroyed or this is
+    /// changed. The default of 1 evaluates every scan on the calling thread.
+    /// @param workers The maximum number of threads per scan.
+    /// @return A reference to this virtual machine.
+    VirtualMachine& scan_workers(size_t workers);
+
+    /// @brief Gets the maximum number of threads which may evaluate a scan.
+    size_t scan_workers() const;
+
+    /// @brief Sets the maximum number of statements an evaluation may execute.
+    /// @details
+    /// An evaluation which exceeds this limit, which runs for longer than the
+    /// time limit, or which is cancelled stops with an error whose code is
+    /// EvalCancelError. The time limit and cancellation are checked
+    /// periodically (by the VM and by long-running built-ins), so an
+    /// evaluation may run slightly past them. The default of 0 means that
+    /// there is no limit.
+    /// @param limit The maximum number of statements per evaluation.
+    /// @return A reference to this virtual machine.
+    VirtualMachine& statement_limit(size_t limit);
+
+    /// @brief Gets the maximum number of statements an evaluation may execute.
+    size_t statement_limit() const;
+
+    /// @brief Sets whether entrypoints return their raw result values.
+    /// @details
+    /// By default, run_entrypoint returns a Results node with a symbol table,
+    /// in the same form as run_query. When raw results are enabled it instead
+    /// returns the result value itself (or a Terms node holding the values,
+    /// if the entrypoint produced more than one), which is much cheaper for
+    /// small results such as boolean decisions. Errors and undefined results
+    /// are returned as before.
+    /// @param raw True to return raw result values.
+    /// @return A reference to this virtual machine.
+    VirtualMachine& raw_results(bool raw);
+
+    /// @brief Gets whether entrypoints return their raw result values.
+    bool raw_results() const;
+
+    /// @brief Sets the maximum wall-clock time an evaluation may take.
+    /// @details
+    /// See VirtualMachine::statement_limit. The default of 0 means that there
+    /// is no limit.
+    /// @param limit The maximum duration of an evaluation.
+    /// @return A reference to this virtual machine.
+    VirtualMachine& time_limit(std::chrono::milliseconds limit);
+
+    /// @brief Gets the maximum wall-clock time an evaluation may take.
+    std::chrono::milliseconds time_limit() const;
+
+    /// @brief Cancels every evaluation in progress.
+    /// @details
+    /// This may be called from any thread. Each evaluation which had started
+    /// when it was called stops (with an EvalCancelError) the next time it
+    /// checks its limits. Evaluations started afterwards are not affected. To
+    /// stop a single evaluation, cancel its EvalContext instead.
+    void cancel();
+
+    /// @brief Sets the number of statements kept in the execution trace.
+    /// @details
+    /// When this is non-zero, each evaluation records an entry for each
+    /// statement it executes in its own ring buffer of this many entries.
+    /// When it finishes (including when it fails or is cancelled) the buffer
+    /// becomes the trace of the VM, which so holds the last statements of
+    /// the most recently finished evaluation. Statements executed by parallel
+    /// scan workers are not recorded. The default of 0 disables the trace.
+    /// @param capacity The maximum number of entries to keep.
+    /// @return A reference to this virtual machine.
+    VirtualMachine& trace_capacity(size_t capacity);
+
+    /// @brief Gets the number of statements kept in the execution trace.
+    size_t trace_capacity() const;
+
+    /// @brief The execution trace of the most recent evaluation.
+    /// @return The entries in the trace, oldest first.
+    std::vector<TraceEntry> trace() const;
+
+    /// @brief Writes the execution trace to a stream in a compact binary form.
+    /// @details
+    /// The trace can be read back with `load_trace` and decoded with
+    /// `print_trace` given the same bundle.
+    /// @param stream The stream to write to.
+    void save_trace(std::ostream& stream) const;
+
+    /// @brief Reads an execution trace written by `save_trace`.
+    /// @param stream The stream to read from.
+    /// @return The entries in the trace, oldest first.
+    static std::vector<TraceEntry> load_trace(std::istream& stream);
+
+    /// @brief Writes a trace as text, one statement per line, along with the
+    /// location of each statement in the policy source.
+    /// @param bundle The bundle which produced the trace.
+    /// @param trace The entries in the trace.
+    /// @param stream The stream to write to.
+    static void print_trace(
+      const BundleDef& bundle,
+      const std::vector<TraceEntry>& trace,
+      std::ostream& stream);
+
   private:
     typedef std::vector<Node> Frame;
 
-    enum class Code
+    // The trace of a single evaluation: a ring buffer of the last `capacity`
+    // statements it executed.
+    struct Trace
     {
-      Break,
-      Continue,
-      Undefined,
-      MultipleOutputs,
-      Return,
-      Error
+      size_t capacity;
+      std::vector<TraceEntry> entries;
+      size_t total;
+      std::chrono::steady_clock::time_point start;
+
+      void record(const TraceEntry& entry);
+      std::vector<TraceEntry> in_order() const;
     };
 
     class State
     {
     public:
-      State(Node input, Node data, size_t num_locals);
+      struct Walk
+      {
+        Node iterator;
+        Node root;
+        bool with_paths;
+      };
+
+      // A change to the world outside an independent scan, recorded by a
+      // worker so that it can be applied in iteration order.
+      struct Effect
+      {
+        const bundle::Statement* stmt;
+        Node key;
+        Node value;
+        Nodes errors;
+        Code code;
+      };
+
+      State(
+        Node input,
+        Node data,
+        size_t num_locals,
+        std::shared_ptr<const DataTape> tape);
+      void limit(std::shared_ptr<EvalLimits> limits);
+      const EvalLimits* limits() const;
+      void trace(std::shared_ptr<Trace> trace);
+      Trace* trace() const;
+      void step();
+      void check_limits();
+      void flush_statements();
+      void seal();
+      State fork(const std::vector<size_t>& collectors) const;
+      bool is_worker() const;
+      bool is_collector(size_t key) const;
+      void add_effect(const bundle::Statement& stmt, Node key, Node value);
+      void end_iteration(Code code);
+      std::vector<Effect> take_effects();
       Node read_local(size_t index) const;
+      Node peek_local(size_t index) const;
+      Node materialize(const Node& value) const;
       void write_local(size_t index, Node value);
       bool is_defined(size_t key) const;
       void reset_local(size_t key);
       void add_result(Node node);
       const Nodes& result_set() const;
+      void next_plan();
       bool is_in_call_stack(const Location& func_name) const;
       std::string_view root_function_name() const;
       void push_function(const Location& func_name, size_t num_args);
       void pop_function(const Location& func_name);
+      void push_frame(size_t num_locals);
+      void pop_frame();
       const Nodes& errors() const;
       void add_error(Node error);
       void add_error_multiple_output(Node inst);
       void add_error_object_insert(Node inst);
       void put_function_result(const Location& func_name, Node result);
       Node get_function_result(const Location& func_name) const;
+      void hold(Node holder);
       bool in_with() const;
       void push_with();
       void pop_with();
       bool in_break() const;
       void push_break(size_t levels);
       void pop_break();
+      std::vector<std::string>& print_output();
+      Node push_walk(Node root, bool with_paths);
+      std::optional<Walk> pop_walk(const Node& iterator);
 
     private:
+      size_t slot(size_t key) const;
+
       Frame m_frame;
+      size_t m_frame_base;
+      size_t m_frame_end;
+      std::vector<std::pair<size_t, size_t>> m_frames;
       Nodes m_errors;
       BuiltIns m_builtins;
       std::vector<Location> m_call_stack;
@@ -1397,13 +2109,58 @@ namespace rego
       Nodes m_result_set;
       size_t m_with_count;
       size_t m_break_count;
+      std::vector<Walk> m_walks;
+      bool m_worker;
+      std::set<size_t> m_collectors;
+      std::vector<Effect> m_effects;
+      std::shared_ptr<EvalLimits> m_limits;
+      size_t m_statements;
+      size_t m_next_check;
+      std::shared_ptr<const DataTape> m_tape;
+      // the containers of the compact data document built by this
+      // evaluation, keyed on their offset in the tape
+      mutable std::map<std::size_t, Node> m_materialized;
+      Node m_sealed;
+      Nodes m_held;
+      std::shared_ptr<Trace> m_trace;
+      std::vector<std::string> m_print_output;
     };
 
-    void run_plan(const bundle::Plan& plan, State& state) const;
+    void run_plan(
+      const bundle::Plan& plan, State& state, EvalContext* context) const;
+    void run_plans(
+      const std::vector<const bundle::Plan*>& plans,
+      State& state,
+      EvalContext* context,
+      const std::function<void(size_t)>& done) const;
+    void publish_trace(const State& state) const;
+    Node entrypoint_results(const State& state) const;
+    Node entrypoint_results(const Nodes& result_set) const;
     Code run_block(State& state, const bundle::Block& block) const;
     Code run_stmt(
       State& state, size_t index, const bundle::Statement& stmt) const;
+    Code run_traced(
+      State& state, size_t index, const bundle::Statement& stmt) const;
     Code run_scan(State& state, const bundle::Statement& stmt) const;
+    Code run_parallel_scan(
+      State& state, const bundle::Statement& stmt, const Node& source) const;
+    Code apply_effect(
+      State& state,
+      const State::Effect& effect,
+      std::map<size_t, std::set<std::string>>& set_members) const;
+    bool calls_are_pure(
+      const bundle::Block& block,
+      std::set<std::string>& visited,
+      bool allow_clock = false) const;
+    bool decisions_cacheable(
+      const bundle::Plan& plan, const bundle::DecisionCache& cache) const;
+    bool results_shareable(const bundle::Function& function) const;
+    bool scan_pure(const bundle::Statement& stmt) const;
+    std::shared_ptr<WorkerPool> worker_pool() const;
+    Code run_walk(
+      State& state,
+      const bundle::Statement& stmt,
+      const State::Walk& walk) const;
     Code run_with(State& state, const bundle::Statement& stmt) const;
     Code run_call(
       State& state,
@@ -1418,6 +2175,10 @@ namespace rego
     Node to_term(const Node& value) const;
     Node unpack_operand(
       const State& state, const bundle::Operand& operand) const;
+    Node unpack_lazy_operand(
+      const State& state, const bundle::Operand& operand) const;
+    Node unpack_view_operand(
+      const State& state, const bundle::Operand& operand) const;
     Node write_and_swap(
       State& state,
       size_t key,
@@ -1426,7 +2187,27 @@ namespace rego
 
     Bundle m_bundle;
     BuiltIns m_builtins;
-    RE2 m_int_regex;
+    size_t m_scan_workers;
+    size_t m_statement_limit;
+    bool m_raw_results;
+    std::chrono::milliseconds m_time_limit;
+    mutable std::atomic<size_t> m_cancel_epoch;
+    size_t m_trace_capacity;
+    mutable std::vector<TraceEntry> m_trace;
+    mutable std::mutex m_trace_mutex;
+    // keyed on the plan and whether the clock may be read, and dropped when
+    // the bundle or built-ins change
+    mutable std::map<std::pair<Location, bool>, bool> m_decisions_cacheable;
+    // keyed on the function, and dropped along with m_decisions_cacheable
+    mutable std::map<Location, bool> m_results_shareable;
+    // keyed on the scan statement, and dropped along with
+    // m_decisions_cacheable
+    mutable std::map<const bundle::Statement*, bool> m_scans_pure;
+    mutable std::mutex m_decisions_mutex;
+    // started by the first parallel scan, and replaced when scan_workers
+    // changes
+    mutable std::shared_ptr<WorkerPool> m_pool;
+    mutable std::mutex m_pool_mutex;
   };
 
   /// @brief This class forms the main interface to the Rego library.
@@ -1505,6 +2286,22 @@ namespace rego
     /// valid.
     Node set_input_json(const std::string& json);
 
+    /// @brief Sets a projection of the input document to the interpreter.
+    /// @details
+    /// As Interpreter::set_input_json, except that only the subtrees of the
+    /// document found at the provided paths (and the objects which lead to
+    /// them) are kept. Object members which are not on any of the paths are
+    /// skipped while the document is being scanned, without building nodes
+    /// for them. The paths for an entrypoint of a bundle are given by
+    /// `bundle::Plan::input_paths`, and a projection to those paths does not
+    /// change the result of querying that entrypoint.
+    /// @param json The contents of the document.
+    /// @param paths The paths to keep.
+    /// @returns either an error node or a nullptr if the input document is
+    /// valid.
+    Node set_input_json(
+      const std::string& json, const std::vector<bundle::InputPath>& paths);
+
     /// @brief Sets the input term of the interpreter.
     /// @details
     /// The string must contain a single valid Rego data term.
@@ -1642,8 +2439,10 @@ namespace rego
     /// representing the result, which will either be a list of bindings and
     /// terms, or an error sequence.
     /// @param bundle The bundle to query
+    /// @param context If not null, cancels the query and receives its print
+    /// output and statement count (see EvalContext)
     /// @return The result of the query
-    Node query_bundle(const Bundle& bundle);
+    Node query_bundle(const Bundle& bundle, EvalContext* context = nullptr);
 
     /// @brief Performs a query against a bundle.
     /// @details
@@ -1654,8 +2453,29 @@ namespace rego
     /// of bindings and terms, or an error sequence.
     /// @param bundle The bundle to query
     /// @param endpoint The entrypoint to execute
+    /// @param context If not null, cancels the query and receives its print
+    /// output and statement count (see EvalContext)
     /// @return The result of the query
-    Node query_bundle(const Bundle& bundle, const std::string& endpoint);
+    Node query_bundle(
+      const Bundle& bundle,
+      const std::string& endpoint,
+      EvalContext* context = nullptr);
+
+    /// @brief Performs a query against several entrypoints of a bundle.
+    /// @details
+    /// The entrypoint plans are executed in a single pass over the same input,
+    /// so rules which more than one of them depends upon are only evaluated
+    /// once. Each result is the same as that returned by calling
+    /// query_bundle(bundle, endpoint) for the corresponding entrypoint.
+    /// @param bundle The bundle to query
+    /// @param endpoints The entrypoints to execute
+    /// @param context If not null, cancels the query and receives its print
+    /// output and statement count (see EvalContext)
+    /// @return The result of each query, in the order of `endpoints`
+    Nodes query_bundle_entrypoints(
+      const Bundle& bundle,
+      const std::vector<std::string>& endpoints,
+      EvalContext* context = nullptr);
 
     /// @brief The path to the debug directory.
     /// @details
@@ -1692,6 +2512,101 @@ namespace rego
     /// @return True if well-formedness checks are enabled, false otherwise.
     bool wf_check_enabled() const;
 
+    /// @brief Sets the number of threads which may evaluate a scan.
+    /// @details
+    /// See VirtualMachine::scan_workers. The default of 1 evaluates every scan
+    /// on the calling thread.
+    /// @param workers The maximum number of threads per scan
+    /// @return a reference to this Interpreter
+    Interpreter& scan_workers(size_t workers);
+
+    /// @brief Gets the maximum number of threads which may evaluate a scan.
+    /// @return The maximum number of threads per scan.
+    size_t scan_workers() const;
+
+    /// @brief Sets the maximum number of statements a query may execute.
+    /// @details
+    /// See VirtualMachine::statement_limit. The default of 0 means that there
+    /// is no limit.
+    /// @param limit The maximum number of statements per query
+    /// @return a reference to this Interpreter
+    Interpreter& statement_limit(size_t limit);
+
+    /// @brief Gets the maximum number of statements a query may execute.
+    /// @return The maximum number of statements per query.
+    size_t statement_limit() const;
+
+    /// @brief Sets whether bundle entrypoint queries return raw result values.
+    /// @details
+    /// See VirtualMachine::raw_results. This only affects query_bundle when
+    /// it is called with an entrypoint, and query_bundle_entrypoints.
+    /// @param raw True to return raw result values.
+    /// @return a reference to this Interpreter
+    Interpreter& raw_results(bool raw);
+
+    /// @brief Gets whether bundle entrypoint queries return raw result values.
+    /// @return True if raw result values are returned.
+    bool raw_results() const;
+
+    /// @brief Sets the maximum wall-clock time the evaluation of a query may
+    /// take.
+    /// @details
+    /// See VirtualMachine::statement_limit. The default of 0 means that there
+    /// is no limit.
+    /// @param limit The maximum duration of an evaluation
+    /// @return a reference to this Interpreter
+    Interpreter& time_limit(std::chrono::milliseconds limit);
+
+    /// @brief Gets the maximum wall-clock time the evaluation of a query may
+    /// take.
+    /// @return The maximum duration of an evaluation.
+    std::chrono::milliseconds time_limit() const;
+
+    /// @brief Cancels the query being evaluated on another thread.
+    /// @details
+    /// See VirtualMachine::cancel. A query which has not yet started is not
+    /// affected.
+    void cancel();
+
+    /// @brief The number of statements executed by the most recent query.
+    /// @details
+    /// Pass an EvalContext to the query to receive the count with its result
+    /// instead.
+    /// @return The number of statements executed.
+    size_t statement_count() const;
+
+    /// @brief The lines printed by the most recent query.
+    /// @details
+    /// Lines are only collected when the print mode is PrintMode::Buffer (see
+    /// BuiltInsDef::print_mode). Pass an EvalContext to the query to receive
+    /// them with its result instead.
+    /// @return The printed lines, in order.
+    const std::vector<std::string>& print_output() const;
+
+    /// @brief Sets the number of statements kept in the execution trace.
+    /// @details
+    /// See VirtualMachine::trace_capacity. The default of 0 disables the
+    /// trace.
+    /// @param capacity The maximum number of entries to keep
+    /// @return a reference to this Interpreter
+    Interpreter& trace_capacity(size_t capacity);
+
+    /// @brief Gets the number of statements kept in the execution trace.
+    /// @return The maximum number of entries kept.
+    size_t trace_capacity() const;
+
+    /// @brief Writes the execution trace of the most recent query to a stream.
+    /// @details
+    /// See VirtualMachine::save_trace.
+    /// @param stream The stream to write to
+    void save_trace(std::ostream& stream) const;
+
+    /// @brief Writes the execution trace of the most recent query as text.
+    /// @details
+    /// See VirtualMachine::print_trace.
+    /// @param stream The stream to write to
+    void print_trace(std::ostream& stream) const;
+
     /// @brief The built-ins used by the interpreter.
     /// @details
     /// This object can be used to register custom built-ins created using
@@ -1764,6 +2679,8 @@ namespace rego
     std::unique_ptr<Rewriter> m_write_bundle;
     std::unique_ptr<Rewriter> m_read_bundle;
     VirtualMachine m_vm;
+    std::vector<std::string> m_print_output;
+    std::size_t m_statement_count;
     std::size_t m_data_count;
     std::map<std::string, Node> m_cache;
 
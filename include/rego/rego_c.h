@@ -40,6 +40,10 @@ typedef int_least64_t regoInt;
 /// @brief Node Type type
 typedef uint_least32_t regoType;
 
+/// Receives each line written by the print built-in (see
+/// ::regoSetPrintCallback).
+typedef void (*regoPrintCallback)(void* context, const char* line);
+
 /// @cond
 // error codes
 #define REGO_OK 0
@@ -50,6 +54,7 @@ typedef uint_least32_t regoType;
 #define REGO_ERROR_INPUT_NULL 5
 #define REGO_ERROR_INPUT_MISSING_ARGUMENTS 6
 #define REGO_ERROR_INPUT_OBJECT_ITEM 7
+#define REGO_ERROR_EVAL_CANCELLED 8
 
 // term node types
 #define REGO_NODE_BINDING 1000
@@ -90,6 +95,11 @@ typedef uint_least32_t regoType;
 #define REGO_LOG_LEVEL_TRACE 6
 #define REGO_LOG_LEVEL_UNSUPPORTED 7
 
+#define REGO_PRINT_STDOUT 0
+#define REGO_PRINT_BUFFER 1
+#define REGO_PRINT_CALLBACK 2
+#define REGO_PRINT_DISCARD 3
+
 #define REGO_BUILD_INFO \
   (REGOCPP_VERSION " (" REGOCPP_BUILD_NAME ", " REGOCPP_BUILD_DATE \
                    ") " REGOCPP_BUILD_TOOLCHAIN " on " REGOCPP_PLATFORM)
@@ -357,6 +367,145 @@ extern "C"
   /// @return Whether strict built-in errors are enabled.
   REGO_API(regoBoolean) regoGetStrictBuiltInErrors(regoInterpreter* rego);
 
+  /// @brief Sets where the output of the print built-in is sent.
+  /// @details
+  /// The mode is one of REGO_PRINT_STDOUT (the default), REGO_PRINT_BUFFER,
+  /// REGO_PRINT_CALLBACK or REGO_PRINT_DISCARD. In buffer mode, the lines
+  /// printed by each query are returned with its output, and can be read
+  /// with ::regoOutputPrint (or with ::regoPrintOutput for the most recent
+  /// query made with the interpreter). In discard mode the arguments to print
+  /// are not serialised at all. Callback mode requires a callback set with
+  /// ::regoSetPrintCallback.
+  /// @param rego The interpreter.
+  /// @param mode The print mode.
+  /// @return REGO_OK if successful, REGO_ERROR if the mode is not valid.
+  REGO_API(regoEnum) regoSetPrintMode(regoInterpreter* rego, regoEnum mode);
+
+  /// @brief Gets where the output of the print built-in is sent.
+  /// @param rego The interpreter.
+  /// @return The print mode.
+  REGO_API(regoEnum) regoGetPrintMode(regoInterpreter* rego);
+
+  /// @brief Sends the output of the print built-in to a callback.
+  /// @details
+  /// This also sets the print mode to REGO_PRINT_CALLBACK. The callback is
+  /// called once for each line, with a string which is only valid for the
+  /// duration of the call, and may be called from any thread evaluating a
+  /// query.
+  /// @param rego The interpreter.
+  /// @param callback The callback.
+  /// @param context A pointer which is passed to each call of the callback.
+  REGO_API(void)
+  regoSetPrintCallback(
+    regoInterpreter* rego, regoPrintCallback callback, void* context);
+
+  /// @brief Returns the number of bytes needed to store the output of the
+  /// print built-in from the most recent query.
+  /// @param rego The interpreter.
+  /// @return The size of the buffer needed by ::regoPrintOutput.
+  REGO_API(regoSize) regoPrintOutputSize(regoInterpreter* rego);
+
+  /// @brief Gets the output of the print built-in from the most recent query.
+  /// @details
+  /// Output is only collected when the print mode is REGO_PRINT_BUFFER. Each
+  /// line is terminated by a newline character.
+  /// @param rego The interpreter.
+  /// @param buffer The buffer to store the output in.
+  /// @param size The size of the buffer.
+  /// @return REGO_OK if successful, REGO_ERROR_BUFFER_TOO_SMALL otherwise.
+  REGO_API(regoEnum)
+  regoPrintOutput(regoInterpreter* rego, char* buffer, regoSize size);
+
+  /// @brief Sets whether bundle entrypoint queries return raw result values.
+  /// @details
+  /// When enabled, the output of ::regoBundleQueryEntrypoint and
+  /// ::regoBundleQueryEntrypoints holds the result value itself, rather than
+  /// a list of results with their expressions and bindings. This avoids the
+  /// cost of building the full output, and the value can be read directly
+  /// with ::regoOutputBoolean, ::regoOutputInt, ::regoOutputFloat or
+  /// ::regoOutputString. Errors and undefined results are reported as before.
+  /// @param rego The interpreter.
+  /// @param enabled Whether raw results should be returned.
+  REGO_API(void) regoSetRawResults(regoInterpreter* rego, regoBoolean enabled);
+
+  /// @brief Gets whether bundle entrypoint queries return raw result values.
+  /// @param rego The interpreter.
+  /// @return Whether raw results are returned.
+  REGO_API(regoBoolean) regoGetRawResults(regoInterpreter* rego);
+
+  /// @brief Sets the maximum number of statements a query may execute.
+  /// @details
+  /// A query which exceeds this limit, which runs for longer than the time
+  /// limit (see ::regoSetTimeLimit), or which is cancelled (see ::regoCancel)
+  /// produces an output whose status is REGO_ERROR_EVAL_CANCELLED (see
+  /// ::regoOutputStatus). A limit of 0 (the default) means no limit.
+  /// @param rego The interpreter.
+  /// @param limit The maximum number of statements per query.
+  REGO_API(void) regoSetStatementLimit(regoInterpreter* rego, regoSize limit);
+
+  /// @brief Gets the maximum number of statements a query may execute.
+  /// @param rego The interpreter.
+  /// @return The maximum number of statements per query (0 for no limit).
+  REGO_API(regoSize) regoGetStatementLimit(regoInterpreter* rego);
+
+  /// @brief Sets the maximum wall-clock time the evaluation of a query may
+  /// take.
+  /// @details
+  /// See ::regoSetStatementLimit. A limit of 0 (the default) means no limit.
+  /// @param rego The interpreter.
+  /// @param milliseconds The maximum duration of an evaluation.
+  REGO_API(void)
+  regoSetTimeLimit(regoInterpreter* rego, regoSize milliseconds);
+
+  /// @brief Gets the maximum wall-clock time the evaluation of a query may
+  /// take.
+  /// @param rego The interpreter.
+  /// @return The maximum duration in milliseconds (0 for no limit).
+  REGO_API(regoSize) regoGetTimeLimit(regoInterpreter* rego);
+
+  /// @brief Cancels the query being evaluated by the interpreter.
+  /// @details
+  /// This is the only interpreter function which may be called while another
+  /// thread is running a query. The evaluation stops the next time it checks
+  /// its limits. A query which has not yet started is not affected.
+  /// @param rego The interpreter.
+  REGO_API(void) regoCancel(regoInterpreter* rego);
+
+  /// @brief Returns the number of statements executed by the most recent
+  /// query.
+  /// @details
+  /// See also ::regoOutputStatementCount, which is unaffected by later
+  /// queries.
+  /// @param rego The interpreter.
+  /// @return The number of statements executed.
+  REGO_API(regoInt) regoGetStatementCount(regoInterpreter* rego);
+
+  /// @brief Sets the number of statements kept in the execution trace.
+  /// @details
+  /// When this is non-zero, the interpreter records the last statements
+  /// executed by each query (with their outcomes and timings) so that they
+  /// can be saved with ::regoSaveTrace, e.g. after a query fails. The default
+  /// of 0 disables the trace.
+  /// @param rego The interpreter.
+  /// @param capacity The maximum number of entries to keep.
+  REGO_API(void) regoSetTraceCapacity(regoInterpreter* rego, regoSize capacity);
+
+  /// @brief Gets the number of statements kept in the execution trace.
+  /// @param rego The interpreter.
+  /// @return The maximum number of entries kept.
+  REGO_API(regoSize) regoGetTraceCapacity(regoInterpreter* rego);
+
+  /// @brief Saves the execution trace of the most recent query to a file.
+  /// @details
+  /// The trace is saved in a compact binary form which refers to the
+  /// statements of the bundle by id. It can be decoded to the source
+  /// locations of those statements with `rego run --decode-trace`, given
+  /// the same bundle.
+  /// @param rego The interpreter.
+  /// @param path The path to the file to write.
+  /// @return REGO_OK if successful, REGO_ERROR otherwise.
+  REGO_API(regoEnum) regoSaveTrace(regoInterpreter* rego, const char* path);
+
   /// @brief Returns whether the specified name corresponds to an available
   /// built-in in the interpreter.
   /// @param rego The interpreter.
@@ -496,6 +645,85 @@ extern "C"
   regoBundleQueryEntrypoint(
     regoInterpreter* rego, regoBundle* bundle, const char* endpoint);
 
+  /// @brief Performs queries against several entrypoints of the specified
+  /// bundle in a single pass.
+  /// @details
+  /// Rules which are shared by the entrypoints are only evaluated once. The
+  /// output of each query is written to the corresponding element of
+  /// `outputs`, and is the same as would be returned by
+  /// ::regoBundleQueryEntrypoint for that entrypoint.
+  /// @note The caller is responsible for freeing each output object with
+  /// ::regoFreeOutput.
+  /// @param rego The interpreter.
+  /// @param bundle The bundle to query.
+  /// @param endpoints The entrypoints to query.
+  /// @param count The number of entrypoints.
+  /// @param outputs An array of `count` elements which receives the outputs.
+  /// @return Returns REGO_OK if successful, REGO_ERROR otherwise.
+  REGO_API(regoEnum)
+  regoBundleQueryEntrypoints(
+    regoInterpreter* rego,
+    regoBundle* bundle,
+    const char** endpoints,
+    regoSize count,
+    regoOutput** outputs);
+
+  /// @brief Returns the number of bytes needed to store the input paths of
+  /// the specified entrypoint.
+  /// @param rego The interpreter.
+  /// @param bundle The bundle.
+  /// @param endpoint The entrypoint.
+  /// @return The size of the buffer needed by ::regoBundleInputPaths, or 0 if
+  /// the entrypoint does not exist.
+  REGO_API(regoSize)
+  regoBundleInputPathsSize(
+    regoInterpreter* rego, regoBundle* bundle, const char* endpoint);
+
+  /// @brief Populates the buffer with the input paths of the specified
+  /// entrypoint.
+  /// @details
+  /// The paths are those which the entrypoint can possibly read from the
+  /// input document, encoded as a JSON array of arrays of object keys (e.g.
+  /// `[["request","kind"],["request","object","spec"]]`). Only the subtrees
+  /// at these paths need to be provided in the input. An empty path means
+  /// that the whole input may be read. The buffer must be large enough to
+  /// hold the value. The size of the buffer can be determined by calling
+  /// ::regoBundleInputPathsSize.
+  /// @param rego The interpreter.
+  /// @param bundle The bundle.
+  /// @param endpoint The entrypoint.
+  /// @param buffer The buffer to populate.
+  /// @param size The size of the buffer.
+  /// @return Returns REGO_OK if successful, REGO_ERROR_BUFFER_TOO_SMALL if the
+  /// buffer is too small, or REGO_ERROR if the entrypoint does not exist.
+  REGO_API(regoEnum)
+  regoBundleInputPaths(
+    regoInterpreter* rego,
+    regoBundle* bundle,
+    const char* endpoint,
+    char* buffer,
+    regoSize size);
+
+  /// @brief Sets the input document for querying the specified entrypoint.
+  /// @details
+  /// The contents must be a JSON document. Only the parts of it which the
+  /// entrypoint can read (see ::regoBundleInputPaths) are parsed, and the
+  /// rest are skipped. The input will give the same results as if it had
+  /// been set in full when querying this entrypoint, but not necessarily when
+  /// querying others.
+  /// @param rego The interpreter.
+  /// @param bundle The bundle.
+  /// @param endpoint The entrypoint.
+  /// @param contents The JSON document.
+  /// @return Returns REGO_OK if successful or REGO_ERROR if the entrypoint
+  /// does not exist or the document is invalid.
+  REGO_API(regoEnum)
+  regoBundleSetInputJSON(
+    regoInterpreter* rego,
+    regoBundle* bundle,
+    const char* endpoint,
+    const char* contents);
+
   ////////////////////////////////////////
   // -------- Output functions -------- //
   ////////////////////////////////////////
@@ -509,6 +737,15 @@ extern "C"
   /// @return Whether the output is ok.
   REGO_API(regoBoolean) regoOutputOk(regoOutput* output);
 
+  /// @brief Returns the status of the output.
+  /// @details
+  /// This distinguishes evaluations which were stopped by a limit or by
+  /// cancellation from those which failed for other reasons.
+  /// @param output The output.
+  /// @return REGO_OK if the output is ok, REGO_ERROR_EVAL_CANCELLED if the
+  /// evaluation was stopped early, and REGO_ERROR otherwise.
+  REGO_API(regoEnum) regoOutputStatus(regoOutput* output);
+
   /// @brief Returns the number of results in the output.
   /// @details
   /// Each query can potentially generate multiple results.
@@ -517,16 +754,21 @@ extern "C"
 
   /// @brief Returns a node containing a list of terms resulting from the query
   /// at the specified index.
+  /// @details
+  /// This returns NULL if the output is an error, is undefined, holds raw
+  /// results (see regoSetRawResults), or has no result at the index.
   /// @param output The output.
   /// @param index The result index.
-  /// @return The output node.
+  /// @return The output node (or NULL, see above).
   REGO_API(regoNode*)
   regoOutputExpressionsAtIndex(regoOutput* output, regoSize index);
 
   /// @brief Returns a node containing a list of terms resulting from the query
   /// at the default index.
+  /// @details
+  /// This returns NULL in the same cases as regoOutputExpressionsAtIndex.
   /// @param output The output.
-  /// @return The output node.
+  /// @return The output node (or NULL).
   REGO_API(regoNode*) regoOutputExpressions(regoOutput* output);
 
   /// @brief Returns the node containing the output of the query.
@@ -537,9 +779,36 @@ extern "C"
   /// @return The output node.
   REGO_API(regoNode*) regoOutputNode(regoOutput* output);
 
+  /// @brief Returns the number of bytes needed to store the output of the
+  /// print built-in from the query which produced this output.
+  /// @param output The output.
+  /// @return The size of the buffer needed by ::regoOutputPrint.
+  REGO_API(regoSize) regoOutputPrintSize(regoOutput* output);
+
+  /// @brief Gets the output of the print built-in from the query which
+  /// produced this output.
+  /// @details
+  /// Output is only collected when the print mode is REGO_PRINT_BUFFER. Each
+  /// line is terminated by a newline character. Unlike ::regoPrintOutput,
+  /// this is unaffected by later queries.
+  /// @param output The output.
+  /// @param buffer The buffer to store the output in.
+  /// @param size The size of the buffer.
+  /// @return REGO_OK if successful, REGO_ERROR_BUFFER_TOO_SMALL otherwise.
+  REGO_API(regoEnum)
+  regoOutputPrint(regoOutput* output, char* buffer, regoSize size);
+
+  /// @brief Returns the number of statements executed by the query which
+  /// produced this output.
+  /// @param output The output.
+  /// @return The number of statements executed.
+  REGO_API(regoInt) regoOutputStatementCount(regoOutput* output);
+
   /// @brief Returns the bound value for a given variable name.
   /// @details
-  /// If the variable is not bound, then this function will return NULL.
+  /// If the variable is not bound, then this function will return NULL. It
+  /// also returns NULL if the output is an error, is undefined, holds raw
+  /// results (see regoSetRawResults), or has no result at the index.
   /// @param output The output.
   /// @param index The result index.
   /// @param name The variable name.
@@ -551,12 +820,59 @@ extern "C"
   /// @brief Returns the bound value for a given variable name at the first
   /// index.
   /// @details
-  /// If the variable is not bound, then this function will return NULL.
+  /// This returns NULL in the same cases as regoOutputBindingAtIndex.
   /// @param output The output.
   /// @param name The variable name.
   /// @return The bound value (or NULL if the variable was not bound)
   REGO_API(regoNode*) regoOutputBinding(regoOutput* output, const char* name);
 
+  /// @brief Gets the first result value of the output as a boolean.
+  /// @details
+  /// This reads the value directly, without formatting the output as JSON.
+  /// The first result value is the first expression of the first result, or
+  /// the result itself if the output holds raw results (see
+  /// ::regoSetRawResults).
+  /// @param output The output.
+  /// @param value Receives the value.
+  /// @return REGO_OK if successful, REGO_ERROR if the value is not a boolean.
+  REGO_API(regoEnum) regoOutputBoolean(regoOutput* output, regoBoolean* value);
+
+  /// @brief Gets the first result value of the output as an integer.
+  /// @details
+  /// See ::regoOutputBoolean.
+  /// @param output The output.
+  /// @param value Receives the value.
+  /// @return REGO_OK if successful, REGO_ERROR if the value is not an integer
+  /// or is too large to be represented as a regoInt.
+  REGO_API(regoEnum) regoOutputInt(regoOutput* output, regoInt* value);
+
+  /// @brief Gets the first result value of the output as a floating point
+  /// number.
+  /// @details
+  /// See ::regoOutputBoolean. Integer values are converted.
+  /// @param output The output.
+  /// @param value Receives the value.
+  /// @return REGO_OK if successful, REGO_ERROR if the value is not a number.
+  REGO_API(regoEnum) regoOutputFloat(regoOutput* output, double* value);
+
+  /// @brief Returns the number of bytes needed to store the first result
+  /// value of the output, if it is a string.
+  /// @param output The output.
+  /// @return The size of the buffer needed by ::regoOutputString, or 0 if the
+  /// value is not a string.
+  REGO_API(regoSize) regoOutputStringSize(regoOutput* output);
+
+  /// @brief Gets the first result value of the output as a string.
+  /// @details
+  /// See ::regoOutputBoolean. The string is not quoted or escaped.
+  /// @param output The output.
+  /// @param buffer The buffer to populate.
+  /// @param size The size of the buffer.
+  /// @return REGO_OK if successful, REGO_ERROR if the value is not a string,
+  /// and REGO_ERROR_BUFFER_TOO_SMALL if the buffer is too small.
+  REGO_API(regoEnum)
+  regoOutputString(regoOutput* output, char* buffer, regoSize size);
+
   /// @brief Returns the number of bytes needed to store a 0-terminated string
   /// representing the output as a human-readable string.
   /// @details
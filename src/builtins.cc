@@ -3,6 +3,7 @@
 #include "internal.hh"
 #include "rego.hh"
 
+#include <cstdio>
 #include <stdexcept>
 
 namespace
@@ -10,6 +11,9 @@ namespace
   using namespace rego;
   namespace bi = rego::builtins;
 
+  // where the print built-ins buffer lines (see PrintOutputScope)
+  thread_local std::vector<std::string>* current_print_output = nullptr;
+
   Node opa_runtime(const Nodes&)
   {
     return version();
@@ -28,47 +32,45 @@ namespace
             << (bi::DynamicObject << (bi::Type << bi::String)
                                   << (bi::Type << bi::Any))));
 
-  Node print(const Nodes& args)
-  {
-    for (auto arg : args)
-    {
-      if (arg->type() == Undefined)
-      {
-        return Resolver::scalar(false);
-      }
-    }
-
-    join(
-      std::cout,
-      args.begin(),
-      args.end(),
-      " ",
-      [](std::ostream& stream, const Node& n) {
-        stream << to_key(n);
-        return true;
-      })
-      << std::endl;
-    return Resolver::scalar(true);
-  }
-
   Node print_decl = bi::Decl << bi::VarArgs << bi::Void;
 
+  Node internal_print_decl =
+    bi::Decl << (bi::ArgSeq
+                 << (bi::Arg << bi::Name << bi::Description
+                             << (bi::Type
+                                 << (bi::DynamicArray
+                                     << (bi::Type << (bi::Set << bi::Any))))))
+             << bi::Void;
+
   Node walk(const Nodes& args)
   {
-    Node x = args[0];
+    // each step records the step it was reached from, so that paths can be
+    // assembled without copying the whole prefix for every child.
+    struct Step
+    {
+      size_t parent;
+      Node key;
+      Node value;
+    };
+
+    std::vector<Step> steps;
+    steps.push_back({0, nullptr, args[0]});
 
     Node result = NodeDef::create(Array);
-    std::deque<std::pair<Nodes, Node>> queue;
-    queue.push_back({{}, x});
-    while (!queue.empty())
+    for (size_t i = 0; i < steps.size(); ++i)
     {
-      auto [path_nodes, current] = queue.front();
-      queue.pop_front();
+      Node current = steps[i].value;
+
+      Nodes path_nodes;
+      for (size_t j = i; j != 0; j = steps[j].parent)
+      {
+        path_nodes.push_back(steps[j].key);
+      }
 
       Node path_array = NodeDef::create(Array);
-      for (auto& node : path_nodes)
+      for (auto it = path_nodes.rbegin(); it != path_nodes.rend(); ++it)
       {
-        path_array->push_back(Resolver::to_term(node->clone()));
+        path_array->push_back(Resolver::to_term((*it)->clone()));
       }
 
       result
@@ -85,30 +87,23 @@ namespace
       current = maybe_node.node;
       if (current == Array)
       {
-        for (size_t i = 0; i < current->size(); i++)
+        for (size_t j = 0; j < current->size(); j++)
         {
-          Node index = Resolver::term(BigInt(i));
-          Nodes path(path_nodes);
-          path.push_back(index);
-          queue.push_back({path, current->at(i)});
+          steps.push_back({i, Resolver::term(BigInt(j)), current->at(j)});
         }
       }
       else if (current == Set)
       {
         for (auto child : *current)
         {
-          Nodes path(path_nodes);
-          path.push_back(child);
-          queue.push_back({path, child});
+          steps.push_back({i, child, child});
         }
       }
       else if (current == Object)
       {
         for (auto child : *current)
         {
-          Nodes path(path_nodes);
-          path.push_back(child / Key);
-          queue.push_back({path, child / Val});
+          steps.push_back({i, child / Key, child / Val});
         }
       }
     }
@@ -156,6 +151,92 @@ namespace
 
 namespace rego
 {
+  PrintSink::PrintSink() : m_mode(PrintMode::Stdout) {}
+
+  PrintMode PrintSink::mode() const
+  {
+    return m_mode;
+  }
+
+  void PrintSink::mode(PrintMode mode)
+  {
+    m_mode = mode;
+  }
+
+  void PrintSink::handler(PrintHandler handler)
+  {
+    std::atomic_store(
+      &m_handler, std::make_shared<const PrintHandler>(std::move(handler)));
+    m_mode = PrintMode::Callback;
+  }
+
+  PrintOutputScope::PrintOutputScope(std::vector<std::string>* output) :
+    m_previous(current_print_output)
+  {
+    current_print_output = output;
+  }
+
+  PrintOutputScope::~PrintOutputScope()
+  {
+    current_print_output = m_previous;
+  }
+
+  Node PrintSink::print(const Nodes& args)
+  {
+    for (auto arg : args)
+    {
+      if (arg->type() == Undefined)
+      {
+        return Resolver::scalar(false);
+      }
+    }
+
+    PrintMode mode = m_mode;
+    if (mode == PrintMode::Discard)
+    {
+      return Resolver::scalar(true);
+    }
+
+    std::string line;
+    for (auto& arg : args)
+    {
+      if (!line.empty())
+      {
+        line.push_back(' ');
+      }
+      line += to_key(arg);
+    }
+
+    switch (mode)
+    {
+      case PrintMode::Buffer:
+        if (current_print_output != nullptr)
+        {
+          current_print_output->push_back(std::move(line));
+        }
+        break;
+
+      case PrintMode::Callback: {
+        auto handler = std::atomic_load(&m_handler);
+        if (handler != nullptr && *handler)
+        {
+          (*handler)(line);
+        }
+        break;
+      }
+
+      default:
+        // one write per line, so that lines printed by different threads
+        // are not interleaved, and no flush: standard output is flushed by
+        // its own buffering policy
+        line.push_back('\n');
+        std::fwrite(line.data(), 1, line.size(), stdout);
+        break;
+    }
+
+    return Resolver::scalar(true);
+  }
+
   BuiltInDef::BuiltInDef(
     Location name_, Node decl_, BuiltInBehavior behavior_, bool available_)
   {
@@ -178,6 +259,7 @@ namespace rego
     decl = decl_;
     behavior = behavior_;
     available = available_;
+    pure = false;
   }
 
   void BuiltInDef::clear() {}
@@ -219,8 +301,43 @@ namespace rego
     {
       builtin.second->clear();
     }
+
+    clear_rune_indexes();
+  }
+
+  PrintSink& BuiltInsDef::print_sink()
+  {
+    if (m_print_sink == nullptr)
+    {
+      m_print_sink = std::make_shared<PrintSink>();
+    }
+
+    return *m_print_sink;
+  }
+
+  PrintMode BuiltInsDef::print_mode() const
+  {
+    if (m_print_sink == nullptr)
+    {
+      return PrintMode::Stdout;
+    }
+
+    return m_print_sink->mode();
   }
 
+  BuiltInsDef& BuiltInsDef::print_mode(PrintMode mode)
+  {
+    print_sink().mode(mode);
+    return *this;
+  }
+
+  BuiltInsDef& BuiltInsDef::print_handler(PrintHandler handler)
+  {
+    print_sink().handler(handler);
+    return *this;
+  }
+
+
   bool BuiltInsDef::strict_errors() const
   {
     return m_strict_errors;
@@ -301,17 +418,22 @@ namespace rego
       }
     }
 
-    Node result = builtin->behavior(args);
+    if (m_strict_errors)
+    {
+      return builtin->behavior(args);
+    }
+
+    // the error (if any) will be replaced by Undefined, so there is no need
+    // for the built-in to describe it
+    Node result;
+    {
+      DiscardErrors discard;
+      result = builtin->behavior(args);
+    }
+
     if (result->type() == Error)
     {
-      if (m_strict_errors)
-      {
-        return result;
-      }
-      else
-      {
-        return Undefined;
-      }
+      return Undefined;
     }
 
     return result;
@@ -325,31 +447,64 @@ namespace rego
 
   BuiltInsDef& BuiltInsDef::register_standard_builtins()
   {
-    register_builtins<std::initializer_list<BuiltIn>>({
-      BuiltInDef::create(Location("print"), print_decl, ::print),
-      BuiltInDef::create(
-        Location("opa.runtime"), opa_runtime_decl, ::opa_runtime),
-      BuiltInDef::create(Location("walk"), walk_decl, ::walk),
-    });
-
-    register_builtins(builtins::aggregates());
-    register_builtins(builtins::arrays());
-    register_builtins(builtins::bits());
-    register_builtins(builtins::comparison());
-    register_builtins(builtins::conversions());
-    register_builtins(builtins::encoding());
-    register_builtins(builtins::graph());
-    register_builtins(builtins::internal());
-    register_builtins(builtins::numbers());
-    register_builtins(builtins::objects());
-    register_builtins(builtins::regex());
-    register_builtins(builtins::sets());
-    register_builtins(builtins::semver());
-    register_builtins(builtins::strings());
-    register_builtins(builtins::time());
-    register_builtins(builtins::types());
-    register_builtins(builtins::units());
-    register_builtins(builtins::uuid());
+    // all of the standard built-ins are deterministic, apart from these
+    const std::set<std::string_view> impure = {
+      "internal.print",
+      "internal.walk_paths",
+      "internal.walk_values",
+      "opa.runtime",
+      "print",
+      "rand.intn",
+      "time.now_ns",
+      "uuid.rfc4122"};
+
+    // both forms of print write to the sink, so that where their output goes
+    // can be changed after they are registered
+    print_sink();
+    std::shared_ptr<PrintSink> sink = m_print_sink;
+    BuiltInBehavior print = [sink](const Nodes& args) {
+      return sink->print(args);
+    };
+
+    std::vector<std::vector<BuiltIn>> groups = {
+      {
+        BuiltInDef::create(Location("print"), print_decl, print),
+        BuiltInDef::create(
+          Location("internal.print"), internal_print_decl, print),
+        BuiltInDef::create(
+          Location("opa.runtime"), opa_runtime_decl, ::opa_runtime),
+        BuiltInDef::create(Location("walk"), walk_decl, ::walk),
+      },
+      builtins::aggregates(),
+      builtins::arrays(),
+      builtins::bits(),
+      builtins::comparison(),
+      builtins::conversions(),
+      builtins::encoding(),
+      builtins::graph(),
+      builtins::internal(),
+      builtins::numbers(),
+      builtins::objects(),
+      builtins::regex(),
+      builtins::sets(),
+      builtins::semver(),
+      builtins::strings(),
+      builtins::time(),
+      builtins::types(),
+      builtins::units(),
+      builtins::uuid(),
+    };
+
+    for (auto& group : groups)
+    {
+      for (auto& builtin : group)
+      {
+        builtin->pure =
+          builtin->available && !impure.contains(builtin->name.view());
+      }
+
+      register_builtins(group);
+    }
 
     return *this;
   }
@@ -1,10 +1,7 @@
 #include "builtins.h"
-#include "trieste/utf8.h"
-
 namespace
 {
   using namespace rego;
-  using namespace trieste::utf8;
   namespace bi = rego::builtins;
 
   Node count(const Nodes& args)
@@ -18,9 +15,7 @@ namespace
 
     if (collection->type() == JSONString)
     {
-      std::string collection_str = get_string(collection);
-      runestring collection_runes = utf8_to_runestring(collection_str);
-      return Resolver::scalar(BigInt(collection_runes.size()));
+      return Resolver::scalar(BigInt(rune_index(collection).size()));
     }
 
     return Resolver::scalar(BigInt(collection->size()));
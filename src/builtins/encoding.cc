@@ -226,10 +226,13 @@ namespace
           continue;
         }
 
-        std::ostringstream error;
-        error << "invalid byte: U+" << std::hex << std::setw(4)
-              << std::setfill('0') << (int)hex << " '" << hex << "'";
-        return err(x_string_node, error.str(), EvalBuiltInError);
+        auto message = [hex]() {
+          std::ostringstream error;
+          error << "invalid byte: U+" << std::hex << std::setw(4)
+                << std::setfill('0') << (int)hex << " '" << hex << "'";
+          return error.str();
+        };
+        return err(x_string_node, message, EvalBuiltInError);
       }
 
       decoded << (char)test;
@@ -248,7 +251,8 @@ namespace
 
   Node json_marshal(const Nodes& args)
   {
-    Node x = Resolver::to_term(args[0]);
+    // the rewrite below works in place, so it needs its own copy
+    Node x = Resolver::to_term(args[0]->clone());
     if (x->type() == Error)
     {
       return x;
@@ -278,7 +282,8 @@ namespace
 
   Node json_marshal_with_options(const Nodes& args)
   {
-    Node x = Resolver::to_term(args[0]);
+    // the rewrite below works in place, so it needs its own copy
+    Node x = Resolver::to_term(args[0]->clone());
     if (x->type() == Error)
     {
       return x;
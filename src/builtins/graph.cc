@@ -96,6 +96,7 @@ namespace
 
     while (!frontier.empty())
     {
+      poll_eval_limits();
       std::string_view current = frontier.back();
       frontier.pop_back();
       if (visited.contains(current))
@@ -262,6 +263,7 @@ namespace
 
     while (!frontier.empty())
     {
+      poll_eval_limits();
       Path path = std::move(frontier.back());
       frontier.pop_back();
 
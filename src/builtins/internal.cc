@@ -1,15 +1,147 @@
 #include "builtins.h"
 
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
 namespace
 {
   using namespace rego;
   namespace bi = rego::builtins;
 
-  Node member_2(const Nodes& args)
+  // Collections at least this large are indexed for membership tests.
+  const size_t MinIndexedCollectionSize = 32;
+  // The number of indexes kept by the cache.
+  const size_t MembershipCacheSize = 8;
+
+  const std::string MembershipIndexKind = "membership";
+
+  struct StructuralHash
+  {
+    size_t operator()(const Node& node) const
+    {
+      return structural_hash(node);
+    }
+  };
+
+  struct StructuralEqual
+  {
+    bool operator()(const Node& lhs, const Node& rhs) const
+    {
+      return structural_equal(lhs, rhs);
+    }
+  };
+
+  // Resolver::membership compares a Float by its value (so that 1.0 is in
+  // [1]), while structural equality compares its text, so values holding a
+  // Float are looked up the slow way.
+  bool has_float(const Node& node)
   {
-    Node item = args[0];
-    Node itemseq = args[1];
-    return Resolver::membership(item, itemseq);
+    if (node == Float)
+    {
+      return true;
+    }
+
+    return std::any_of(node->begin(), node->end(), has_float);
+  }
+
+  struct MembershipIndex
+  {
+    // false if a member holds a Float, in which case the index is empty
+    bool usable = true;
+    // the members (or object values) of the collection
+    std::unordered_set<Node, StructuralHash, StructuralEqual> values;
+    // for objects, the value stored under each object key
+    std::unordered_map<Node, Node, StructuralHash, StructuralEqual> entries;
+  };
+
+  // Membership tests against large collections (typically allow-lists held
+  // in data, probed once per input item) are answered from a hash index of
+  // the collection, built on the first test. An index over data is kept by
+  // the bundle and reused by every evaluation, while one over any other
+  // collection is reused by later tests in the same evaluation.
+  thread_local IdentityCache<std::shared_ptr<const MembershipIndex>>
+    membership_indexes(MembershipCacheSize);
+
+  std::shared_ptr<const MembershipIndex> build_index(const Node& collection)
+  {
+    auto index = std::make_shared<MembershipIndex>();
+    if (has_float(collection))
+    {
+      index->usable = false;
+      return index;
+    }
+
+    if (collection->type() == Object)
+    {
+      for (auto& objectitem : *collection)
+      {
+        Node value = objectitem / Val;
+        index->entries.insert({objectitem / Key, value});
+        index->values.insert(value);
+      }
+    }
+    else
+    {
+      index->values.insert(collection->begin(), collection->end());
+    }
+
+    return index;
+  }
+
+  std::shared_ptr<const MembershipIndex> find_index(const Node& collection)
+  {
+    if (collection->size() < MinIndexedCollectionSize)
+    {
+      return nullptr;
+    }
+
+    bundle::DataIndexCache* shared = data_index_cache(collection);
+    std::shared_ptr<const MembershipIndex> index;
+    if (shared != nullptr)
+    {
+      index = std::static_pointer_cast<const MembershipIndex>(
+        shared->find(collection, MembershipIndexKind));
+      if (index == nullptr)
+      {
+        index = std::static_pointer_cast<const MembershipIndex>(
+          shared->insert(
+            collection, MembershipIndexKind, build_index(collection)));
+      }
+    }
+    else
+    {
+      auto cached = membership_indexes.find(collection);
+      if (cached != nullptr)
+      {
+        index = *cached;
+      }
+      else
+      {
+        index = build_index(collection);
+        membership_indexes.insert(collection, index);
+      }
+    }
+
+    return index->usable ? index : nullptr;
+  }
+
+  Node unwrap_collection(Node itemseq)
+  {
+    if (itemseq->type() == Term)
+    {
+      itemseq = itemseq->front();
+    }
+
+    if (
+      itemseq->type() == Array || itemseq->type() == Set ||
+      itemseq->type() == Object)
+    {
+      return itemseq;
+    }
+
+    return nullptr;
   }
 
   const Node member_2_decl = bi::Decl
@@ -22,14 +154,6 @@ namespace
                        "true if `item` is a member of `itemseq`")
                    << (bi::Type << bi::Boolean));
 
-  Node member_3(const Nodes& args)
-  {
-    Node index = args[0];
-    Node item = args[1];
-    Node itemseq = args[2];
-    return Resolver::membership(index, item, itemseq);
-  }
-
   const Node member_3_decl = bi::Decl
     << (bi::ArgSeq << (bi::Arg << (bi::Name ^ "index") << bi::Description
                                << (bi::Type << bi::Any))
@@ -42,37 +166,101 @@ namespace
                        "true if (`index`, `item`) is a member of `itemseq`")
                    << (bi::Type << bi::Boolean));
 
-  Node print(const Nodes& args)
+  struct Member2 : public BuiltInDef
   {
-    // TODO implement this properly
-    for (auto arg : args)
+    Member2() :
+      BuiltInDef(
+        Location("internal.member_2"),
+        member_2_decl,
+        [this](const Nodes& args) { return call(args); },
+        true)
+    {}
+
+    Node call(const Nodes& args)
     {
-      if (arg->type() == Undefined)
+      Node item = args[0];
+      Node itemseq = args[1];
+      Node collection = unwrap_collection(itemseq);
+      if (collection == nullptr)
+      {
+        return Resolver::membership(item, itemseq);
+      }
+
+      auto index = find_index(collection);
+      if (index == nullptr || has_float(item))
       {
-        return Resolver::scalar(false);
+        return Resolver::membership(item, itemseq);
       }
+
+      return Resolver::scalar(index->values.contains(item));
+    }
+
+    // internal.member_3 shares the cache, so only this one clears it.
+    void clear() override
+    {
+      membership_indexes.clear();
+    }
+  };
+
+  struct Member3 : public BuiltInDef
+  {
+    Member3() :
+      BuiltInDef(
+        Location("internal.member_3"),
+        member_3_decl,
+        [this](const Nodes& args) { return call(args); },
+        true)
+    {}
+
+    Node call(const Nodes& args)
+    {
+      Node index = args[0];
+      Node item = args[1];
+      Node itemseq = args[2];
+      Node collection = unwrap_collection(itemseq);
+      // arrays and sets are checked positionally, which needs no index
+      if (collection == nullptr || collection->type() != Object)
+      {
+        return Resolver::membership(index, item, itemseq);
+      }
+
+      auto object_index = find_index(collection);
+      if (object_index == nullptr || has_float(index) || has_float(item))
+      {
+        return Resolver::membership(index, item, itemseq);
+      }
+
+      auto it = object_index->entries.find(index);
+      return Resolver::scalar(
+        it != object_index->entries.end() &&
+        structural_equal(it->second, item));
     }
+  };
 
-    join(
-      std::cout,
-      args.begin(),
-      args.end(),
-      " ",
-      [](std::ostream& stream, const Node& n) {
-        stream << to_key(n);
-        return true;
-      })
-      << std::endl;
-    return Resolver::scalar(true);
+  Node walk_iterator(const Nodes& args)
+  {
+    // the virtual machine evaluates these calls itself, by handing an
+    // iterator to the scan which consumes them.
+    return err(
+      args[0],
+      "lazy walk can only be evaluated as the source of a scan",
+      EvalBuiltInError);
   }
 
-  const Node print_decl =
-    bi::Decl << (bi::ArgSeq
-                 << (bi::Arg << bi::Name << bi::Description
-                             << (bi::Type
-                                 << (bi::DynamicArray
-                                     << (bi::Type << (bi::Set << bi::Any))))))
-             << bi::Void;
+  const Node walk_paths_decl = bi::Decl
+    << (bi::ArgSeq << (bi::Arg << (bi::Name ^ "x") << bi::Description
+                               << (bi::Type << bi::Any)))
+    << (bi::Result << (bi::Name ^ "output")
+                   << (bi::Description ^
+                       "iterator over the `path` and `value` pairs of `x`")
+                   << (bi::Type << bi::Any));
+
+  const Node walk_values_decl = bi::Decl
+    << (bi::ArgSeq << (bi::Arg << (bi::Name ^ "x") << bi::Description
+                               << (bi::Type << bi::Any)))
+    << (bi::Result << (bi::Name ^ "output")
+                   << (bi::Description ^ "iterator over the values of `x`")
+                   << (bi::Type << bi::Any));
 }
 
 namespace rego
@@ -82,11 +270,12 @@ namespace rego
     std::vector<BuiltIn> internal()
     {
       return {
+        std::make_shared<Member2>(),
+        std::make_shared<Member3>(),
         BuiltInDef::create(
-          Location("internal.member_2"), member_2_decl, member_2),
+          Location("internal.walk_paths"), walk_paths_decl, walk_iterator),
         BuiltInDef::create(
-          Location("internal.member_3"), member_3_decl, member_3),
-        BuiltInDef::create(Location("internal.print"), print_decl, ::print)};
+          Location("internal.walk_values"), walk_values_decl, walk_iterator)};
     }
   }
 }
\ No newline at end of file
@@ -153,6 +153,7 @@ namespace
       BigInt curr = lhs;
       while (curr < rhs)
       {
+        poll_eval_limits();
         array->push_back(Term << (Scalar << (Int ^ curr.loc())));
         curr = curr.increment();
       }
@@ -163,6 +164,7 @@ namespace
       BigInt curr = lhs;
       while (curr > rhs)
       {
+        poll_eval_limits();
         array->push_back(Term << (Scalar << (Int ^ curr.loc())));
         curr = curr.decrement();
       }
@@ -229,6 +231,7 @@ namespace
       BigInt curr = lhs;
       while (curr < rhs)
       {
+        poll_eval_limits();
         array->push_back(Term << (Scalar << (Int ^ curr.loc())));
         curr = curr + step;
       }
@@ -243,6 +246,7 @@ namespace
       BigInt curr = lhs;
       while (curr > rhs)
       {
+        poll_eval_limits();
         array->push_back(Term << (Scalar << (Int ^ curr.loc())));
         curr = curr - step;
       }
@@ -157,10 +157,10 @@ namespace
     auto maybe_value = get_key(object, key, 0);
     if (maybe_value.has_value())
     {
-      return maybe_value.value()->clone();
+      return maybe_value.value();
     }
 
-    return args[2]->clone();
+    return args[2];
   }
 
   Node get_decl =
@@ -237,7 +237,7 @@ namespace
       std::string key_str = to_key(item / Key);
       if (!keys.contains(key_str))
       {
-        output->push_back(item->clone());
+        output->push_back(item);
       }
     }
 
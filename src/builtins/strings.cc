@@ -3,7 +3,10 @@
 #include "trieste/json.h"
 #include "trieste/utf8.h"
 
+#include <algorithm>
 #include <bitset>
+#include <map>
+#include <memory>
 
 namespace
 {
@@ -271,15 +274,16 @@ namespace
       return needle;
     }
 
-    runestring haystack_runes = utf8_to_runestring(get_string(haystack));
-    runestring needle_runes = utf8_to_runestring(get_string(needle));
-    auto pos = haystack_runes.find(needle_runes);
-    if (pos == haystack_runes.npos)
+    // UTF-8 is self-synchronising, so a byte search only ever matches at rune
+    // boundaries and the byte offset of a match maps onto its rune offset.
+    std::string_view haystack_str = get_string_view(haystack);
+    auto pos = haystack_str.find(get_string_view(needle));
+    if (pos == haystack_str.npos)
     {
       return Int ^ "-1";
     }
 
-    return Int ^ std::to_string(pos);
+    return Int ^ std::to_string(rune_index(haystack).rune_offset(pos));
   }
 
   Node indexof_decl = bi::Decl
@@ -310,14 +314,20 @@ namespace
       return needle;
     }
 
-    runestring haystack_runes = utf8_to_runestring(get_string(haystack));
-    runestring needle_runes = utf8_to_runestring(get_string(needle));
+    std::string_view haystack_str = get_string_view(haystack);
+    std::string_view needle_str = get_string_view(needle);
     Node array = NodeDef::create(Array);
-    auto pos = haystack_runes.find(needle_runes);
-    while (pos != haystack_runes.npos)
+    auto pos = haystack_str.find(needle_str);
+    if (pos == haystack_str.npos)
     {
-      array->push_back(Int ^ std::to_string(pos));
-      pos = haystack_runes.find(needle_runes, pos + 1);
+      return array;
+    }
+
+    auto index = rune_index(haystack);
+    while (pos != haystack_str.npos)
+    {
+      array->push_back(Int ^ std::to_string(index.rune_offset(pos)));
+      pos = haystack_str.find(needle_str, pos + 1);
     }
 
     return array;
@@ -701,76 +711,6 @@ namespace
                        "`format` formatted by the values in `values`")
                    << (bi::Type << bi::String));
 
-  Node any_prefix_match(const Nodes& args)
-  {
-    Node search = unwrap_arg(
-      args,
-      UnwrapOpt(0).types({JSONString, Set, Array}).func("any_prefix_match"));
-    if (search->type() == Error)
-    {
-      return search;
-    }
-
-    Node base = unwrap_arg(
-      args,
-      UnwrapOpt(1).types({JSONString, Set, Array}).func("any_prefix_match"));
-    if (base->type() == Error)
-    {
-      return base;
-    }
-
-    std::vector<std::string> search_strings;
-    if (search->type() == JSONString)
-    {
-      search_strings.push_back(get_string(search));
-    }
-    else
-    {
-      Node bad_term = unwrap_strings(search, search_strings);
-      if (bad_term)
-      {
-        return err(
-          bad_term,
-          "strings.any_prefix_match: operand 1 must be array of strings but "
-          "got array containing " +
-            type_name(bad_term),
-          EvalTypeError);
-      }
-    }
-
-    std::vector<std::string> base_strings;
-    if (base->type() == JSONString)
-    {
-      base_strings.push_back(get_string(base));
-    }
-    else
-    {
-      Node bad_term = unwrap_strings(base, base_strings);
-      if (bad_term)
-      {
-        return err(
-          bad_term,
-          "strings.any_prefix_match: operand 2 must be array of strings but "
-          "got array containing " +
-            type_name(bad_term),
-          EvalTypeError);
-      }
-    }
-
-    for (auto& search_str : search_strings)
-    {
-      for (auto& base_str : base_strings)
-      {
-        if (search_str.starts_with(base_str))
-        {
-          return True ^ "true";
-        }
-      }
-    }
-
-    return False ^ "false";
-  }
-
   Node any_prefix_match_decl = bi::Decl
     << (bi::ArgSeq
         << (bi::Arg
@@ -793,97 +733,261 @@ namespace
                    << (bi::Description ^ "result of the prefix check")
                    << (bi::Type << bi::String));
 
-  Node any_suffix_match(const Nodes& args)
+  Node any_suffix_match_decl = bi::Decl
+    << (bi::ArgSeq
+        << (bi::Arg
+            << (bi::Name ^ "search") << (bi::Description ^ "search string(s)")
+            << (bi::Type
+                << (bi::TypeSeq
+                    << (bi::Type << bi::String)
+                    << (bi::Type
+                        << (bi::DynamicArray << (bi::Type << bi::String)))
+                    << (bi::Type << (bi::Set << (bi::Type << bi::String))))))
+        << (bi::Arg
+            << (bi::Name ^ "base") << (bi::Description ^ "base string(s)")
+            << (bi::Type
+                << (bi::TypeSeq
+                    << (bi::Type << bi::String)
+                    << (bi::Type
+                        << (bi::DynamicArray << (bi::Type << bi::String)))
+                    << (bi::Type << (bi::Set << (bi::Type << bi::String)))))))
+    << (bi::Result << (bi::Name ^ "result")
+                   << (bi::Description ^ "result of the suffix check")
+                   << (bi::Type << bi::String));
+
+  // A byte-wise trie over a collection of strings. Finding whether any member
+  // is a prefix (or, when built over reversed strings, a suffix) of a search
+  // string costs time proportional to the length of the search string rather
+  // than to the size of the collection.
+  class AffixTrie
   {
-    Node search = unwrap_arg(
-      args,
-      UnwrapOpt(0).types({JSONString, Set, Array}).func("any_suffix_match"));
-    if (search->type() == Error)
-    {
-      return search;
-    }
+  public:
+    AffixTrie(bool suffix) : m_suffix(suffix), m_nodes(1) {}
 
-    Node base = unwrap_arg(
-      args,
-      UnwrapOpt(1).types({JSONString, Set, Array}).func("any_suffix_match"));
-    if (base->type() == Error)
+    void insert(const std::string& key)
     {
-      return base;
-    }
+      size_t node = 0;
+      auto add = [&](char c) {
+        auto it = m_nodes[node].children.find(c);
+        if (it != m_nodes[node].children.end())
+        {
+          node = it->second;
+          return;
+        }
 
-    std::vector<std::string> search_strings;
-    if (search->type() == JSONString)
-    {
-      search_strings.push_back(get_string(search));
-    }
-    else
-    {
-      Node bad_term = unwrap_strings(search, search_strings);
-      if (bad_term)
+        size_t child = m_nodes.size();
+        m_nodes[node].children[c] = child;
+        m_nodes.emplace_back();
+        node = child;
+      };
+
+      if (m_suffix)
       {
-        return err(
-          bad_term,
-          "strings.any_suffix_match: operand 1 must be array of strings but "
-          "got array containing " +
-            type_name(bad_term),
-          EvalTypeError);
+        std::for_each(key.rbegin(), key.rend(), add);
+      }
+      else
+      {
+        std::for_each(key.begin(), key.end(), add);
       }
+
+      m_nodes[node].terminal = true;
     }
 
-    std::vector<std::string> base_strings;
-    if (base->type() == JSONString)
+    bool matches(const std::string& str) const
     {
-      base_strings.push_back(get_string(base));
+      if (m_suffix)
+      {
+        return matches(str.rbegin(), str.rend());
+      }
+
+      return matches(str.begin(), str.end());
     }
-    else
+
+  private:
+    template <typename It>
+    bool matches(It begin, It end) const
     {
-      Node bad_term = unwrap_strings(base, base_strings);
-      if (bad_term)
+      size_t node = 0;
+      if (m_nodes[node].terminal)
       {
-        return err(
-          bad_term,
-          "strings.any_suffix_match: operand 2 must be array of strings but "
-          "got array containing " +
-            type_name(bad_term),
-          EvalTypeError);
+        return true;
       }
+
+      for (It it = begin; it != end; ++it)
+      {
+        auto child = m_nodes[node].children.find(*it);
+        if (child == m_nodes[node].children.end())
+        {
+          return false;
+        }
+
+        node = child->second;
+        if (m_nodes[node].terminal)
+        {
+          return true;
+        }
+      }
+
+      return false;
     }
 
-    for (auto& search_str : search_strings)
+    struct TrieNode
     {
-      for (auto& base_str : base_strings)
+      std::map<char, size_t> children;
+      bool terminal = false;
+    };
+
+    bool m_suffix;
+    std::vector<TrieNode> m_nodes;
+  };
+
+  // Collections at least this large have their tries cached.
+  const size_t MinCachedTrieSize = 16;
+  // The number of tries over collections not in data cached by each built-in.
+  const size_t TrieCacheSize = 8;
+
+  using TrieCache = IdentityCache<std::shared_ptr<const AffixTrie>>;
+  thread_local TrieCache prefix_tries(TrieCacheSize);
+  thread_local TrieCache suffix_tries(TrieCacheSize);
+
+  // strings.any_prefix_match and strings.any_suffix_match. The base
+  // collection is typically a large allow-list held in data, so the trie
+  // built over it is cached against the identity of the collection node. A
+  // trie over data is kept by the bundle and reused by every evaluation,
+  // while one over any other collection is reused by later calls in the same
+  // evaluation.
+  struct AnyAffixMatch : public BuiltInDef
+  {
+    AnyAffixMatch(bool suffix) :
+      BuiltInDef(
+        Location(
+          suffix ? "strings.any_suffix_match" : "strings.any_prefix_match"),
+        suffix ? any_suffix_match_decl : any_prefix_match_decl,
+        [this](const Nodes& args) { return call(args); },
+        true),
+      m_suffix(suffix),
+      m_func(suffix ? "any_suffix_match" : "any_prefix_match")
+    {}
+
+    Node call(const Nodes& args)
+    {
+      Node search = unwrap_arg(
+        args, UnwrapOpt(0).types({JSONString, Set, Array}).func(m_func));
+      if (search->type() == Error)
       {
-        if (search_str.ends_with(base_str))
+        return search;
+      }
+
+      Node base = unwrap_arg(
+        args, UnwrapOpt(1).types({JSONString, Set, Array}).func(m_func));
+      if (base->type() == Error)
+      {
+        return base;
+      }
+
+      std::vector<std::string> search_strings;
+      if (search->type() == JSONString)
+      {
+        search_strings.push_back(get_string(search));
+      }
+      else
+      {
+        Node bad_term = unwrap_strings(search, search_strings);
+        if (bad_term)
+        {
+          return err(
+            bad_term,
+            "strings." + m_func +
+              ": operand 1 must be array of strings but got array "
+              "containing " +
+              type_name(bad_term),
+            EvalTypeError);
+        }
+      }
+
+      if (base->type() == JSONString)
+      {
+        std::string base_str = get_string(base);
+        for (auto& search_str : search_strings)
+        {
+          bool match = m_suffix ? search_str.ends_with(base_str) :
+                                  search_str.starts_with(base_str);
+          if (match)
+          {
+            return True ^ "true";
+          }
+        }
+
+        return False ^ "false";
+      }
+
+      TrieCache& tries = m_suffix ? suffix_tries : prefix_tries;
+      bundle::DataIndexCache* shared = data_index_cache(base);
+      std::shared_ptr<const AffixTrie> trie;
+      if (shared != nullptr)
+      {
+        trie = std::static_pointer_cast<const AffixTrie>(
+          shared->find(base, m_func));
+      }
+      else
+      {
+        const std::shared_ptr<const AffixTrie>* cached = tries.find(base);
+        trie = cached == nullptr ? nullptr : *cached;
+      }
+
+      if (trie == nullptr)
+      {
+        std::vector<std::string> base_strings;
+        Node bad_term = unwrap_strings(base, base_strings);
+        if (bad_term)
+        {
+          return err(
+            bad_term,
+            "strings." + m_func +
+              ": operand 2 must be array of strings but got array "
+              "containing " +
+              type_name(bad_term),
+            EvalTypeError);
+        }
+
+        auto new_trie = std::make_shared<AffixTrie>(m_suffix);
+        for (auto& base_str : base_strings)
+        {
+          new_trie->insert(base_str);
+        }
+
+        trie = new_trie;
+        if (base->size() >= MinCachedTrieSize && shared != nullptr)
+        {
+          trie = std::static_pointer_cast<const AffixTrie>(
+            shared->insert(base, m_func, trie));
+        }
+        else if (base->size() >= MinCachedTrieSize)
+        {
+          tries.insert(base, trie);
+        }
+      }
+
+      for (auto& search_str : search_strings)
+      {
+        if (trie->matches(search_str))
         {
           return True ^ "true";
         }
       }
+
+      return False ^ "false";
     }
 
-    return False ^ "false";
-  }
+    void clear() override
+    {
+      (m_suffix ? suffix_tries : prefix_tries).clear();
+    }
 
-  Node any_suffix_match_decl = bi::Decl
-    << (bi::ArgSeq
-        << (bi::Arg
-            << (bi::Name ^ "search") << (bi::Description ^ "search string(s)")
-            << (bi::Type
-                << (bi::TypeSeq
-                    << (bi::Type << bi::String)
-                    << (bi::Type
-                        << (bi::DynamicArray << (bi::Type << bi::String)))
-                    << (bi::Type << (bi::Set << (bi::Type << bi::String))))))
-        << (bi::Arg
-            << (bi::Name ^ "base") << (bi::Description ^ "base string(s)")
-            << (bi::Type
-                << (bi::TypeSeq
-                    << (bi::Type << bi::String)
-                    << (bi::Type
-                        << (bi::DynamicArray << (bi::Type << bi::String)))
-                    << (bi::Type << (bi::Set << (bi::Type << bi::String)))))))
-    << (bi::Result << (bi::Name ^ "result")
-                   << (bi::Description ^ "result of the suffix check")
-                   << (bi::Type << bi::String));
+  private:
+    bool m_suffix;
+    std::string m_func;
+  };
 
   Node replace_n(const Nodes& args)
   {
@@ -965,12 +1069,21 @@ namespace
       return x;
     }
 
-    std::string x_str = get_string(x);
-    runestring x_runes = utf8_to_runestring(x_str);
-    std::reverse(x_runes.begin(), x_runes.end());
-    std::ostringstream y;
-    y << x_runes;
-    return JSONString ^ y.str();
+    std::string_view x_str = get_string_view(x);
+    auto index = rune_index(x);
+    if (index.is_ascii())
+    {
+      return JSONString ^ std::string(x_str.rbegin(), x_str.rend());
+    }
+
+    std::string y;
+    y.reserve(x_str.size());
+    for (size_t i = index.size(); i > 0; --i)
+    {
+      y.append(index.substr(x_str, i - 1, 1));
+    }
+
+    return JSONString ^ y;
   }
 
   Node reverse_decl =
@@ -1001,8 +1114,8 @@ namespace
       return length;
     }
 
-    std::string value_str = get_string(value);
-    runestring value_runes = utf8_to_runestring(value_str);
+    std::string_view value_str = get_string_view(value);
+    auto index = rune_index(value);
     auto maybe_offset_int = get_int(offset).to_int();
     if (!maybe_offset_int)
     {
@@ -1016,7 +1129,7 @@ namespace
     }
 
     std::size_t offset_size = static_cast<std::size_t>(offset_int);
-    if (offset_size >= value_runes.size())
+    if (offset_size >= index.size())
     {
       return JSONString ^ "";
     }
@@ -1031,21 +1144,20 @@ namespace
     std::size_t length_size;
     if (length_int < 0)
     {
-      length_size = value_runes.size() - offset_size;
+      length_size = index.size() - offset_size;
     }
     else
     {
       length_size = static_cast<std::size_t>(length_int);
     }
 
-    if (length_size > value_runes.size() - offset_size)
+    if (length_size > index.size() - offset_size)
     {
-      length_size = value_runes.size() - offset_size;
+      length_size = index.size() - offset_size;
     }
 
-    std::ostringstream output;
-    output << value_runes.substr(offset_size, length_size);
-    return JSONString ^ output.str();
+    return JSONString ^
+      std::string(index.substr(value_str, offset_size, length_size));
   }
 
   Node substring_decl = bi::Decl
@@ -1360,14 +1472,8 @@ namespace rego
         BuiltInDef::create(Location("replace"), replace_decl, replace),
         BuiltInDef::create(Location("split"), split_decl, split),
         BuiltInDef::create(Location("sprintf"), sprintf_decl, sprintf_),
-        BuiltInDef::create(
-          Location("strings.any_prefix_match"),
-          any_prefix_match_decl,
-          any_prefix_match),
-        BuiltInDef::create(
-          Location("strings.any_suffix_match"),
-          any_suffix_match_decl,
-          any_suffix_match),
+        std::make_shared<AnyAffixMatch>(false),
+        std::make_shared<AnyAffixMatch>(true),
         BuiltInDef::create(Location("strings.count"), count_decl, count),
         BuiltInDef::create(
           Location("strings.replace_n"), replace_n_decl, replace_n),
@@ -1,5 +1,8 @@
 #include "internal.hh"
 
+#include <list>
+#include <unordered_map>
+
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 namespace rego
@@ -222,7 +225,293 @@ namespace rego
       return std::get<Block>(contents);
     }
 
-    Statement::Statement() : type(StatementType::Nop), target(0) {}
+    StatementExt::StatementExt(DataRefExt&& ext) : contents(ext) {}
+
+    const DataRefExt& StatementExt::data_ref() const
+    {
+      return std::get<DataRefExt>(contents);
+    }
+
+    Statement::Statement() : type(StatementType::Nop), target(0), id(0) {}
+
+    Node ResultCache::find(const Location& name, const Node& data) const
+    {
+      Node value;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_data.get() != data.get())
+        {
+          return nullptr;
+        }
+
+        auto it = m_results.find(name);
+        if (it == m_results.end())
+        {
+          return nullptr;
+        }
+
+        value = it->second;
+      }
+
+      return value;
+    }
+
+    void ResultCache::insert(const Location& name, const Node& data, Node value)
+    {
+      // the evaluation which computed the value goes on to use it, and may
+      // add it to a collection of its own, so the cache keeps a copy
+      Node holder = Seq << value->clone();
+      std::lock_guard<std::mutex> lock(m_mutex);
+      reset(data);
+      m_results.insert({name, holder});
+    }
+
+    void ResultCache::clear()
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_data = nullptr;
+      m_results.clear();
+    }
+
+    size_t ResultCache::size() const
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_results.size();
+    }
+
+    void ResultCache::reset(const Node& data)
+    {
+      if (m_data.get() != data.get())
+      {
+        m_data = data;
+        m_results.clear();
+      }
+    }
+
+    std::shared_ptr<const void>
+    DataIndexCache::find(const Node& node, const std::string& kind) const
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_indexes.find({node.get(), kind});
+      if (it == m_indexes.end())
+      {
+        return nullptr;
+      }
+
+      return it->second.index;
+    }
+
+    std::shared_ptr<const void> DataIndexCache::insert(
+      const Node& node,
+      const std::string& kind,
+      std::shared_ptr<const void> index)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto [it, _] = m_indexes.insert({{node.get(), kind}, {node, index}});
+      return it->second.index;
+    }
+
+    void DataIndexCache::clear()
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_indexes.clear();
+    }
+
+    size_t DataIndexCache::size() const
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_indexes.size();
+    }
+
+    struct DecisionCache::Shard
+    {
+      struct Entry
+      {
+        size_t hash;
+        Location entrypoint;
+        Node input;
+        Nodes values;
+        std::chrono::steady_clock::time_point expires;
+      };
+
+      using Entries = std::list<Entry>;
+
+      // the most recently used entry is at the front
+      Entries entries;
+      std::unordered_multimap<size_t, Entries::iterator> index;
+      size_t capacity;
+      Node data;
+      std::mutex mutex;
+
+      void erase(Entries::iterator it)
+      {
+        auto range = index.equal_range(it->hash);
+        for (auto pos = range.first; pos != range.second; ++pos)
+        {
+          if (pos->second == it)
+          {
+            index.erase(pos);
+            break;
+          }
+        }
+
+        entries.erase(it);
+      }
+
+      void reset(const Node& new_data)
+      {
+        if (data.get() != new_data.get())
+        {
+          data = new_data;
+          entries.clear();
+          index.clear();
+        }
+      }
+    };
+
+    DecisionCache::DecisionCache(
+      size_t capacity, std::chrono::milliseconds ttl, size_t shards) :
+      m_ttl(ttl), m_hits(0), m_misses(0), m_evictions(0)
+    {
+      capacity = MAX(capacity, static_cast<size_t>(1));
+      shards = std::min(MAX(shards, static_cast<size_t>(1)), capacity);
+      for (size_t i = 0; i < shards; ++i)
+      {
+        auto shard = std::make_unique<Shard>();
+        // the first shards take the remainder
+        shard->capacity = capacity / shards + (i < capacity % shards ? 1 : 0);
+        m_shards.push_back(std::move(shard));
+      }
+    }
+
+    DecisionCache::~DecisionCache() = default;
+
+    DecisionCache::Shard& DecisionCache::shard(size_t hash)
+    {
+      return *m_shards[hash % m_shards.size()];
+    }
+
+    std::optional<Nodes> DecisionCache::find(
+      const Location& entrypoint, const Node& input, const Node& data)
+    {
+      size_t hash = combine(
+        std::hash<std::string_view>{}(entrypoint.view()),
+        structural_hash(input));
+      Shard& s = shard(hash);
+      auto now = std::chrono::steady_clock::now();
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (s.data.get() == data.get())
+      {
+        auto range = s.index.equal_range(hash);
+        for (auto pos = range.first; pos != range.second; ++pos)
+        {
+          auto it = pos->second;
+          if (
+            it->entrypoint != entrypoint ||
+            !structural_equal(it->input, input))
+          {
+            continue;
+          }
+
+          if (m_ttl.count() > 0 && it->expires <= now)
+          {
+            s.erase(it);
+            break;
+          }
+
+          s.entries.splice(s.entries.begin(), s.entries, it);
+          ++m_hits;
+          // each hit goes on to be adopted by its own output
+          Nodes values;
+          for (const Node& value : it->values)
+          {
+            values.push_back(value->clone());
+          }
+
+          return values;
+        }
+      }
+
+      ++m_misses;
+      return std::nullopt;
+    }
+
+    void DecisionCache::insert(
+      const Location& entrypoint,
+      const Node& input,
+      const Node& data,
+      const Nodes& values)
+    {
+      size_t hash = combine(
+        std::hash<std::string_view>{}(entrypoint.view()),
+        structural_hash(input));
+      // the evaluation which computed the values goes on to use them
+      Nodes copies;
+      for (const Node& value : values)
+      {
+        copies.push_back(value->clone());
+      }
+
+      Shard& s = shard(hash);
+      auto expires = std::chrono::steady_clock::now() + m_ttl;
+      std::lock_guard<std::mutex> lock(s.mutex);
+      s.reset(data);
+
+      auto range = s.index.equal_range(hash);
+      for (auto pos = range.first; pos != range.second; ++pos)
+      {
+        auto it = pos->second;
+        if (it->entrypoint == entrypoint && structural_equal(it->input, input))
+        {
+          // another evaluation got here first
+          it->values = std::move(copies);
+          it->expires = expires;
+          s.entries.splice(s.entries.begin(), s.entries, it);
+          return;
+        }
+      }
+
+      if (s.entries.size() >= s.capacity)
+      {
+        s.erase(std::prev(s.entries.end()));
+        ++m_evictions;
+      }
+
+      s.entries.push_front(
+        {hash, entrypoint, input->clone(), std::move(copies), expires});
+      s.index.insert({hash, s.entries.begin()});
+    }
+
+    std::chrono::milliseconds DecisionCache::ttl() const
+    {
+      return m_ttl;
+    }
+
+    void DecisionCache::clear()
+    {
+      for (auto& s : m_shards)
+      {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->entries.clear();
+        s->index.clear();
+        s->data = nullptr;
+      }
+    }
+
+    DecisionCache::Stats DecisionCache::stats() const
+    {
+      Stats stats;
+      stats.hits = m_hits;
+      stats.misses = m_misses;
+      stats.evictions = m_evictions;
+      for (auto& s : m_shards)
+      {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        stats.size += s->entries.size();
+      }
+
+      return stats;
+    }
 
     Operand::Operand() : type(OperandType::None), value(0) {}
 
@@ -734,6 +1023,17 @@ namespace rego
     }
 
     bundle.local_count = *max_index + 1;
+    for (bundle::Function& function : bundle.functions)
+    {
+      function.local_count = bundle.local_count;
+    }
+    for (bundle::Plan& plan : bundle.plans)
+    {
+      plan.local_count = bundle.local_count;
+    }
+
+    bundle.optimize();
+    bundle.materialize_constants();
     return std::make_shared<BundleDef>(std::move(bundle));
   }
 
@@ -769,6 +1069,28 @@ namespace rego
     return name_to_func.find(name) != name_to_func.end();
   }
 
+  void BundleDef::materialize_constants()
+  {
+    constants = NodeDef::create(Seq);
+    string_values.clear();
+    string_values.reserve(strings.size());
+    for (const Location& str : strings)
+    {
+      Node value = JSONString ^ str;
+      constants << value;
+      string_values.push_back(value);
+    }
+
+    true_value = True ^ "true";
+    false_value = False ^ "false";
+    null_value = NodeDef::create(Null);
+    constants << true_value << false_value << null_value;
+    if (data != nullptr && data->parent() == nullptr)
+    {
+      constants << data;
+    }
+  }
+
   void BundleDef::save(const std::filesystem::path& path) const
   {
     std::ofstream stream(path, std::ios::out | std::ios::binary);
@@ -777,6 +1099,13 @@ namespace rego
   }
 
   Bundle BundleDef::load(const std::filesystem::path& path)
+  {
+    return load(path, {});
+  }
+
+  Bundle BundleDef::load(
+    const std::filesystem::path& path,
+    const std::vector<std::string>& entrypoints)
   {
     std::ifstream stream(path, std::ios::in | std::ios::binary);
     if (!stream.is_open())
@@ -786,6 +1115,6 @@ namespace rego
     }
 
     stream.imbue(std::locale::classic());
-    return load(stream);
+    return load(stream, entrypoints);
   }
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include "rego.hh"
 #include "trieste/wf.h"
 
+#include <algorithm>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 
@@ -12,6 +14,8 @@ namespace
   namespace bi = rego::builtins;
 
   const uint32_t CRC32Init = 0;
+  // The size of the chunks in which a bundle is read to check its CRC
+  const size_t CRCChunkSize = 64 * 1024;
 
   uint32_t crc32_add(uint32_t crc, const uint8_t* ptr, size_t len)
   {
@@ -462,7 +466,9 @@ namespace
 
   const char* Magic = "REGOBUND";
   const uint8_t RegoVersion = 1;
-  const uint8_t RegoBinaryVersion = 1;
+  // Version 2 renumbered the locals of each function from zero, so the Local
+  // Count in the header became the size of the largest frame.
+  const uint8_t RegoBinaryVersion = 2;
   const size_t NumReservedBytes = 5;
   const size_t NumForwardPointers = 4;
   const size_t HeaderSize = strlen(Magic) + 1 + 1 + 1 + NumReservedBytes +
@@ -497,7 +503,12 @@ namespace
         bundle.strings, bundle.builtin_functions, bundle.files, bundle.query);
       write_plans(bundle.plans);
       write_funcs(bundle.functions);
-      write_data(bundle.data);
+      Node data = bundle.data;
+      if (bundle.data_tape != nullptr)
+      {
+        data = bundle.data_tape->document();
+      }
+      write_data(data);
       update_header();
     }
 
@@ -879,6 +890,8 @@ namespace
       write_size(files.size());
       for (auto& file : files)
       {
+        size_t index = m_files.size();
+        m_files[file->origin()] = index;
         write_string(file->origin());
         write_string(file->view());
       }
@@ -1150,10 +1163,91 @@ namespace
     uint64_t m_header_table;
   };
 
+  // The strings and functions referenced by a set of blocks.
+  struct References
+  {
+    std::vector<std::string> calls;
+    std::set<size_t> strings;
+    bool dynamic = false;
+  };
+
+  void collect_references(const b::Block& block, References& refs)
+  {
+    auto add_op = [&refs](const b::Operand& op) {
+      if (op.type == b::OperandType::String)
+      {
+        refs.strings.insert(op.index);
+      }
+    };
+
+    for (const b::Statement& stmt : block)
+    {
+      add_op(stmt.op0);
+      add_op(stmt.op1);
+      switch (stmt.type)
+      {
+        case b::StatementType::MakeNumberRef:
+          refs.strings.insert(stmt.op0.index);
+          break;
+
+        case b::StatementType::Call:
+          refs.calls.push_back(std::string(stmt.ext->call().func.view()));
+          std::for_each(
+            stmt.ext->call().ops.begin(), stmt.ext->call().ops.end(), add_op);
+          break;
+
+        case b::StatementType::CallDynamic:
+          refs.dynamic = true;
+          std::for_each(
+            stmt.ext->call_dynamic().path.begin(),
+            stmt.ext->call_dynamic().path.end(),
+            add_op);
+          std::for_each(
+            stmt.ext->call_dynamic().ops.begin(),
+            stmt.ext->call_dynamic().ops.end(),
+            add_op);
+          break;
+
+        case b::StatementType::Block:
+          for (const b::Block& inner : stmt.ext->blocks())
+          {
+            collect_references(inner, refs);
+          }
+          break;
+
+        case b::StatementType::Not:
+        case b::StatementType::Scan:
+          collect_references(stmt.ext->block(), refs);
+          break;
+
+        case b::StatementType::With:
+          refs.strings.insert(
+            stmt.ext->with().path.begin(), stmt.ext->with().path.end());
+          collect_references(stmt.ext->with().block, refs);
+          break;
+
+        default:
+          break;
+      }
+    }
+  }
+
+  void collect_references(const std::vector<b::Block>& blocks, References& refs)
+  {
+    for (const b::Block& block : blocks)
+    {
+      collect_references(block, refs);
+    }
+  }
+
   class iregostream
   {
   public:
-    iregostream(std::string&& bytes) : m_istream(bytes, std::ios::binary) {}
+    // The stream must be positioned at the end of the header. Positions in
+    // the body are given relative to that point.
+    iregostream(std::istream& istream) :
+      m_istream(istream), m_skip_files(false)
+    {}
 
     Bundle read_bundle(size_t local_count, int8_t query_plan)
     {
@@ -1171,7 +1265,189 @@ namespace
       return std::make_shared<BundleDef>(std::move(bundle));
     }
 
+    // Decodes only the plans for the provided entrypoints, the functions they
+    // can (transitively) call, and the strings and built-in declarations they
+    // use. The sections are located using the forward pointers in the header
+    // and the name tables which follow the plan and function sections.
+    Bundle read_bundle(
+      size_t local_count,
+      int8_t query_plan,
+      const std::vector<uint64_t>& pointers,
+      const std::vector<std::string>& entrypoints)
+    {
+      BundleDef bundle;
+      bundle.local_count = local_count;
+
+      // statement locations point into the module files, which are not
+      // loaded, so they are all decoded as empty locations.
+      m_skip_files = true;
+      seek(pointers[StaticId - 1]);
+      assert_id(StaticId, "Static ID byte missing");
+      skip_files();
+      uint64_t strings_pos = position();
+
+      std::map<std::string, uint64_t> plan_table =
+        read_table(pointers[PlansId - 1]);
+      std::map<std::string, uint64_t> func_table =
+        read_table(pointers[FuncsId - 1]);
+
+      References refs;
+      for (const std::string& entrypoint : entrypoints)
+      {
+        auto it = plan_table.find(entrypoint);
+        if (it == plan_table.end())
+        {
+          logging::Error() << "Entrypoint not found in bundle: " << entrypoint;
+          throw std::invalid_argument("Entrypoint not found in bundle");
+        }
+
+        if (bundle.name_to_plan.contains(entrypoint))
+        {
+          continue;
+        }
+
+        seek_body(it->second);
+        b::Plan plan = read_plan();
+        plan.local_count = bundle.local_count;
+        collect_references(plan.blocks, refs);
+        bundle.name_to_plan[plan.name] = bundle.plans.size();
+        bundle.plans.push_back(plan);
+      }
+
+      if (query_plan >= 0)
+      {
+        // plans are written in index order, so the position of a plan in the
+        // section gives its index in the full bundle
+        std::vector<std::pair<uint64_t, std::string>> order;
+        for (auto& [name, pos] : plan_table)
+        {
+          order.push_back({pos, name});
+        }
+        std::sort(order.begin(), order.end());
+        if (static_cast<size_t>(query_plan) < order.size())
+        {
+          auto it = bundle.name_to_plan.find(order[query_plan].second);
+          if (it != bundle.name_to_plan.end())
+          {
+            bundle.query_plan = it->second;
+          }
+        }
+      }
+
+      std::set<std::string> seen;
+      std::set<std::string> builtins;
+      bool all_functions = false;
+      size_t next = 0;
+      while (true)
+      {
+        if (refs.dynamic && !all_functions)
+        {
+          // dynamic calls are resolved by path at runtime, so any function
+          // could be the target
+          for (auto& [name, _] : func_table)
+          {
+            refs.calls.push_back(name);
+          }
+          all_functions = true;
+        }
+
+        if (next == refs.calls.size())
+        {
+          break;
+        }
+
+        std::string name = refs.calls[next++];
+        if (!seen.insert(name).second)
+        {
+          continue;
+        }
+
+        auto it = func_table.find(name);
+        if (it == func_table.end())
+        {
+          builtins.insert(name);
+          continue;
+        }
+
+        seek_body(it->second);
+        b::Function func = read_func();
+        func.local_count = bundle.local_count;
+        collect_references(func.blocks, refs);
+        bundle.name_to_func[func.name] = bundle.functions.size();
+        bundle.functions.push_back(func);
+      }
+
+      seek_body(strings_pos);
+      size_t num_strings = read_size();
+      Location unused = std::string();
+      for (size_t i = 0; i < num_strings; ++i)
+      {
+        if (refs.strings.contains(i))
+        {
+          bundle.strings.push_back(read_string());
+        }
+        else
+        {
+          skip_string();
+          bundle.strings.push_back(unused);
+        }
+      }
+
+      size_t num_builtins = read_size();
+      for (size_t i = 0; i < num_builtins; ++i)
+      {
+        std::string name = read_string();
+        Node decl = read_builtin_decl();
+        if (builtins.contains(name))
+        {
+          bundle.builtin_functions[name] = decl;
+        }
+      }
+
+      int8_t query_id = read_sbyte();
+      if (query_id == 2)
+      {
+        bundle.query = SourceDef::synthetic(read_string(), "query");
+      }
+
+      seek(pointers[DataId - 1]);
+      read_data(bundle);
+
+      logging::Debug() << "Loaded " << bundle.plans.size() << "/"
+                       << plan_table.size() << " plans and "
+                       << bundle.functions.size() << "/" << func_table.size()
+                       << " functions";
+      return std::make_shared<BundleDef>(std::move(bundle));
+    }
+
   private:
+    // Seeks to a position given relative to the start of the file.
+    void seek(uint64_t pos)
+    {
+      m_istream.seekg(pos, std::ios::beg);
+    }
+
+    // Seeks to a position given relative to the start of the body.
+    void seek_body(uint64_t pos)
+    {
+      m_istream.seekg(HeaderSize + pos, std::ios::beg);
+    }
+
+    std::map<std::string, uint64_t> read_table(uint64_t pos)
+    {
+      seek(pos);
+      skip_uint64();
+      std::map<std::string, uint64_t> table;
+      size_t size = read_size();
+      for (size_t i = 0; i < size; ++i)
+      {
+        std::string name = read_string();
+        table[name] = bson::read_uint64(m_istream) - HeaderSize;
+      }
+
+      return table;
+    }
+
     uint8_t read_byte()
     {
       return static_cast<uint8_t>(m_istream.get());
@@ -1219,6 +1495,11 @@ namespace
       size_t idx = read_size();
       size_t pos = read_size();
       size_t len = read_size();
+      if (m_skip_files || idx >= m_files.size())
+      {
+        return {nullptr, 0, 0};
+      }
+
       return Location(m_files[idx], pos, len);
     }
 
@@ -1239,7 +1520,7 @@ namespace
 
     uint64_t position()
     {
-      return static_cast<uint64_t>(m_istream.tellg());
+      return static_cast<uint64_t>(m_istream.tellg()) - HeaderSize;
     }
 
     void assert_id(int8_t expected, const char* error)
@@ -1260,6 +1541,18 @@ namespace
         std::string contents = read_string();
         files.push_back(SourceDef::synthetic(contents, origin));
       }
+
+      m_files = files;
+    }
+
+    void skip_files()
+    {
+      size_t size = read_size();
+      for (size_t i = 0; i < size; ++i)
+      {
+        skip_string();
+        skip_string();
+      }
     }
 
     void read_strings(std::vector<Location>& strings)
@@ -1671,6 +1964,8 @@ namespace
       for (size_t i = 0; i < num_plans; ++i)
       {
         b::Plan plan = read_plan();
+        // refined by BundleDef::optimize, as for functions
+        plan.local_count = bundle.local_count;
         bundle.name_to_plan[plan.name] = i;
         bundle.plans.push_back(plan);
       }
@@ -1715,6 +2010,9 @@ namespace
       for (size_t i = 0; i < num_funcs; ++i)
       {
         b::Function func = read_func();
+        // refined by BundleDef::optimize, but the bundle-wide count is
+        // always large enough
+        func.local_count = bundle.local_count;
         bundle.name_to_func[func.name] = i;
         bundle.functions.push_back(func);
       }
@@ -1727,8 +2025,9 @@ namespace
       bundle.data = bson::read_object(m_istream);
     }
 
-    std::istringstream m_istream;
+    std::istream& m_istream;
     std::vector<Source> m_files;
+    bool m_skip_files;
   };
 
 }
@@ -1744,6 +2043,12 @@ namespace rego
   }
 
   Bundle BundleDef::load(std::istream& istream)
+  {
+    return load(istream, {});
+  }
+
+  Bundle BundleDef::load(
+    std::istream& istream, const std::vector<std::string>& entrypoints)
   {
     char magic[9];
     istream.read(magic, strlen(Magic));
@@ -1754,19 +2059,22 @@ namespace rego
       throw std::invalid_argument("Mismatched header");
     }
 
-    char version = istream.get();
+    int version = istream.get();
     if (version != RegoVersion)
     {
-      logging::Error() << "Unsupported rego version: " << version << "Only "
-                       << RegoVersion << " is supported.";
+      logging::Error() << "Unsupported rego version: " << version << ". Only "
+                       << int(RegoVersion) << " is supported.";
       throw std::invalid_argument("Unsupported rego version");
     }
 
+    // bundles written before the current binary version are rejected rather
+    // than misread, as the meaning of their header fields has changed
     version = istream.get();
     if (version != RegoBinaryVersion)
     {
       logging::Error() << "Unsupported rego binary version: " << version
-                       << "Only " << RegoBinaryVersion << " is supported.";
+                       << ". Only " << int(RegoBinaryVersion)
+                       << " is supported.";
       throw std::invalid_argument("Unsupported rego binary version");
     }
 
@@ -1776,14 +2084,37 @@ namespace rego
     uint32_t local_count = bson::read_uint32(istream);
     uint32_t expected_crc32 = bson::read_uint32(istream);
     uint64_t size = bson::read_uint64(istream);
+    std::vector<uint64_t> pointers;
+    for (size_t i = 0; i < NumForwardPointers; ++i)
+    {
+      pointers.push_back(bson::read_uint64(istream));
+    }
     istream.seekg(HeaderSize, std::ios::beg); // seek to the end of the header
 
-    std::string bytes;
-    bytes.resize(size);
-    istream.read(bytes.data(), size);
+    // The body is checked a chunk at a time, and then decoded straight from
+    // the stream, so the file is never held in memory as a whole. When only
+    // some entrypoints are loaded, the sections they do not need are skipped
+    // rather than decoded.
+    std::vector<char> chunk(CRCChunkSize);
+    uint32_t actual_crc32 = CRC32Init;
+    uint64_t remaining = size;
+    while (remaining > 0)
+    {
+      size_t count =
+        static_cast<size_t>(std::min<uint64_t>(remaining, chunk.size()));
+      istream.read(chunk.data(), count);
+      if (static_cast<size_t>(istream.gcount()) != count)
+      {
+        logging::Error() << "Truncated bundle: expected " << size
+                         << " bytes after the header";
+        throw std::invalid_argument("Truncated bundle");
+      }
+
+      actual_crc32 = crc32_add(
+        actual_crc32, reinterpret_cast<const uint8_t*>(chunk.data()), count);
+      remaining -= count;
+    }
 
-    uint32_t actual_crc32 = crc32_add(
-      CRC32Init, reinterpret_cast<const uint8_t*>(bytes.data()), size);
     if (actual_crc32 != expected_crc32)
     {
       logging::Error() << "Mismatched CRC: " << actual_crc32
@@ -1791,7 +2122,17 @@ namespace rego
       throw std::invalid_argument("Mismatched CRC");
     }
 
-    iregostream stream(std::move(bytes));
-    return stream.read_bundle(local_count, query_plan);
+    istream.seekg(HeaderSize, std::ios::beg);
+    iregostream stream(istream);
+    Bundle bundle = entrypoints.empty() ?
+      stream.read_bundle(local_count, query_plan) :
+      stream.read_bundle(local_count, query_plan, pointers, entrypoints);
+    if (bundle != nullptr)
+    {
+      bundle->optimize();
+      bundle->materialize_constants();
+    }
+
+    return bundle;
   }
 }
\ No newline at end of file
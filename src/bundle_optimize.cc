@@ -0,0 +1,2059 @@
+#include "internal.hh"
+#include "rego.hh"
+#include "trieste/json.h"
+
+namespace
+{
+  using namespace rego;
+  namespace b = rego::bundle;
+
+  using b::Block;
+  using b::Operand;
+  using b::OperandType;
+  using b::Statement;
+  using b::StatementType;
+
+  const size_t MaxOptimizePasses = 8;
+
+  // Bounds the input paths built by Dot statements in loops
+  const size_t MaxInputPathDepth = 32;
+
+  // Whether the statement reads the local in its target (as opposed to, or as
+  // well as, writing it).
+  bool reads_target(const Statement& stmt)
+  {
+    switch (stmt.type)
+    {
+      case StatementType::ArrayAppend:
+      case StatementType::AssignVarOnce:
+      case StatementType::IsDefined:
+      case StatementType::IsUndefined:
+      case StatementType::ObjectInsert:
+      case StatementType::ObjectInsertOnce:
+      case StatementType::ResultSetAdd:
+      case StatementType::ReturnLocal:
+      case StatementType::Scan:
+      case StatementType::SetAdd:
+      case StatementType::With:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  // Calls `f` with the index of every local that the statement itself (i.e.
+  // not counting any nested blocks) reads.
+  template <typename F>
+  void for_each_read(const Statement& stmt, F f)
+  {
+    auto read_op = [&](const Operand& op) {
+      if (op.type == OperandType::Local)
+      {
+        f(op.index);
+      }
+    };
+
+    read_op(stmt.op0);
+    read_op(stmt.op1);
+
+    switch (stmt.type)
+    {
+      case StatementType::Call:
+        for (const Operand& op : stmt.ext->call().ops)
+        {
+          read_op(op);
+        }
+        break;
+
+      case StatementType::CallDynamic:
+        for (const Operand& op : stmt.ext->call_dynamic().path)
+        {
+          read_op(op);
+        }
+        for (const Operand& op : stmt.ext->call_dynamic().ops)
+        {
+          read_op(op);
+        }
+        break;
+
+      case StatementType::ObjectMerge:
+        f(stmt.op0.index);
+        f(stmt.op1.index);
+        break;
+
+      default:
+        break;
+    }
+
+    if (reads_target(stmt))
+    {
+      f(stmt.target);
+    }
+  }
+
+  // Whether the statement writes the local in its target.
+  bool writes_target(const Statement& stmt)
+  {
+    switch (stmt.type)
+    {
+      case StatementType::AssignInt:
+      case StatementType::AssignVarOnce:
+      case StatementType::AssignVar:
+      case StatementType::Call:
+      case StatementType::CallDynamic:
+      case StatementType::Dot:
+      case StatementType::Len:
+      case StatementType::MakeArray:
+      case StatementType::MakeNull:
+      case StatementType::MakeNumberInt:
+      case StatementType::MakeNumberRef:
+      case StatementType::MakeObject:
+      case StatementType::MakeSet:
+      case StatementType::ObjectMerge:
+      case StatementType::ResetLocal:
+      case StatementType::With:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  // Calls `f` with the index of every local that the statement itself writes.
+  template <typename F>
+  void for_each_write(const Statement& stmt, F f)
+  {
+    if (writes_target(stmt))
+    {
+      f(stmt.target);
+    }
+
+    if (stmt.type == StatementType::Scan)
+    {
+      f(stmt.op0.index);
+      f(stmt.op1.index);
+    }
+  }
+
+  // The blocks nested inside a Block, Not, Scan or With statement.
+  std::vector<const Block*> nested_blocks(const Statement& stmt)
+  {
+    std::vector<const Block*> blocks;
+    switch (stmt.type)
+    {
+      case StatementType::Block:
+        for (const Block& block : stmt.ext->blocks())
+        {
+          blocks.push_back(&block);
+        }
+        break;
+
+      case StatementType::Not:
+      case StatementType::Scan:
+        blocks.push_back(&stmt.ext->block());
+        break;
+
+      case StatementType::With:
+        blocks.push_back(&stmt.ext->with().block);
+        break;
+
+      default:
+        break;
+    }
+
+    return blocks;
+  }
+
+  // Returns a copy of the statement with its nested blocks replaced. The
+  // extension is shared between copies of a statement, so it is never
+  // modified in place.
+  Statement with_nested_blocks(const Statement& stmt, std::vector<Block> blocks)
+  {
+    Statement result = stmt;
+    switch (stmt.type)
+    {
+      case StatementType::Block:
+        result.ext = std::make_shared<const b::StatementExt>(std::move(blocks));
+        break;
+
+      case StatementType::Not:
+        result.ext =
+          std::make_shared<const b::StatementExt>(std::move(blocks.front()));
+        break;
+
+      case StatementType::Scan: {
+        b::StatementExt ext(std::move(blocks.front()));
+        ext.independent = stmt.ext->independent;
+        ext.collectors = stmt.ext->collectors;
+        result.ext = std::make_shared<const b::StatementExt>(std::move(ext));
+      }
+      break;
+
+      case StatementType::With: {
+        b::WithExt with;
+        with.path = stmt.ext->with().path;
+        with.block = std::move(blocks.front());
+        result.ext = std::make_shared<const b::StatementExt>(std::move(with));
+      }
+      break;
+
+      default:
+        break;
+    }
+
+    return result;
+  }
+
+  bool contains_break(const Block& block)
+  {
+    for (const Statement& stmt : block)
+    {
+      if (stmt.type == StatementType::Break)
+      {
+        return true;
+      }
+
+      for (const Block* nested : nested_blocks(stmt))
+      {
+        if (contains_break(*nested))
+        {
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  size_t count_statements(const Block& block)
+  {
+    size_t count = block.size();
+    for (const Statement& stmt : block)
+    {
+      for (const Block* nested : nested_blocks(stmt))
+      {
+        count += count_statements(*nested);
+      }
+    }
+
+    return count;
+  }
+
+  size_t count_statements(const std::vector<Block>& blocks)
+  {
+    size_t count = 0;
+    for (const Block& block : blocks)
+    {
+      count += count_statements(block);
+    }
+    return count;
+  }
+
+  bool is_constant(const Operand& op)
+  {
+    return op.type == OperandType::String || op.type == OperandType::True ||
+      op.type == OperandType::False;
+  }
+
+  // Compares two constant operands. Only returns a value when the result is
+  // certain without consulting the string table.
+  std::optional<bool> constant_equals(const Operand& lhs, const Operand& rhs)
+  {
+    if (!is_constant(lhs) || !is_constant(rhs))
+    {
+      return std::nullopt;
+    }
+
+    if (lhs.type != rhs.type)
+    {
+      return false;
+    }
+
+    if (lhs.type != OperandType::String)
+    {
+      return true;
+    }
+
+    if (lhs.index == rhs.index)
+    {
+      return true;
+    }
+
+    return std::nullopt;
+  }
+
+  // Whether the statement is an Equal/NotEqual comparison whose outcome is
+  // known ahead of time.
+  std::optional<bool> constant_outcome(const Statement& stmt)
+  {
+    if (stmt.type == StatementType::Equal)
+    {
+      return constant_equals(stmt.op0, stmt.op1);
+    }
+
+    if (stmt.type == StatementType::NotEqual)
+    {
+      auto maybe_equal = constant_equals(stmt.op0, stmt.op1);
+      if (maybe_equal.has_value())
+      {
+        return !*maybe_equal;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  bool always_fails(const Statement& stmt)
+  {
+    auto maybe_outcome = constant_outcome(stmt);
+    return maybe_outcome.has_value() && !*maybe_outcome;
+  }
+
+  Statement failing_statement(const Location& location)
+  {
+    Statement stmt;
+    stmt.type = StatementType::Equal;
+    stmt.location = location;
+    stmt.op0.type = OperandType::True;
+    stmt.op1.type = OperandType::False;
+    return stmt;
+  }
+
+  // Statements which can only ever return Continue, and so can be moved out
+  // of a nested block without changing when the enclosing block stops.
+  bool never_undefined(const Statement& stmt)
+  {
+    switch (stmt.type)
+    {
+      case StatementType::Nop:
+      case StatementType::AssignInt:
+      case StatementType::AssignVar:
+      case StatementType::MakeArray:
+      case StatementType::MakeNull:
+      case StatementType::MakeNumberInt:
+      case StatementType::MakeNumberRef:
+      case StatementType::MakeObject:
+      case StatementType::MakeSet:
+      case StatementType::ResetLocal:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  // Statements whose only effect is to write their target, and which leave it
+  // defined afterwards.
+  bool defines_target(const Statement& stmt)
+  {
+    switch (stmt.type)
+    {
+      case StatementType::AssignInt:
+      case StatementType::Len:
+      case StatementType::MakeArray:
+      case StatementType::MakeNull:
+      case StatementType::MakeNumberInt:
+      case StatementType::MakeNumberRef:
+      case StatementType::MakeObject:
+      case StatementType::MakeSet:
+        return true;
+
+      case StatementType::AssignVar:
+        return is_constant(stmt.op0);
+
+      default:
+        return false;
+    }
+  }
+
+  // Statements whose only effect is to write their target, and which can
+  // therefore be removed if that target is never read.
+  bool is_pure_store(const Statement& stmt)
+  {
+    return defines_target(stmt) || stmt.type == StatementType::AssignVar ||
+      stmt.type == StatementType::ResetLocal;
+  }
+
+  struct LocalUsage
+  {
+    std::vector<size_t> reads;
+    std::vector<size_t> writes;
+    std::vector<bool> pinned;
+    std::set<size_t> with_targets;
+  };
+
+  class Optimizer
+  {
+  public:
+    Optimizer(BundleDef& bundle) : m_bundle(bundle) {}
+
+    bool run()
+    {
+      analyse();
+      bool changed = false;
+      for (b::Function& function : m_bundle.functions)
+      {
+        m_parameters = function.parameters;
+        changed |= optimize_blocks(function.blocks);
+      }
+
+      m_parameters.clear();
+      for (b::Plan& plan : m_bundle.plans)
+      {
+        changed |= optimize_blocks(plan.blocks);
+      }
+
+      return changed;
+    }
+
+  private:
+    void ensure(size_t local)
+    {
+      if (local >= m_usage.reads.size())
+      {
+        m_usage.reads.resize(local + 1, 0);
+        m_usage.writes.resize(local + 1, 0);
+        m_usage.pinned.resize(local + 1, false);
+      }
+    }
+
+    void pin(size_t local)
+    {
+      ensure(local);
+      m_usage.pinned[local] = true;
+    }
+
+    void analyse(const Block& block)
+    {
+      for (const Statement& stmt : block)
+      {
+        for_each_read(stmt, [this](size_t local) {
+          ensure(local);
+          m_usage.reads[local]++;
+        });
+        for_each_write(stmt, [this](size_t local) {
+          ensure(local);
+          m_usage.writes[local]++;
+        });
+
+        if (stmt.type == StatementType::With)
+        {
+          pin(stmt.target);
+          m_usage.with_targets.insert(stmt.target);
+        }
+
+        for (const Block* nested : nested_blocks(stmt))
+        {
+          analyse(*nested);
+        }
+      }
+    }
+
+    void analyse()
+    {
+      m_usage = LocalUsage();
+      ensure(m_bundle.local_count);
+      // input and data are written by the VM before evaluation starts
+      pin(0);
+      pin(1);
+      for (const b::Function& function : m_bundle.functions)
+      {
+        for (size_t parameter : function.parameters)
+        {
+          pin(parameter);
+        }
+        pin(function.result);
+        for (const Block& block : function.blocks)
+        {
+          analyse(block);
+        }
+      }
+
+      for (const b::Plan& plan : m_bundle.plans)
+      {
+        for (const Block& block : plan.blocks)
+        {
+          analyse(block);
+        }
+      }
+    }
+
+    bool is_read(size_t local) const
+    {
+      return m_usage.pinned[local] || m_usage.reads[local] > 0;
+    }
+
+    bool optimize_blocks(std::vector<Block>& blocks)
+    {
+      bool changed = false;
+      for (Block& block : blocks)
+      {
+        changed |= optimize_block(block);
+      }
+      return changed;
+    }
+
+    bool optimize_block(Block& block)
+    {
+      bool changed = false;
+      Block result;
+      result.reserve(block.size());
+      for (size_t i = 0; i < block.size(); ++i)
+      {
+        Statement stmt = block[i];
+        std::vector<const Block*> nested = nested_blocks(stmt);
+        if (!nested.empty())
+        {
+          std::vector<Block> blocks;
+          bool nested_changed = false;
+          for (const Block* n : nested)
+          {
+            blocks.push_back(*n);
+            nested_changed |= optimize_block(blocks.back());
+          }
+
+          if (nested_changed)
+          {
+            stmt = with_nested_blocks(stmt, std::move(blocks));
+            changed = true;
+          }
+        }
+
+        if (stmt.type == StatementType::Nop)
+        {
+          changed = true;
+          continue;
+        }
+
+        auto maybe_outcome = constant_outcome(stmt);
+        if (maybe_outcome.has_value())
+        {
+          if (*maybe_outcome)
+          {
+            changed = true;
+            continue;
+          }
+
+          // nothing after this statement can ever run
+          result.push_back(stmt);
+          changed |= i + 1 < block.size();
+          break;
+        }
+
+        if (stmt.type == StatementType::Not)
+        {
+          const Block& inner = stmt.ext->block();
+          if (inner.empty())
+          {
+            // the inner block always succeeds, so the Not always fails
+            result.push_back(failing_statement(stmt.location));
+            changed = true;
+            break;
+          }
+
+          if (always_fails(inner.front()))
+          {
+            changed = true;
+            continue;
+          }
+        }
+
+        if (stmt.type == StatementType::Block)
+        {
+          std::vector<Block> blocks;
+          bool can_flatten = true;
+          for (const Block& inner : stmt.ext->blocks())
+          {
+            if (inner.empty() || always_fails(inner.front()))
+            {
+              continue;
+            }
+
+            // a nested Block statement never returns Undefined, and once
+            // Breaks are excluded the nesting depth no longer matters
+            can_flatten = can_flatten && !contains_break(inner) &&
+              std::all_of(inner.begin(), inner.end(), [](const Statement& s) {
+                              return never_undefined(s) ||
+                                s.type == StatementType::Block;
+                            });
+            blocks.push_back(inner);
+          }
+
+          if (blocks.size() != stmt.ext->blocks().size())
+          {
+            stmt = with_nested_blocks(stmt, blocks);
+            changed = true;
+          }
+
+          if (blocks.empty())
+          {
+            changed = true;
+            continue;
+          }
+
+          if (can_flatten)
+          {
+            for (const Block& inner : blocks)
+            {
+              result.insert(result.end(), inner.begin(), inner.end());
+            }
+            changed = true;
+            continue;
+          }
+        }
+
+        if (is_pure_store(stmt) && !is_read(stmt.target))
+        {
+          changed = true;
+          continue;
+        }
+
+        if (
+          stmt.type == StatementType::IsDefined &&
+          is_known_defined(result, stmt.target))
+        {
+          changed = true;
+          continue;
+        }
+
+        result.push_back(stmt);
+      }
+
+      changed |= propagate_copies(result);
+      block = std::move(result);
+      return changed;
+    }
+
+    // Whether the preceding statements of the block guarantee that the local
+    // is defined at this point.
+    bool is_known_defined(const Block& preceding, size_t local) const
+    {
+      for (auto it = preceding.rbegin(); it != preceding.rend(); ++it)
+      {
+        bool writes = false;
+        for_each_write(*it, [&](size_t l) { writes = writes || l == local; });
+        if (writes)
+        {
+          return defines_target(*it);
+        }
+
+        switch (it->type)
+        {
+          case StatementType::Block:
+          case StatementType::Call:
+          case StatementType::CallDynamic:
+          case StatementType::Not:
+          case StatementType::Scan:
+          case StatementType::With:
+            return false;
+
+          default:
+            break;
+        }
+      }
+
+      return false;
+    }
+
+    // Counts reads of the local in the statements (including nested blocks).
+    // `operands` receives the number of those reads which are plain Local
+    // operands, and which could therefore also be replaced by a constant.
+    static size_t count_reads(
+      const Block& block, size_t start, size_t local, size_t& operands)
+    {
+      size_t count = 0;
+      for (size_t i = start; i < block.size(); ++i)
+      {
+        const Statement& stmt = block[i];
+        for_each_read(stmt, [&](size_t l) { count += l == local; });
+        auto count_op = [&](const Operand& op) {
+          operands += op.type == OperandType::Local && op.index == local;
+        };
+        count_op(stmt.op0);
+        count_op(stmt.op1);
+        if (stmt.type == StatementType::Call)
+        {
+          std::for_each(
+            stmt.ext->call().ops.begin(), stmt.ext->call().ops.end(), count_op);
+        }
+        else if (stmt.type == StatementType::CallDynamic)
+        {
+          const b::CallDynamicExt& call = stmt.ext->call_dynamic();
+          std::for_each(call.path.begin(), call.path.end(), count_op);
+          std::for_each(call.ops.begin(), call.ops.end(), count_op);
+        }
+
+        for (const Block* nested : nested_blocks(stmt))
+        {
+          count += count_reads(*nested, 0, local, operands);
+        }
+      }
+
+      return count;
+    }
+
+    static Statement substitute(
+      const Statement& original, size_t local, const Operand& replacement)
+    {
+      Statement stmt = original;
+      auto replace_op = [&](Operand& op) {
+        if (op.type == OperandType::Local && op.index == local)
+        {
+          op = replacement;
+        }
+      };
+
+      replace_op(stmt.op0);
+      replace_op(stmt.op1);
+
+      switch (stmt.type)
+      {
+        case StatementType::Call: {
+          b::CallExt call = stmt.ext->call();
+          std::for_each(call.ops.begin(), call.ops.end(), replace_op);
+          stmt.ext = std::make_shared<const b::StatementExt>(std::move(call));
+        }
+        break;
+
+        case StatementType::CallDynamic: {
+          b::CallDynamicExt call = stmt.ext->call_dynamic();
+          std::for_each(call.path.begin(), call.path.end(), replace_op);
+          std::for_each(call.ops.begin(), call.ops.end(), replace_op);
+          stmt.ext = std::make_shared<const b::StatementExt>(std::move(call));
+        }
+        break;
+
+        case StatementType::ObjectMerge:
+          if (stmt.op0.index == local)
+          {
+            stmt.op0.index = replacement.index;
+          }
+          if (stmt.op1.index == local)
+          {
+            stmt.op1.index = replacement.index;
+          }
+          break;
+
+        default:
+          break;
+      }
+
+      if (
+        reads_target(original) &&
+        original.target == static_cast<std::int32_t>(local))
+      {
+        stmt.target = static_cast<std::int32_t>(replacement.index);
+      }
+
+      std::vector<const Block*> nested = nested_blocks(stmt);
+      if (!nested.empty())
+      {
+        std::vector<Block> blocks;
+        for (const Block* n : nested)
+        {
+          Block block;
+          for (const Statement& s : *n)
+          {
+            block.push_back(substitute(s, local, replacement));
+          }
+          blocks.push_back(std::move(block));
+        }
+        stmt = with_nested_blocks(stmt, std::move(blocks));
+      }
+
+      return stmt;
+    }
+
+    // Whether the source of a copy keeps the same value from the copy until
+    // the end of the block.
+    bool is_stable_source(const Block& block, size_t index, size_t local) const
+    {
+      if (m_usage.pinned[local])
+      {
+        // input, data and the parameters of the current function are only
+        // written when the frame is set up, unless the target of a With.
+        bool is_parameter = local <= 1 ||
+          std::find(m_parameters.begin(), m_parameters.end(), local) !=
+            m_parameters.end();
+        return is_parameter && m_usage.writes[local] == 0 &&
+          !m_usage.with_targets.contains(local);
+      }
+
+      if (m_usage.writes[local] != 1)
+      {
+        return false;
+      }
+
+      for (size_t i = 0; i < index; ++i)
+      {
+        bool writes = false;
+        for_each_write(
+          block[i], [&](size_t l) { writes = writes || l == local; });
+        if (writes)
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool propagate_copies(Block& block)
+    {
+      bool changed = false;
+      for (size_t i = 0; i < block.size(); ++i)
+      {
+        const Statement& copy = block[i];
+        if (copy.type != StatementType::AssignVar)
+        {
+          continue;
+        }
+
+        size_t target = copy.target;
+        if (m_usage.pinned[target] || m_usage.writes[target] != 1)
+        {
+          continue;
+        }
+
+        Operand source = copy.op0;
+        if (source.type == OperandType::Local)
+        {
+          if (
+            source.index == target ||
+            !is_stable_source(block, i, source.index))
+          {
+            continue;
+          }
+        }
+        else if (!is_constant(source))
+        {
+          continue;
+        }
+
+        size_t operands = 0;
+        size_t reads = count_reads(block, i + 1, target, operands);
+        if (reads != m_usage.reads[target])
+        {
+          // the copy is read somewhere it does not dominate
+          continue;
+        }
+
+        if (source.type != OperandType::Local && operands != reads)
+        {
+          // constants can only replace plain operands
+          continue;
+        }
+
+        for (size_t j = i + 1; j < block.size(); ++j)
+        {
+          block[j] = substitute(block[j], target, source);
+        }
+
+        if (source.type == OperandType::Local)
+        {
+          m_usage.reads[source.index] += reads;
+        }
+        m_usage.reads[target] = 0;
+        m_usage.writes[target] = 0;
+        block.erase(block.begin() + i);
+        --i;
+        changed = true;
+      }
+
+      return changed;
+    }
+
+    BundleDef& m_bundle;
+    LocalUsage m_usage;
+    std::vector<size_t> m_parameters;
+  };
+
+  // Renumbers the locals of a single plan or function so that they occupy a
+  // compact range of frame slots. Slots 0 and 1 (input and data) are shared by
+  // every frame and keep their indices.
+  class FrameAllocator
+  {
+  public:
+    size_t local_count() const
+    {
+      return m_slots.size() + 2;
+    }
+
+    size_t slot(size_t local)
+    {
+      if (local < 2)
+      {
+        return local;
+      }
+
+      auto [it, _] = m_slots.insert({local, m_slots.size() + 2});
+      return it->second;
+    }
+
+    std::vector<Block> remap_blocks(const std::vector<Block>& blocks)
+    {
+      std::vector<Block> result;
+      result.reserve(blocks.size());
+      for (const Block& block : blocks)
+      {
+        result.push_back(remap_block(block));
+      }
+      return result;
+    }
+
+  private:
+    Block remap_block(const Block& block)
+    {
+      Block result;
+      result.reserve(block.size());
+      for (const Statement& stmt : block)
+      {
+        result.push_back(remap(stmt));
+      }
+      return result;
+    }
+
+    Statement remap(const Statement& original)
+    {
+      Statement stmt = original;
+      auto remap_op = [this](Operand& op) {
+        if (op.type == OperandType::Local)
+        {
+          op.index = slot(op.index);
+        }
+      };
+
+      remap_op(stmt.op0);
+      remap_op(stmt.op1);
+
+      if (
+        stmt.type == StatementType::ObjectMerge ||
+        stmt.type == StatementType::Scan)
+      {
+        stmt.op0.index = slot(stmt.op0.index);
+        stmt.op1.index = slot(stmt.op1.index);
+      }
+
+      if (reads_target(stmt) || writes_target(stmt))
+      {
+        stmt.target = static_cast<std::int32_t>(slot(stmt.target));
+      }
+
+      switch (stmt.type)
+      {
+        case StatementType::Call: {
+          b::CallExt call = stmt.ext->call();
+          std::for_each(call.ops.begin(), call.ops.end(), remap_op);
+          stmt.ext = std::make_shared<const b::StatementExt>(std::move(call));
+        }
+        break;
+
+        case StatementType::CallDynamic: {
+          b::CallDynamicExt call = stmt.ext->call_dynamic();
+          std::for_each(call.path.begin(), call.path.end(), remap_op);
+          std::for_each(call.ops.begin(), call.ops.end(), remap_op);
+          stmt.ext = std::make_shared<const b::StatementExt>(std::move(call));
+        }
+        break;
+
+        default:
+          break;
+      }
+
+      std::vector<const Block*> nested = nested_blocks(stmt);
+      if (!nested.empty())
+      {
+        std::vector<Block> blocks;
+        for (const Block* n : nested)
+        {
+          blocks.push_back(remap_block(*n));
+        }
+        stmt = with_nested_blocks(stmt, std::move(blocks));
+      }
+
+      return stmt;
+    }
+
+    std::map<size_t, size_t> m_slots;
+  };
+
+  // Marks the Scan statements of a single plan or function whose iterations
+  // are independent of one another. The body of such a scan may only write
+  // locals which it defines before reading and which are not referenced
+  // anywhere else, apart from adding values to collections (the collectors)
+  // created before the scan, which it must not otherwise touch. It may not
+  // break out of the scan, return, or make dynamic calls.
+  class ScanMarker
+  {
+  public:
+    ScanMarker(
+      const std::vector<Block>& blocks, const std::vector<size_t>& external) :
+      m_marked(0)
+    {
+      for (const Block& block : blocks)
+      {
+        count_references(block, m_references);
+      }
+
+      // Parameters and results are referenced by the caller
+      for (size_t local : external)
+      {
+        m_references[local]++;
+      }
+    }
+
+    std::vector<Block> mark_blocks(const std::vector<Block>& blocks)
+    {
+      std::vector<Block> result;
+      result.reserve(blocks.size());
+      for (const Block& block : blocks)
+      {
+        result.push_back(mark_block(block));
+      }
+      return result;
+    }
+
+    size_t marked() const
+    {
+      return m_marked;
+    }
+
+  private:
+    using References = std::map<size_t, size_t>;
+
+    static void count_references(const Block& block, References& references)
+    {
+      for (const Statement& stmt : block)
+      {
+        for_each_read(stmt, [&](size_t local) { references[local]++; });
+        for_each_write(stmt, [&](size_t local) { references[local]++; });
+        for (const Block* nested : nested_blocks(stmt))
+        {
+          count_references(*nested, references);
+        }
+      }
+    }
+
+    static bool is_collector_statement(const Statement& stmt)
+    {
+      switch (stmt.type)
+      {
+        case StatementType::ArrayAppend:
+        case StatementType::ObjectInsert:
+        case StatementType::ObjectInsertOnce:
+        case StatementType::SetAdd:
+          return true;
+
+        default:
+          return false;
+      }
+    }
+
+    // Gathers the locals written by the block, and the number of times each
+    // local is added to. Returns false if the block contains a statement
+    // which leaves the scan.
+    static bool collect_writes(
+      const Block& block, std::set<size_t>& written, References& added)
+    {
+      for (const Statement& stmt : block)
+      {
+        switch (stmt.type)
+        {
+          case StatementType::Break:
+          case StatementType::CallDynamic:
+          case StatementType::ReturnLocal:
+            return false;
+
+          default:
+            break;
+        }
+
+        if (is_collector_statement(stmt))
+        {
+          added[stmt.target]++;
+        }
+
+        for_each_write(stmt, [&](size_t local) { written.insert(local); });
+        for (const Block* nested : nested_blocks(stmt))
+        {
+          if (!collect_writes(*nested, written, added))
+          {
+            return false;
+          }
+        }
+      }
+
+      return true;
+    }
+
+    // Whether every read of a local written by the body is preceded (in the
+    // same iteration) by a write to it.
+    static bool defined_before_use(
+      const Block& block,
+      const std::set<size_t>& written,
+      std::set<size_t> defined)
+    {
+      for (const Statement& stmt : block)
+      {
+        bool valid = true;
+        for_each_read(stmt, [&](size_t local) {
+          valid &= !written.contains(local) || defined.contains(local);
+        });
+
+        if (!valid)
+        {
+          return false;
+        }
+
+        // The With statement replaces its target before running its block
+        if (stmt.type == StatementType::With)
+        {
+          defined.insert(stmt.target);
+        }
+
+        for (const Block* nested : nested_blocks(stmt))
+        {
+          if (!defined_before_use(*nested, written, defined))
+          {
+            return false;
+          }
+        }
+
+        for_each_write(stmt, [&](size_t local) { defined.insert(local); });
+      }
+
+      return true;
+    }
+
+    std::optional<std::vector<size_t>> find_collectors(const Statement& scan)
+    {
+      std::set<size_t> written = {scan.op0.index, scan.op1.index};
+      References added;
+      if (!collect_writes(scan.ext->block(), written, added))
+      {
+        return std::nullopt;
+      }
+
+      References inside;
+      count_references({scan}, inside);
+      for (size_t local : written)
+      {
+        if (local < 2 || inside[local] != m_references[local])
+        {
+          return std::nullopt;
+        }
+      }
+
+      std::vector<size_t> collectors;
+      for (auto [local, count] : added)
+      {
+        if (written.contains(local))
+        {
+          continue;
+        }
+
+        if (local < 2 || inside[local] != count)
+        {
+          return std::nullopt;
+        }
+
+        collectors.push_back(local);
+      }
+
+      if (!defined_before_use(
+            scan.ext->block(), written, {scan.op0.index, scan.op1.index}))
+      {
+        return std::nullopt;
+      }
+
+      return collectors;
+    }
+
+    Block mark_block(const Block& block)
+    {
+      Block result;
+      result.reserve(block.size());
+      for (const Statement& original : block)
+      {
+        Statement stmt = original;
+        std::vector<const Block*> nested = nested_blocks(stmt);
+        if (!nested.empty())
+        {
+          std::vector<Block> blocks;
+          for (const Block* n : nested)
+          {
+            blocks.push_back(mark_block(*n));
+          }
+          stmt = with_nested_blocks(stmt, std::move(blocks));
+        }
+
+        if (stmt.type == StatementType::Scan)
+        {
+          auto maybe_collectors = find_collectors(stmt);
+          if (maybe_collectors.has_value())
+          {
+            b::StatementExt ext(Block(stmt.ext->block()));
+            ext.independent = true;
+            ext.collectors = std::move(*maybe_collectors);
+            stmt.ext = std::make_shared<const b::StatementExt>(std::move(ext));
+            m_marked++;
+          }
+        }
+
+        result.push_back(stmt);
+      }
+      return result;
+    }
+
+    References m_references;
+    size_t m_marked;
+  };
+
+  // Assigns each statement its id (see bundle::Statement::id), numbering the
+  // statements of each block in order and each statement before those
+  // nested within it.
+  class StatementNumberer
+  {
+  public:
+    StatementNumberer() : m_next(0) {}
+
+    std::vector<Block> number_blocks(const std::vector<Block>& blocks)
+    {
+      std::vector<Block> result;
+      result.reserve(blocks.size());
+      for (const Block& block : blocks)
+      {
+        result.push_back(number_block(block));
+      }
+      return result;
+    }
+
+  private:
+    Block number_block(const Block& block)
+    {
+      Block result;
+      result.reserve(block.size());
+      for (const Statement& original : block)
+      {
+        Statement stmt = original;
+        stmt.id = m_next++;
+        std::vector<const Block*> nested = nested_blocks(stmt);
+        if (!nested.empty())
+        {
+          std::vector<Block> blocks;
+          for (const Block* n : nested)
+          {
+            blocks.push_back(number_block(*n));
+          }
+          stmt = with_nested_blocks(stmt, std::move(blocks));
+        }
+
+        result.push_back(stmt);
+      }
+      return result;
+    }
+
+    std::uint32_t m_next;
+  };
+
+  const Statement* find_statement(const Block& block, std::uint32_t id)
+  {
+    for (const Statement& stmt : block)
+    {
+      if (stmt.id == id)
+      {
+        return &stmt;
+      }
+
+      for (const Block* nested : nested_blocks(stmt))
+      {
+        const Statement* found = find_statement(*nested, id);
+        if (found != nullptr)
+        {
+          return found;
+        }
+      }
+    }
+
+    return nullptr;
+  }
+
+  const Statement* find_statement(
+    const std::vector<Block>& blocks, std::uint32_t id)
+  {
+    for (const Block& block : blocks)
+    {
+      const Statement* found = find_statement(block, id);
+      if (found != nullptr)
+      {
+        return found;
+      }
+    }
+
+    return nullptr;
+  }
+
+  // Computes the paths into the input document which a plan can possibly
+  // read. Paths are extended by Dot statements with constant keys and are
+  // copied by assignments and by calls into the parameters and out of the
+  // results of functions. Any other read of a value derived from the input
+  // (a dynamic key, a Scan, a built-in call such as walk, a comparison, and
+  // so on) needs the whole subtree at its path. The analysis is insensitive
+  // to flow and calling context, and so may report more paths than are read
+  // on any one evaluation, but never fewer.
+  class InputPathAnalyzer
+  {
+  public:
+    InputPathAnalyzer(const BundleDef& bundle) : m_bundle(bundle) {}
+
+    std::vector<b::InputPath> analyze(const b::Plan& plan)
+    {
+      m_functions.clear();
+      m_touched.clear();
+      m_used.clear();
+      m_dynamic = false;
+
+      Frame frame;
+      do
+      {
+        m_changed = false;
+        frame[0].insert(b::InputPath());
+        visit_blocks(frame, plan.blocks, std::nullopt);
+        for (auto& [index, callee] : m_functions)
+        {
+          const b::Function& function = m_bundle.functions[index];
+          callee[0].insert(b::InputPath());
+          visit_blocks(callee, function.blocks, index);
+        }
+      } while (m_changed && !m_dynamic);
+
+      if (m_dynamic)
+      {
+        // the callee cannot be known, so neither can what it reads
+        return {b::InputPath()};
+      }
+
+      return terminal_paths();
+    }
+
+  private:
+    using PathSet = std::set<b::InputPath>;
+    using Frame = std::map<size_t, PathSet>;
+
+    bool add_paths(Frame& frame, size_t local, const PathSet& paths)
+    {
+      if (paths.empty())
+      {
+        return false;
+      }
+
+      PathSet& current = frame[local];
+      size_t before = current.size();
+      current.insert(paths.begin(), paths.end());
+      if (current.size() != before)
+      {
+        m_changed = true;
+        return true;
+      }
+
+      return false;
+    }
+
+    void use(const PathSet& paths)
+    {
+      m_used.insert(paths.begin(), paths.end());
+    }
+
+    void use_local(const Frame& frame, size_t local)
+    {
+      auto it = frame.find(local);
+      if (it != frame.end())
+      {
+        use(it->second);
+      }
+    }
+
+    PathSet operand_paths(const Frame& frame, const Operand& op)
+    {
+      if (op.type != OperandType::Local)
+      {
+        return {};
+      }
+
+      auto it = frame.find(op.index);
+      if (it == frame.end())
+      {
+        return {};
+      }
+
+      return it->second;
+    }
+
+    Frame& function_frame(size_t index)
+    {
+      auto it = m_functions.find(index);
+      if (it == m_functions.end())
+      {
+        m_changed = true;
+        it = m_functions.emplace(index, Frame()).first;
+      }
+      return it->second;
+    }
+
+    void visit_blocks(
+      Frame& frame,
+      const std::vector<Block>& blocks,
+      std::optional<size_t> function)
+    {
+      for (const Block& block : blocks)
+      {
+        visit_block(frame, block, function);
+      }
+    }
+
+    void visit_block(
+      Frame& frame, const Block& block, std::optional<size_t> function)
+    {
+      for (const Statement& stmt : block)
+      {
+        visit(frame, stmt, function);
+        for (const Block* nested : nested_blocks(stmt))
+        {
+          visit_block(frame, *nested, function);
+        }
+      }
+    }
+
+    void visit_dot(Frame& frame, const Statement& stmt)
+    {
+      PathSet sources = operand_paths(frame, stmt.op0);
+      if (stmt.op1.type != OperandType::String)
+      {
+        use(sources);
+        use(operand_paths(frame, stmt.op1));
+        return;
+      }
+
+      std::string key = json::unescape(
+        strip_quotes(m_bundle.strings[stmt.op1.index].view()));
+      PathSet paths;
+      for (const b::InputPath& source : sources)
+      {
+        if (source.size() >= MaxInputPathDepth)
+        {
+          m_used.insert(source);
+          continue;
+        }
+
+        b::InputPath path = source;
+        path.push_back(key);
+        paths.insert(path);
+      }
+
+      // Whether the Dot succeeds depends upon the key being present
+      m_touched.insert(paths.begin(), paths.end());
+      add_paths(frame, stmt.target, paths);
+    }
+
+    void visit_call(Frame& frame, const Statement& stmt)
+    {
+      const b::CallExt& call = stmt.ext->call();
+      auto maybe_index = m_bundle.find_function(call.func);
+      if (!maybe_index.has_value())
+      {
+        for (const Operand& op : call.ops)
+        {
+          use(operand_paths(frame, op));
+        }
+        return;
+      }
+
+      const b::Function& function = m_bundle.functions[*maybe_index];
+      Frame& callee = function_frame(*maybe_index);
+      for (size_t i = 2; i < function.parameters.size() && i < call.ops.size();
+           ++i)
+      {
+        add_paths(
+          callee, function.parameters[i], operand_paths(frame, call.ops[i]));
+      }
+
+      auto it = callee.find(function.result);
+      if (it != callee.end())
+      {
+        PathSet results = it->second;
+        add_paths(frame, stmt.target, results);
+      }
+    }
+
+    void visit(
+      Frame& frame, const Statement& stmt, std::optional<size_t> function)
+    {
+      switch (stmt.type)
+      {
+        case StatementType::Dot:
+          visit_dot(frame, stmt);
+          break;
+
+        case StatementType::AssignVar:
+          add_paths(frame, stmt.target, operand_paths(frame, stmt.op0));
+          break;
+
+        case StatementType::AssignVarOnce:
+          // the target is compared with any value it already holds
+          add_paths(frame, stmt.target, operand_paths(frame, stmt.op0));
+          use_local(frame, stmt.target);
+          break;
+
+        case StatementType::Call:
+          visit_call(frame, stmt);
+          break;
+
+        case StatementType::CallDynamic:
+          m_dynamic = true;
+          break;
+
+        case StatementType::ReturnLocal:
+          if (!function.has_value())
+          {
+            use_local(frame, stmt.target);
+          }
+          break;
+
+        case StatementType::With:
+          // the target is the document being patched, not a use of it
+          use(operand_paths(frame, stmt.op0));
+          break;
+
+        default:
+          for_each_read(
+            stmt, [&](size_t local) { use_local(frame, local); });
+          break;
+      }
+    }
+
+    // The paths whose subtrees must be kept whole: those which are used,
+    // and those which are only touched and have no touched extensions.
+    // Paths within a used subtree are subsumed by it.
+    std::vector<b::InputPath> terminal_paths() const
+    {
+      auto within_used = [this](const b::InputPath& path) {
+        for (size_t length = 0; length < path.size(); ++length)
+        {
+          b::InputPath prefix(path.begin(), path.begin() + length);
+          if (m_used.contains(prefix))
+          {
+            return true;
+          }
+        }
+        return false;
+      };
+
+      std::vector<b::InputPath> result;
+      for (const b::InputPath& path : m_used)
+      {
+        if (!within_used(path))
+        {
+          result.push_back(path);
+        }
+      }
+
+      for (auto it = m_touched.begin(); it != m_touched.end(); ++it)
+      {
+        const b::InputPath& path = *it;
+        if (m_used.contains(path) || within_used(path))
+        {
+          continue;
+        }
+
+        // the set is ordered, so any extension immediately follows
+        auto next = std::next(it);
+        if (
+          next != m_touched.end() && next->size() > path.size() &&
+          std::equal(path.begin(), path.end(), next->begin()))
+        {
+          continue;
+        }
+
+        result.push_back(path);
+      }
+
+      std::sort(result.begin(), result.end());
+      return result;
+    }
+
+    const BundleDef& m_bundle;
+    std::map<size_t, Frame> m_functions;
+    PathSet m_touched;
+    PathSet m_used;
+    bool m_changed;
+    bool m_dynamic;
+  };
+
+  // Whether a block reads the input document (in `input_local`), other than
+  // by passing it on to a function it calls, or calls a function which cannot
+  // be known. The functions it calls are added to `callees`.
+  bool reads_input(
+    const BundleDef& bundle,
+    const Block& block,
+    size_t input_local,
+    std::set<size_t>& callees)
+  {
+    for (const Statement& stmt : block)
+    {
+      if (stmt.type == StatementType::CallDynamic)
+      {
+        return true;
+      }
+
+      bool reads = false;
+      if (stmt.type == StatementType::Call)
+      {
+        const b::CallExt& call = stmt.ext->call();
+        auto maybe_index = bundle.find_function(call.func);
+        size_t first = 0;
+        if (maybe_index.has_value())
+        {
+          // the first two arguments are always the input and data documents
+          callees.insert(*maybe_index);
+          first = 2;
+        }
+
+        for (size_t i = first; i < call.ops.size(); ++i)
+        {
+          const Operand& op = call.ops[i];
+          reads |= op.type == OperandType::Local && op.index == input_local;
+        }
+      }
+      else
+      {
+        for_each_read(
+          stmt, [&](size_t local) { reads |= local == input_local; });
+      }
+
+      if (reads)
+      {
+        return true;
+      }
+
+      for (const Block* nested : nested_blocks(stmt))
+      {
+        if (reads_input(bundle, *nested, input_local, callees))
+        {
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  // Marks the cacheable functions whose results depend only on the base data
+  // document, i.e. those which do not read the input document and do not
+  // (transitively) call a function which does. Returns the number marked.
+  size_t mark_data_only_functions(BundleDef& bundle)
+  {
+    size_t count = bundle.functions.size();
+    std::vector<bool> reads(count, false);
+    std::vector<std::set<size_t>> callees(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      const b::Function& function = bundle.functions[i];
+      size_t input_local =
+        function.parameters.empty() ? 0 : function.parameters.front();
+      for (const Block& block : function.blocks)
+      {
+        if (reads_input(bundle, block, input_local, callees[i]))
+        {
+          reads[i] = true;
+          break;
+        }
+      }
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+      changed = false;
+      for (size_t i = 0; i < count; ++i)
+      {
+        if (reads[i])
+        {
+          continue;
+        }
+
+        for (size_t callee : callees[i])
+        {
+          if (reads[callee])
+          {
+            reads[i] = true;
+            changed = true;
+            break;
+          }
+        }
+      }
+    }
+
+    size_t marked = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      b::Function& function = bundle.functions[i];
+      function.data_only = function.cacheable && !reads[i];
+      if (function.data_only)
+      {
+        marked++;
+      }
+    }
+
+    return marked;
+  }
+
+  // Resolves Dot statements which look up a constant key in a local known to
+  // hold a constant path into the base data document (starting from the data
+  // local itself). The value found (if any) is attached to the statement as
+  // a DataRefExt, which the VM uses in place of searching the document, so
+  // long as no With statement has replaced the document.
+  //
+  // Locals are tracked in order through each block. Before entering the
+  // blocks nested in a statement, the locals written anywhere inside them are
+  // forgotten, as a loop may write them after they are read, and they are
+  // also forgotten after the statement, as its blocks may or may not have
+  // run.
+  class DataPathResolver
+  {
+  public:
+    DataPathResolver(const BundleDef& bundle) :
+      m_bundle(bundle), m_resolved(0)
+    {}
+
+    std::vector<Block> resolve_blocks(
+      const std::vector<Block>& blocks, size_t data_local)
+    {
+      if (m_bundle.data == nullptr)
+      {
+        return blocks;
+      }
+
+      Known known;
+      known[data_local] = m_bundle.data;
+      std::vector<Block> result;
+      result.reserve(blocks.size());
+      for (const Block& block : blocks)
+      {
+        result.push_back(resolve_block(block, known));
+      }
+
+      return result;
+    }
+
+    size_t resolved() const
+    {
+      return m_resolved;
+    }
+
+  private:
+    typedef std::map<size_t, Node> Known;
+
+    Block resolve_block(const Block& block, Known known)
+    {
+      Block result;
+      result.reserve(block.size());
+      for (const Statement& original : block)
+      {
+        Statement stmt = original;
+        if (
+          stmt.type == StatementType::Dot &&
+          stmt.op0.type == OperandType::Local &&
+          stmt.op1.type == OperandType::String &&
+          known.contains(stmt.op0.index))
+        {
+          std::optional<Node> value =
+            lookup(known[stmt.op0.index], m_bundle.strings[stmt.op1.index]);
+          if (value.has_value())
+          {
+            stmt.ext = std::make_shared<const b::StatementExt>(
+              b::DataRefExt{value.value()});
+            m_resolved++;
+            if (value.value() != nullptr)
+            {
+              known[stmt.target] = value.value();
+            }
+            else
+            {
+              known.erase(stmt.target);
+            }
+
+            result.push_back(stmt);
+            continue;
+          }
+        }
+
+        std::vector<const Block*> nested = nested_blocks(stmt);
+        if (!nested.empty())
+        {
+          Known inner = known;
+          for (const Block* n : nested)
+          {
+            forget_writes(*n, inner);
+            forget_writes(*n, known);
+          }
+
+          std::vector<Block> blocks;
+          for (const Block* n : nested)
+          {
+            blocks.push_back(resolve_block(*n, inner));
+          }
+          stmt = with_nested_blocks(stmt, std::move(blocks));
+        }
+
+        forget_writes(stmt, known);
+        result.push_back(stmt);
+      }
+
+      return result;
+    }
+
+    // Every local which the statement writes or modifies in place
+    void forget_writes(const Statement& stmt, Known& known)
+    {
+      for_each_write(stmt, [&known](size_t local) { known.erase(local); });
+      switch (stmt.type)
+      {
+        case StatementType::ArrayAppend:
+        case StatementType::ObjectInsert:
+        case StatementType::ObjectInsertOnce:
+        case StatementType::SetAdd:
+          known.erase(stmt.target);
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    void forget_writes(const Block& block, Known& known)
+    {
+      for (const Statement& stmt : block)
+      {
+        forget_writes(stmt, known);
+        for (const Block* n : nested_blocks(stmt))
+        {
+          forget_writes(*n, known);
+        }
+      }
+    }
+
+    // Looks up a key in an object as VirtualMachine::dot does. Returns
+    // std::nullopt if the source is not an object (such lookups are left to
+    // the VM), or nullptr if the object has no such key.
+    std::optional<Node> lookup(const Node& source, const Location& key)
+    {
+      if (source == TapeValue)
+      {
+        const DataTape& tape = *m_bundle.data_tape;
+        if (tape.type(source) != Object)
+        {
+          return std::nullopt;
+        }
+
+        return tape.find(source, JSONString ^ key);
+      }
+
+      auto maybe_object = unwrap(source, Object);
+      if (!maybe_object.success)
+      {
+        return std::nullopt;
+      }
+
+      std::string query_str = to_key(JSONString ^ key);
+      for (const Node& member : *maybe_object.node)
+      {
+        if (to_key(member / Key) == query_str)
+        {
+          return member / Val;
+        }
+      }
+
+      return nullptr;
+    }
+
+    const BundleDef& m_bundle;
+    size_t m_resolved;
+  };
+
+  size_t resolve_data_paths(BundleDef& bundle)
+  {
+    // in functions, as in plans, the data document is passed in local 1
+    DataPathResolver data_paths(bundle);
+    for (b::Function& function : bundle.functions)
+    {
+      size_t data_local = function.parameters.size() > 1 ?
+        function.parameters[1] :
+        1;
+      function.blocks = data_paths.resolve_blocks(function.blocks, data_local);
+    }
+    for (b::Plan& plan : bundle.plans)
+    {
+      plan.blocks = data_paths.resolve_blocks(plan.blocks, 1);
+    }
+    return data_paths.resolved();
+  }
+}
+
+namespace rego
+{
+  bundle::OptimizeStats BundleDef::optimize()
+  {
+    bundle::OptimizeStats stats;
+    for (const b::Function& function : functions)
+    {
+      stats.statements_before += count_statements(function.blocks);
+    }
+    for (const b::Plan& plan : plans)
+    {
+      stats.statements_before += count_statements(plan.blocks);
+    }
+
+    Optimizer optimizer(*this);
+    while (stats.passes < MaxOptimizePasses)
+    {
+      stats.passes++;
+      if (!optimizer.run())
+      {
+        break;
+      }
+    }
+
+    for (const b::Function& function : functions)
+    {
+      stats.statements_after += count_statements(function.blocks);
+    }
+    for (const b::Plan& plan : plans)
+    {
+      stats.statements_after += count_statements(plan.blocks);
+    }
+
+    // Every plan and function call gets a fresh frame from the VM, so their
+    // locals can be renumbered independently. The frame for a call chain is
+    // then proportional to its depth rather than to the size of the bundle.
+    stats.local_count_before = local_count;
+    local_count = 2;
+    for (b::Function& function : functions)
+    {
+      FrameAllocator frame;
+      for (size_t& parameter : function.parameters)
+      {
+        parameter = frame.slot(parameter);
+      }
+      function.result = frame.slot(function.result);
+      function.blocks = frame.remap_blocks(function.blocks);
+      function.local_count = frame.local_count();
+      local_count = std::max(local_count, function.local_count);
+
+      std::vector<size_t> external = function.parameters;
+      external.push_back(function.result);
+      ScanMarker marker(function.blocks, external);
+      function.blocks = marker.mark_blocks(function.blocks);
+      stats.independent_scans += marker.marked();
+    }
+
+    InputPathAnalyzer input_paths(*this);
+    for (b::Plan& plan : plans)
+    {
+      FrameAllocator frame;
+      plan.blocks = frame.remap_blocks(plan.blocks);
+      plan.local_count = frame.local_count();
+      local_count = std::max(local_count, plan.local_count);
+
+      ScanMarker marker(plan.blocks, {});
+      plan.blocks = marker.mark_blocks(plan.blocks);
+      stats.independent_scans += marker.marked();
+
+      plan.input_paths = input_paths.analyze(plan);
+    }
+
+    stats.local_count_after = local_count;
+
+    stats.data_paths = resolve_data_paths(*this);
+
+    stats.data_only_functions = mark_data_only_functions(*this);
+
+    StatementNumberer numberer;
+    for (b::Function& function : functions)
+    {
+      function.blocks = numberer.number_blocks(function.blocks);
+    }
+    for (b::Plan& plan : plans)
+    {
+      plan.blocks = numberer.number_blocks(plan.blocks);
+    }
+
+    logging::Debug() << "Optimized bundle in " << stats.passes
+                     << " passes: " << stats.statements_before << " -> "
+                     << stats.statements_after << " statements, "
+                     << stats.local_count_before << " -> "
+                     << stats.local_count_after << " locals, "
+                     << stats.independent_scans << " independent scans, "
+                     << stats.data_paths << " resolved data paths, "
+                     << stats.data_only_functions << " data-only functions";
+    return stats;
+  }
+
+  bool BundleDef::compact_data()
+  {
+    if (data_tape != nullptr)
+    {
+      return true;
+    }
+
+    if (data == nullptr)
+    {
+      return false;
+    }
+
+    std::shared_ptr<const DataTape> tape = DataTape::encode(data);
+    if (tape == nullptr)
+    {
+      logging::Debug() << "Data document cannot be compacted";
+      return false;
+    }
+
+    // the resolved paths hold nodes of the old document, which would keep it
+    // alive, as would the constants if they hold it (see
+    // materialize_constants)
+    if (constants != nullptr && data->parent() == constants.get())
+    {
+      constants->replace(data);
+    }
+
+    data_tape = tape;
+    data = tape->root();
+    size_t resolved = resolve_data_paths(*this);
+    logging::Debug() << "Compacted data document, " << resolved
+                     << " resolved data paths";
+    return true;
+  }
+
+  const bundle::Statement* BundleDef::find_statement(std::uint32_t id) const
+  {
+    for (const b::Function& function : functions)
+    {
+      const b::Statement* found = ::find_statement(function.blocks, id);
+      if (found != nullptr)
+      {
+        return found;
+      }
+    }
+
+    for (const b::Plan& plan : plans)
+    {
+      const b::Statement* found = ::find_statement(plan.blocks, id);
+      if (found != nullptr)
+      {
+        return found;
+      }
+    }
+
+    return nullptr;
+  }
+}
@@ -0,0 +1,339 @@
+#include "internal.hh"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace
+{
+  using namespace rego;
+
+  // The header of a value holds its tag in the low byte.
+  const int TagBits = 8;
+  const std::uint64_t TagMask = 0xFF;
+
+  // The tags index Tokens, and the containers come first.
+  enum Tag : std::uint8_t
+  {
+    ObjectTag,
+    ArrayTag,
+    SetTag,
+    StringTag,
+    IntTag,
+    FloatTag,
+    TrueTag,
+    FalseTag,
+    NullTag
+  };
+
+  const Token Tokens[] = {
+    Object, Array, Set, JSONString, Int, Float, True, False, Null};
+
+  bool is_container(std::uint8_t tag)
+  {
+    return tag <= SetTag;
+  }
+
+  Node unwrap_value(const Node& node)
+  {
+    Node value = node;
+    if (value->type() == Term)
+    {
+      value = value->front();
+    }
+
+    if (value->type() == Scalar)
+    {
+      value = value->front();
+    }
+
+    return value;
+  }
+
+  Node term(const Node& value)
+  {
+    if (value->in({Object, Array, Set, TapeValue}))
+    {
+      return Term << value;
+    }
+
+    return Term << (Scalar << value);
+  }
+}
+
+namespace rego
+{
+  struct DataTape::Encoder
+  {
+    DataTape& tape;
+    std::unordered_map<std::string, std::uint64_t> interned;
+
+    std::uint64_t intern(const std::string_view& str)
+    {
+      auto [it, inserted] =
+        interned.try_emplace(std::string(str), interned.size());
+      if (inserted)
+      {
+        tape.m_strings.append(str);
+        tape.m_string_offsets.push_back(tape.m_strings.size());
+      }
+
+      return it->second;
+    }
+
+    void push(std::uint8_t tag, std::uint64_t payload)
+    {
+      tape.m_words.push_back(tag | (payload << TagBits));
+    }
+
+    // Appends a value to the tape. Returns false if it cannot be encoded.
+    bool encode(const Node& node)
+    {
+      Node value = unwrap_value(node);
+      if (value == Object)
+      {
+        std::vector<std::pair<std::string, Node>> items;
+        items.reserve(value->size());
+        for (const Node& item : *value)
+        {
+          Node key = unwrap_value(item / Key);
+          if (key != JSONString)
+          {
+            return false;
+          }
+
+          items.emplace_back(to_key(key), item / Val);
+        }
+
+        // stable, so that a lookup finds the first of any duplicate keys as
+        // VirtualMachine::dot does
+        std::stable_sort(
+          items.begin(), items.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.first < rhs.first;
+          });
+
+        size_t start = tape.m_words.size();
+        size_t count = items.size();
+        push(ObjectTag, count);
+        for (const auto& item : items)
+        {
+          tape.m_words.push_back(intern(item.first));
+        }
+
+        tape.m_words.resize(start + 1 + 2 * count, 0);
+        for (size_t i = 0; i < count; ++i)
+        {
+          tape.m_words[start + 1 + count + i] = tape.m_words.size();
+          if (!encode(items[i].second))
+          {
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+      if (value->in({Array, Set}))
+      {
+        size_t start = tape.m_words.size();
+        size_t count = value->size();
+        push(value == Array ? ArrayTag : SetTag, count);
+        tape.m_words.resize(start + 1 + count, 0);
+        for (size_t i = 0; i < count; ++i)
+        {
+          tape.m_words[start + 1 + i] = tape.m_words.size();
+          if (!encode(value->at(i)))
+          {
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+      for (std::uint8_t tag = StringTag; tag <= NullTag; ++tag)
+      {
+        if (value == Tokens[tag])
+        {
+          push(tag, intern(value->location().view()));
+          return true;
+        }
+      }
+
+      return false;
+    }
+  };
+
+  std::shared_ptr<const DataTape> DataTape::encode(const Node& data)
+  {
+    auto tape = std::make_shared<DataTape>();
+    tape->m_string_offsets.push_back(0);
+    Encoder encoder{*tape, {}};
+    if (!encoder.encode(data))
+    {
+      return nullptr;
+    }
+
+    tape->m_words.shrink_to_fit();
+    tape->m_strings.shrink_to_fit();
+    tape->m_string_offsets.shrink_to_fit();
+    tape->m_views = SourceDef::synthetic(
+      std::string(tape->m_words.size(), ' '), "compact data");
+    return tape;
+  }
+
+  Node DataTape::root() const
+  {
+    return value(0);
+  }
+
+  Token DataTape::type(const Node& view) const
+  {
+    return Tokens[tag(offset(view))];
+  }
+
+  size_t DataTape::size(const Node& view) const
+  {
+    return payload(offset(view));
+  }
+
+  Node DataTape::find(const Node& view, const Node& key) const
+  {
+    size_t start = offset(view);
+    if (tag(start) != ObjectTag)
+    {
+      return nullptr;
+    }
+
+    std::string query_str = to_key(key);
+    size_t count = payload(start);
+    auto keys = m_words.begin() + start + 1;
+    auto it = std::lower_bound(
+      keys,
+      keys + count,
+      query_str,
+      [this](std::uint64_t index, const std::string& query) {
+        return string(index) < query;
+      });
+    if (it == keys + count || string(*it) != query_str)
+    {
+      return nullptr;
+    }
+
+    return value(*(it + count));
+  }
+
+  Node DataTape::at(const Node& view, size_t index) const
+  {
+    size_t start = offset(view);
+    size_t count = payload(start);
+    if (tag(start) == ObjectTag)
+    {
+      return value(m_words[start + 1 + count + index]);
+    }
+
+    return value(m_words[start + 1 + index]);
+  }
+
+  Node DataTape::key_at(const Node& view, size_t index) const
+  {
+    size_t start = offset(view);
+    return JSONString ^ std::string(string(m_words[start + 1 + index]));
+  }
+
+  Node DataTape::expand(const Node& view) const
+  {
+    size_t start = offset(view);
+    std::uint8_t container = tag(start);
+    Node result = NodeDef::create(Tokens[container]);
+    for (size_t i = 0; i < payload(start); ++i)
+    {
+      Node child = term(at(view, i));
+      if (container == ObjectTag)
+      {
+        result << (ObjectItem << term(key_at(view, i)) << child);
+      }
+      else
+      {
+        result << child;
+      }
+    }
+
+    return result;
+  }
+
+  Node DataTape::materialize(const Node& view) const
+  {
+    return build(offset(view));
+  }
+
+  Node DataTape::document() const
+  {
+    return build(0);
+  }
+
+  size_t DataTape::offset(const Node& view) const
+  {
+    const Location& loc = view->location();
+    if (loc.source != m_views || loc.pos >= m_words.size())
+    {
+      throw std::runtime_error("Invalid data tape view");
+    }
+
+    return loc.pos;
+  }
+
+  std::uint8_t DataTape::tag(size_t offset) const
+  {
+    return static_cast<std::uint8_t>(m_words[offset] & TagMask);
+  }
+
+  size_t DataTape::payload(size_t offset) const
+  {
+    return static_cast<size_t>(m_words[offset] >> TagBits);
+  }
+
+  std::string_view DataTape::string(size_t index) const
+  {
+    size_t start = m_string_offsets[index];
+    return std::string_view(m_strings)
+      .substr(start, m_string_offsets[index + 1] - start);
+  }
+
+  Node DataTape::value(size_t offset) const
+  {
+    if (is_container(tag(offset)))
+    {
+      return TapeValue ^ Location(m_views, offset, 1);
+    }
+
+    return build(offset);
+  }
+
+  Node DataTape::build(size_t offset) const
+  {
+    std::uint8_t value_tag = tag(offset);
+    if (!is_container(value_tag))
+    {
+      return Tokens[value_tag] ^ std::string(string(payload(offset)));
+    }
+
+    poll_eval_limits();
+    size_t count = payload(offset);
+    Node result = NodeDef::create(Tokens[value_tag]);
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (value_tag == ObjectTag)
+      {
+        Node key = JSONString ^ std::string(string(m_words[offset + 1 + i]));
+        Node val = build(m_words[offset + 1 + count + i]);
+        result << (ObjectItem << term(key) << term(val));
+      }
+      else
+      {
+        result << term(build(m_words[offset + 1 + i]));
+      }
+    }
+
+    return result;
+  }
+}
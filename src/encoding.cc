@@ -117,9 +117,7 @@ namespace rego
     {
       try
       {
-        double value = std::stod(std::string(node->location().view()));
-        buf << std::setprecision(std::numeric_limits<double>::max_digits10 - 1)
-            << std::noshowpoint << value;
+        buf << format_double(parse_double(node->location().view()));
       }
       catch (...)
       {
@@ -2,6 +2,8 @@
 
 #include "rego.hh"
 
+#include <algorithm>
+#include <charconv>
 #include <initializer_list>
 #include <trieste/json.h>
 
@@ -95,9 +97,51 @@ namespace
     return BigInt(node->location());
   }
 
+  bool is_digit(char c)
+  {
+    return c >= '0' && c <= '9';
+  }
+
+  // The number of significant digits in the mantissa of number text, which
+  // may overcount (e.g. trailing zeros) but never undercounts.
+  size_t significant_digits(const std::string_view& text)
+  {
+    size_t count = 0;
+    for (char c : text)
+    {
+      if (c == 'e' || c == 'E')
+      {
+        break;
+      }
+
+      if (c >= '1' && c <= '9')
+      {
+        count++;
+      }
+      else if (c == '0' && count > 0)
+      {
+        count++;
+      }
+    }
+
+    return count;
+  }
+
   double get_double(const Node& node)
   {
-    return std::stod(to_key(node));
+    std::string_view text = node->location().view();
+    double value = parse_double(text);
+    if (
+      node->type() == Float &&
+      significant_digits(text) > std::numeric_limits<double>::digits10)
+    {
+      // Floats compare at the precision at which they are formatted (see
+      // to_key). Text with no more digits than a double can hold round-trips
+      // through that formatting unchanged, so only longer text is rounded.
+      value = parse_double(format_double(value));
+    }
+
+    return value;
   }
 
   bool refarg_is_varref(const Node& refarg)
@@ -121,6 +165,9 @@ namespace
 
     return term->front() == Var || term->front() == Ref;
   }
+
+  // The number of DiscardErrors scopes open on this thread.
+  thread_local size_t discard_errors_depth = 0;
 }
 
 namespace rego
@@ -205,10 +252,140 @@ namespace rego
 
   Node err(Node node, const std::string& msg, const std::string& code)
   {
+    if (errors_discarded())
+    {
+      // the error will only be tested for, so neither the node nor the
+      // message is kept
+      return NodeDef::create(Error);
+    }
+
     return Error << (ErrorMsg ^ msg) << (ErrorAst << node->clone())
                  << (ErrorCode ^ get_code(msg, code));
   }
 
+  Node err(
+    Node node,
+    const std::function<std::string()>& msg,
+    const std::string& code)
+  {
+    if (errors_discarded())
+    {
+      return NodeDef::create(Error);
+    }
+
+    return err(node, msg(), code);
+  }
+
+  std::string format_double(double value)
+  {
+    char buf[32];
+    auto result = std::to_chars(
+      buf,
+      buf + sizeof(buf),
+      value,
+      std::chars_format::general,
+      std::numeric_limits<double>::max_digits10 - 1);
+    return std::string(buf, result.ptr);
+  }
+
+  double parse_double(const std::string_view& text)
+  {
+    double value;
+    const char* end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    if (result.ec == std::errc() && result.ptr == end)
+    {
+      return value;
+    }
+
+    return std::stod(std::string(text));
+  }
+
+  bool scan_int(const std::string_view& text, bool allow_leading_zeros)
+  {
+    size_t i = 0;
+    if (i < text.size() && text[i] == '-')
+    {
+      i++;
+    }
+
+    size_t start = i;
+    while (i < text.size() && is_digit(text[i]))
+    {
+      i++;
+    }
+
+    if (i == start || i != text.size())
+    {
+      return false;
+    }
+
+    return allow_leading_zeros || text[start] != '0' || i - start == 1;
+  }
+
+  bool scan_float(const std::string_view& text)
+  {
+    auto digits = [&text](size_t& i) {
+      size_t start = i;
+      while (i < text.size() && is_digit(text[i]))
+      {
+        i++;
+      }
+
+      return i > start;
+    };
+
+    size_t i = 0;
+    if (i < text.size() && text[i] == '-')
+    {
+      i++;
+    }
+
+    if (!digits(i) || i == text.size() || text[i] != '.')
+    {
+      return false;
+    }
+
+    i++;
+    if (!digits(i))
+    {
+      return false;
+    }
+
+    if (i == text.size())
+    {
+      return true;
+    }
+
+    if (text[i] != 'e')
+    {
+      return false;
+    }
+
+    i++;
+    if (i < text.size() && (text[i] == '+' || text[i] == '-'))
+    {
+      i++;
+    }
+
+    return digits(i) && i == text.size();
+  }
+
+  DiscardErrors::DiscardErrors()
+  {
+    discard_errors_depth++;
+  }
+
+  DiscardErrors::~DiscardErrors()
+  {
+    discard_errors_depth--;
+  }
+
+  bool errors_discarded()
+  {
+    return discard_errors_depth > 0;
+  }
+
   Node version()
   {
     Node object = NodeDef::create(Object);
@@ -285,6 +462,141 @@ namespace rego
     return std::string(value->location().view());
   }
 
+  size_t combine(size_t seed, size_t value)
+  {
+    return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+  }
+
+  namespace
+  {
+    Node structural_value(Node node)
+    {
+      while (node->in({Term, Scalar}) && node->size() == 1)
+      {
+        node = node->front();
+      }
+
+      return node;
+    }
+
+    std::string_view structural_text(const Node& node)
+    {
+      std::string_view text = node->location().view();
+      if (
+        node == JSONString && text.size() >= 2 && text.front() == '"' &&
+        text.back() == '"')
+      {
+        text = text.substr(1, text.size() - 2);
+      }
+
+      return text;
+    }
+  }
+
+  size_t structural_hash(const Node& node)
+  {
+    Node value = structural_value(node);
+    size_t hash = std::hash<const void*>{}(value->type().str());
+    if (value->empty())
+    {
+      return combine(
+        hash, std::hash<std::string_view>{}(structural_text(value)));
+    }
+
+    if (value->in({Object, Set}))
+    {
+      // summed, so that the order of the members does not matter
+      size_t members = 0;
+      for (const Node& child : *value)
+      {
+        members += structural_hash(child);
+      }
+
+      return combine(hash, members);
+    }
+
+    for (const Node& child : *value)
+    {
+      hash = combine(hash, structural_hash(child));
+    }
+
+    return hash;
+  }
+
+  bool structural_equal(const Node& lhs, const Node& rhs)
+  {
+    Node l = structural_value(lhs);
+    Node r = structural_value(rhs);
+    if (l.get() == r.get())
+    {
+      return true;
+    }
+
+    if (l->type() != r->type() || l->size() != r->size())
+    {
+      return false;
+    }
+
+    if (l->empty())
+    {
+      return structural_text(l) == structural_text(r);
+    }
+
+    bool unordered = l->in({Object, Set});
+    for (size_t i = 0; i < l->size(); ++i)
+    {
+      if (structural_equal(l->at(i), r->at(i)))
+      {
+        continue;
+      }
+
+      // object keys and set members are unique, so a member which is not in
+      // the same place need only be found somewhere in the other
+      if (
+        !unordered ||
+        std::none_of(r->begin(), r->end(), [&](const Node& other) {
+          return structural_equal(l->at(i), other);
+        }))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  Node adopt(const Node& node)
+  {
+    if (node->parent() == nullptr)
+    {
+      return node;
+    }
+
+    return node->clone();
+  }
+
+  std::string_view get_string_view(const Node& node)
+  {
+    Node value = node;
+    if (value->type() == Term)
+    {
+      value = value->front();
+    }
+
+    if (value->type() == Scalar)
+    {
+      value = value->front();
+    }
+
+    std::string_view view = value->location().view();
+    if (value->type() == JSONString && is_quoted(view))
+    {
+      return view.substr(1, view.size() - 2);
+    }
+
+    return view;
+  }
+
   bool get_bool(const Node& node)
   {
     assert(node->type() == True || node->type() == False);
@@ -416,7 +728,7 @@ namespace rego
       return result.node;
     }
 
-    if (!m_message.empty())
+    if (!m_message.empty() || errors_discarded())
     {
       return err(node, m_message, m_code);
     }
@@ -5,7 +5,16 @@
 
 #include "rego/rego.hh"
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
 
 namespace rego
 {
@@ -42,10 +51,6 @@ namespace rego
     static Node membership(
       const Node& index, const Node& item, const Node& itemseq);
     static Node membership(const Node& item, const Node& itemseq);
-    static std::vector<std::string> array_find(
-      const Node& array, const std::string& search);
-    static std::vector<std::string> object_find(
-      const Node& object, const std::string& search);
     static Node to_term(const Node& value);
   };
 
@@ -135,6 +140,9 @@ namespace rego
   inline const auto FuncArgVar = TokenDef("rego-funcargvar", flag::print);
   inline const auto UnifyVar = TokenDef("rego-unifyvar", flag::print);
   inline const auto Alias = TokenDef("rego-alias");
+  inline const auto WalkIterator = TokenDef("rego-walkiterator");
+  inline const auto RangeValue = TokenDef("rego-rangevalue", flag::print);
+  inline const auto TapeValue = TokenDef("rego-tapevalue", flag::print);
 
   // clang-format off
   inline const auto wf_bundle_input =
@@ -267,6 +275,250 @@ namespace rego
   std::string add_quotes(const std::string_view& str);
   std::string type_name(const Node& node, bool specify_number = false);
 
+  // Returns a copy of the JSON document which keeps only the subtrees at the
+  // provided paths, or std::nullopt if the document could not be scanned.
+  std::optional<std::string> project_json(
+    const std::string_view& json, const std::vector<bundle::InputPath>& paths);
+
+  // Formats a double as Float values are formatted throughout the library:
+  // 16 significant digits (i.e. printf's %.16g), which hides representation
+  // error in the last digit.
+  std::string format_double(double value);
+
+  // Parses the text of a number as a double without going through a stream
+  // or locale. Falls back to std::stod (and so throws as it does) for text
+  // std::from_chars cannot parse in full.
+  double parse_double(const std::string_view& text);
+
+  // Whether text is an integer, i.e. `-?[0-9]+`. Unless leading zeros are
+  // allowed, the only integer starting with 0 is 0 itself.
+  bool scan_int(const std::string_view& text, bool allow_leading_zeros);
+
+  // Whether text is a float of the form `-?[0-9]+\.[0-9]+(e[+-]?[0-9]+)?`.
+  bool scan_float(const std::string_view& text);
+
+  // While an instance is alive, errors made with err() on the current thread
+  // will be discarded rather than reported, so err() returns a bare Error
+  // node without cloning the offending node or keeping the message. Used by
+  // BuiltInsDef::call when strict errors are off.
+  class DiscardErrors
+  {
+  public:
+    DiscardErrors();
+    ~DiscardErrors();
+    DiscardErrors(const DiscardErrors&) = delete;
+    DiscardErrors& operator=(const DiscardErrors&) = delete;
+  };
+
+  // Whether errors made on the current thread will be discarded.
+  bool errors_discarded();
+
+  // Like get_string, but returns a view of the node's location rather than
+  // a copy.
+  std::string_view get_string_view(const Node& node);
+
+  // Mixes a hash into a seed.
+  size_t combine(size_t seed, size_t value);
+
+  // Hashes the structure of a value: the types of its nodes, the text of its
+  // leaves and (except in objects and sets) the order of its children. The
+  // Term and Scalar wrappers of a value, and the quotes around a string, are
+  // not part of it. The locations of other nodes point into whichever source
+  // the value was parsed from, so they are ignored.
+  size_t structural_hash(const Node& node);
+
+  // Whether two values have the same structure (see structural_hash).
+  // Numbers are compared by their text, so an Int and a Float with the same
+  // value are not equal.
+  bool structural_equal(const Node& lhs, const Node& rhs);
+
+  // Returns the node if it has no parent, and otherwise a copy of it. Adding
+  // a node to a tree overwrites its parent, so a value which already belongs
+  // to one (an element of a collection, part of the data document) is
+  // copied before it is added to another, while a fresh value is adopted.
+  Node adopt(const Node& node);
+
+  // A small ring of values derived from nodes (tries, hash indexes) which
+  // built-ins reuse across calls, keyed on the identity of the node. Values
+  // derived from the data document are kept by the bundle instead (see
+  // data_index_cache), so these hold those derived from the input. The
+  // node is held so that its address cannot be reused, and its size is
+  // checked as the VM only ever mutates collections by appending to them.
+  // The caches are not synchronised: built-ins keep them thread_local and
+  // clear them at the start of each evaluation (see BuiltInDef::clear), so
+  // a value is pinned no longer than that.
+  template<typename T>
+  class IdentityCache
+  {
+  public:
+    IdentityCache(size_t capacity) : m_capacity(capacity), m_next(0) {}
+
+    // The value cached for the node, or nullptr. The pointer is valid until
+    // the next insert or clear.
+    const T* find(const Node& node) const
+    {
+      for (auto& entry : m_entries)
+      {
+        if (entry.node.get() == node.get() && entry.size == node->size())
+        {
+          return &entry.value;
+        }
+      }
+
+      return nullptr;
+    }
+
+    void insert(const Node& node, T value)
+    {
+      Entry entry{node, node->size(), std::move(value)};
+      if (m_entries.size() < m_capacity)
+      {
+        m_entries.push_back(std::move(entry));
+        return;
+      }
+
+      m_entries[m_next] = std::move(entry);
+      m_next = (m_next + 1) % m_capacity;
+    }
+
+    void clear()
+    {
+      m_entries.clear();
+      m_next = 0;
+    }
+
+  private:
+    struct Entry
+    {
+      Node node;
+      size_t size;
+      T value;
+    };
+
+    size_t m_capacity;
+    size_t m_next;
+    std::vector<Entry> m_entries;
+  };
+
+  // Rune metadata for a UTF-8 string, computed in a single pass. ASCII
+  // strings (by far the most common) need no index, as rune and byte offsets
+  // coincide. Otherwise the byte offset of every rune is recorded, so that
+  // built-ins can work on the original bytes instead of converting the
+  // string to a runestring. The offsets are shared between copies, so an
+  // index is cheap to pass by value.
+  class RuneIndex
+  {
+  public:
+    RuneIndex(const std::string_view& str);
+
+    bool is_ascii() const;
+
+    // The number of runes in the string.
+    size_t size() const;
+
+    // The byte offset of a rune. `rune` may be size(), in which case the
+    // length of the string in bytes is returned.
+    size_t byte_offset(size_t rune) const;
+
+    // The index of the rune which contains the byte at the given offset.
+    size_t rune_offset(size_t byte) const;
+
+    // The bytes of `count` runes starting at rune `pos` of `str`, which must
+    // be the string the index was built from.
+    std::string_view substr(
+      const std::string_view& str, size_t pos, size_t count) const;
+
+  private:
+    size_t m_bytes;
+    bool m_ascii;
+    std::shared_ptr<const std::vector<std::uint32_t>> m_offsets;
+  };
+
+  // Returns the rune index of a string node. Indexes of longer strings are
+  // cached against the identity of the node, so repeated calls on the same
+  // value (e.g. one held in data or bound outside a loop) do not rescan it.
+  // Short ASCII strings are indexed without allocating.
+  RuneIndex rune_index(const Node& node);
+
+  // Drops the rune indexes cached by the calling thread.
+  void clear_rune_indexes();
+
+  // Whether a string consists only of 7-bit ASCII characters.
+  bool is_ascii(const std::string_view& str);
+
+  // A read-only encoding of a data document (see BundleDef::compact_data) as
+  // one contiguous tape of words. Each value starts with a header word which
+  // holds its type in the low byte and, above that, the index of its text in
+  // the string table (scalars) or its number of children (containers). The
+  // header of an array or set is followed by the offsets of its children,
+  // and that of an object by the string indices of its keys, sorted so that
+  // they can be binary searched, and then the offsets of their values.
+  // Strings are interned, so a key which occurs in many objects is stored
+  // once.
+  //
+  // The VM refers to a container in the tape with a view: a TapeValue node
+  // whose location starts at the offset of the container in a source held
+  // by the tape, so that it is made without a lock and read without parsing.
+  // Scalars are always built as nodes, and containers only when they escape
+  // into something (a built-in, a comparison, a result) which needs a real
+  // value. The tape keeps nothing it builds: each evaluation keeps the
+  // containers it has built (see VirtualMachine::State::materialize), so
+  // that repeated reads do not defeat the caches keyed on node identity.
+  class DataTape
+  {
+  public:
+    // Returns nullptr if the document cannot be encoded, i.e. if one of its
+    // objects has a key which is not a string.
+    static std::shared_ptr<const DataTape> encode(const Node& data);
+
+    // The view of the whole document.
+    Node root() const;
+
+    // The type (Object, Array or Set) of the container a view refers to.
+    Token type(const Node& view) const;
+
+    // The number of children of the container a view refers to.
+    size_t size(const Node& view) const;
+
+    // The value of a key in an object, as dot looks it up, or nullptr if the
+    // object has no such key.
+    Node find(const Node& view, const Node& key) const;
+
+    // The value of the child at `index` of a container.
+    Node at(const Node& view, size_t index) const;
+
+    // The key of the item at `index` of an object.
+    Node key_at(const Node& view, size_t index) const;
+
+    // Builds one level of a container, with views in place of its child
+    // containers. The result is only fit to be iterated over by a scan.
+    Node expand(const Node& view) const;
+
+    // Builds the value a view refers to.
+    Node materialize(const Node& view) const;
+
+    // Builds the whole document, e.g. to be serialized.
+    Node document() const;
+
+    // The offset of the container a view refers to, which identifies it.
+    std::size_t offset(const Node& view) const;
+
+  private:
+    struct Encoder;
+
+    std::uint8_t tag(std::size_t offset) const;
+    std::size_t payload(std::size_t offset) const;
+    std::string_view string(std::size_t index) const;
+    Node value(std::size_t offset) const;
+    Node build(std::size_t offset) const;
+
+    std::vector<std::uint64_t> m_words;
+    std::string m_strings;
+    std::vector<std::uint64_t> m_string_offsets;
+    // one byte per word, so that every offset is a position in it
+    Source m_views;
+  };
+
   inline bool is_quoted(const std::string_view& str)
   {
     return str.size() >= 2 && str.front() == str.back() && str.front() == '"';
@@ -292,7 +544,8 @@ namespace rego
 
   inline size_t to_size(Node value)
   {
-    return static_cast<size_t>(to_uint32(value));
+    std::string value_str(value->location().view());
+    return static_cast<size_t>(std::stoull(value_str));
   }
 
   // opblocks
@@ -344,6 +597,139 @@ namespace rego
     static std::map<key_t, info_t> s_action_info;
   };
 
+  // The limits on a single evaluation (see VirtualMachine::statement_limit),
+  // shared by every thread which works on it.
+  struct EvalLimits
+  {
+    size_t max_statements;
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    const std::atomic<bool>* cancelled;
+    // VirtualMachine::cancel stops the evaluations which started before it
+    // by moving the epoch of the VM on from the one they started in.
+    const std::atomic<size_t>* cancel_epoch;
+    size_t epoch;
+    std::atomic<size_t> statements;
+
+    // Throws EvalInterrupted if the evaluation has been cancelled or has
+    // passed its deadline.
+    void check() const;
+  };
+
+  class EvalInterrupted : public std::runtime_error
+  {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+
+  // Makes the limits of an evaluation visible to poll_eval_limits on the
+  // current thread for the lifetime of the scope.
+  class EvalLimitsScope
+  {
+  public:
+    EvalLimitsScope(const EvalLimits* limits);
+    ~EvalLimitsScope();
+
+  private:
+    const EvalLimits* m_previous;
+  };
+
+  // The threads a VirtualMachine keeps for evaluating its parallel scans (see
+  // VirtualMachine::scan_workers), so that a scan does not pay for starting
+  // and joining threads of its own.
+  class WorkerPool
+  {
+  public:
+    WorkerPool(size_t threads);
+    ~WorkerPool();
+
+    // The number of threads in the pool, which may be fewer than were asked
+    // for if the system would not start them all.
+    size_t size() const;
+
+    // Calls task(0) on the calling thread and task(1) .. task(count - 1) on
+    // the pool, and returns once every call has finished. Calls which no
+    // thread has picked up by the time task(0) returns are skipped, so the
+    // tasks should share their work out between them rather than each owning
+    // a part of it. Tasks run on the pool must not throw.
+    void run(size_t count, const std::function<void(size_t)>& task);
+
+  private:
+    struct Batch
+    {
+      const std::function<void(size_t)>* task;
+      size_t running;
+    };
+
+    void loop();
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::pair<Batch*, size_t>> m_queue;
+    bool m_stopping;
+    std::mutex m_mutex;
+    std::condition_variable m_queued;
+    std::condition_variable m_finished;
+  };
+
+  // Makes the data document of the bundle being evaluated, and the cache of
+  // indexes over it, visible to data_index_cache on the current thread for
+  // the lifetime of the scope.
+  class DataIndexScope
+  {
+  public:
+    DataIndexScope(const Node& data, bundle::DataIndexCache* cache);
+    ~DataIndexScope();
+
+  private:
+    const NodeDef* m_previous_data;
+    bundle::DataIndexCache* m_previous_cache;
+  };
+
+  // The cache of indexes over the data document being evaluated on the
+  // current thread, if the node is part of that document, and otherwise
+  // nullptr. Built-ins keep indexes over data there, for the lifetime of the
+  // bundle, and indexes over anything else in a per-evaluation
+  // IdentityCache.
+  bundle::DataIndexCache* data_index_cache(const Node& node);
+
+  // Called by long-running built-ins on each unit of work. Every so often
+  // this checks the limits of the evaluation running on the current thread,
+  // throwing EvalInterrupted if it should stop.
+  void poll_eval_limits();
+
+  // Receives the output of the print built-ins of a BuiltInsDef. Several
+  // evaluations may print at once, so nothing here is locked: buffered lines
+  // go to the evaluation running on the current thread (see
+  // PrintOutputScope), and the handler is swapped atomically.
+  class PrintSink
+  {
+  public:
+    PrintSink();
+
+    PrintMode mode() const;
+    void mode(PrintMode mode);
+    void handler(PrintHandler handler);
+
+    // The behaviour of the print built-ins.
+    Node print(const Nodes& args);
+
+  private:
+    std::atomic<PrintMode> m_mode;
+    std::shared_ptr<const PrintHandler> m_handler;
+  };
+
+  // Makes the print output of an evaluation the destination of the print
+  // built-ins in PrintMode::Buffer on the current thread for the lifetime of
+  // the scope.
+  class PrintOutputScope
+  {
+  public:
+    PrintOutputScope(std::vector<std::string>* output);
+    ~PrintOutputScope();
+
+  private:
+    std::vector<std::string>* m_previous;
+  };
+
   // bundle
 
   namespace bundle
@@ -356,6 +742,20 @@ namespace rego
   }
 }
 
+// Logging on the VM's hot paths (per statement and per frame access). When
+// REGOCPP_STRIP_VM_LOGGING is defined the log statement is discarded at
+// compile time, so neither the logger nor its arguments are evaluated.
+#ifdef REGOCPP_STRIP_VM_LOGGING
+#define VM_LOG(level) \
+  if constexpr (true) \
+  { \
+  } \
+  else \
+    logging::level()
+#else
+#define VM_LOG(level) logging::level()
+#endif
+
 #ifdef REGOCPP_ACTION_METRICS
 #define ACTION() rego::ActionMetrics __action_metrics(__FILE__, __LINE__)
 #define PRINT_ACTION_METRICS() rego::ActionMetrics::print()
@@ -57,6 +57,7 @@ namespace rego
     m_debug_enabled(false),
     m_wf_check_enabled(false),
     m_builtins(BuiltInsDef::create()),
+    m_statement_count(0),
     m_data_count(0),
     m_log_level(LogLevel::Output)
   {}
@@ -313,6 +314,22 @@ namespace rego
     return nullptr;
   }
 
+  Node Interpreter::set_input_json(
+    const std::string& contents, const std::vector<bundle::InputPath>& paths)
+  {
+    auto loglevel = ::log_level(m_log_level);
+    std::optional<std::string> projected = project_json(contents, paths);
+    if (!projected.has_value())
+    {
+      // the reader will report the problem with the document
+      return set_input_json(contents);
+    }
+
+    logging::Info() << "Projected input from " << contents.size() << " to "
+                    << projected->size() << " bytes";
+    return set_input_json(*projected);
+  }
+
   Node Interpreter::set_input(const Node& node)
   {
     auto loglevel = ::log_level(m_log_level);
@@ -341,7 +358,7 @@ namespace rego
     else if (node->in({Term, Object, Array, Set, Scalar}))
     {
       logging::Info() << "Setting input from Rego AST";
-      input_node = Input << Resolver::to_term(node);
+      input_node = Input << Resolver::to_term(node->clone());
     }
     else if (node == Input)
     {
@@ -409,6 +426,8 @@ namespace rego
     logging::Info() << "Query";
 
     m_builtins->clear();
+    m_print_output.clear();
+    m_statement_count = 0;
 
     Node ast = Top
       << (RegoBundle << EntryPointSeq << m_dataseq << m_moduleseq << m_query);
@@ -428,35 +447,76 @@ namespace rego
     return query_bundle(bundle);
   }
 
-  Node Interpreter::query_bundle(const Bundle& bundle)
+  Node Interpreter::query_bundle(const Bundle& bundle, EvalContext* context)
   {
     auto loglevel = ::log_level(m_log_level);
-    WFContext context(wf_bundle);
+    WFContext wf_context(wf_bundle);
+    EvalContext local;
+    EvalContext& eval = context == nullptr ? local : *context;
+    Node result;
     try
     {
-      return m_vm.bundle(bundle).builtins(m_builtins).run_query(m_input);
+      result =
+        m_vm.bundle(bundle).builtins(m_builtins).run_query(m_input, &eval);
     }
     catch (const std::exception& e)
     {
-      return err(m_input, e.what());
+      result = err(m_input, e.what());
     }
+
+    m_print_output = eval.print_output;
+    m_statement_count = eval.statement_count;
+    return result;
   }
 
   Node Interpreter::query_bundle(
-    const Bundle& bundle, const std::string& entrypoint)
+    const Bundle& bundle, const std::string& entrypoint, EvalContext* context)
   {
     auto loglevel = ::log_level(m_log_level);
-    WFContext context(wf_bundle);
+    WFContext wf_context(wf_bundle);
+    EvalContext local;
+    EvalContext& eval = context == nullptr ? local : *context;
+    Node result;
     try
     {
-      return m_vm.bundle(bundle)
-        .builtins(m_builtins)
-        .run_entrypoint({entrypoint}, m_input);
+      result = m_vm.bundle(bundle)
+                 .builtins(m_builtins)
+                 .run_entrypoint({entrypoint}, m_input, &eval);
     }
     catch (const std::exception& e)
     {
-      return err(m_input, e.what());
+      result = err(m_input, e.what());
     }
+
+    m_print_output = eval.print_output;
+    m_statement_count = eval.statement_count;
+    return result;
+  }
+
+  Nodes Interpreter::query_bundle_entrypoints(
+    const Bundle& bundle,
+    const std::vector<std::string>& entrypoints,
+    EvalContext* context)
+  {
+    auto loglevel = ::log_level(m_log_level);
+    WFContext wf_context(wf_bundle);
+    EvalContext local;
+    EvalContext& eval = context == nullptr ? local : *context;
+    Nodes results;
+    try
+    {
+      std::vector<Location> names(entrypoints.begin(), entrypoints.end());
+      results = m_vm.bundle(bundle).builtins(m_builtins).run_entrypoints(
+        names, m_input, &eval);
+    }
+    catch (const std::exception& e)
+    {
+      results = Nodes(entrypoints.size(), err(m_input, e.what()));
+    }
+
+    m_print_output = eval.print_output;
+    m_statement_count = eval.statement_count;
+    return results;
   }
 
   std::string Interpreter::query()
@@ -573,6 +633,90 @@ namespace rego
     return m_wf_check_enabled;
   }
 
+  Interpreter& Interpreter::scan_workers(size_t workers)
+  {
+    m_vm.scan_workers(workers);
+    return *this;
+  }
+
+  size_t Interpreter::scan_workers() const
+  {
+    return m_vm.scan_workers();
+  }
+
+  Interpreter& Interpreter::statement_limit(size_t limit)
+  {
+    m_vm.statement_limit(limit);
+    return *this;
+  }
+
+  size_t Interpreter::statement_limit() const
+  {
+    return m_vm.statement_limit();
+  }
+
+  Interpreter& Interpreter::raw_results(bool raw)
+  {
+    m_vm.raw_results(raw);
+    return *this;
+  }
+
+  bool Interpreter::raw_results() const
+  {
+    return m_vm.raw_results();
+  }
+
+  Interpreter& Interpreter::time_limit(std::chrono::milliseconds limit)
+  {
+    m_vm.time_limit(limit);
+    return *this;
+  }
+
+  std::chrono::milliseconds Interpreter::time_limit() const
+  {
+    return m_vm.time_limit();
+  }
+
+  void Interpreter::cancel()
+  {
+    m_vm.cancel();
+  }
+
+  size_t Interpreter::statement_count() const
+  {
+    return m_statement_count;
+  }
+
+  const std::vector<std::string>& Interpreter::print_output() const
+  {
+    return m_print_output;
+  }
+
+  Interpreter& Interpreter::trace_capacity(size_t capacity)
+  {
+    m_vm.trace_capacity(capacity);
+    return *this;
+  }
+
+  size_t Interpreter::trace_capacity() const
+  {
+    return m_vm.trace_capacity();
+  }
+
+  void Interpreter::save_trace(std::ostream& stream) const
+  {
+    m_vm.save_trace(stream);
+  }
+
+  void Interpreter::print_trace(std::ostream& stream) const
+  {
+    Bundle bundle = m_vm.bundle();
+    if (bundle != nullptr)
+    {
+      VirtualMachine::print_trace(*bundle, m_vm.trace(), stream);
+    }
+  }
+
   BuiltIns Interpreter::builtins() const
   {
     return m_builtins;
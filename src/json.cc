@@ -8,6 +8,7 @@ namespace
   using namespace trieste;
   using namespace rego;
   using namespace wf::ops;
+  namespace b = rego::bundle;
 
   // clang-format off
     const auto wf_from_json_dataterm =
@@ -34,9 +35,17 @@ namespace
     ;
   // clang-format on
 
-  const char* FloatRE =
-    R"(\-?[[:digit:]]+\.[[:digit:]]+(?:e[+-]?[[:digit:]]+)?)";
-  const char* IntRE = R"(\-?[[:digit:]]+)";
+  // JSON numbers are classified by scanning their text, which is much
+  // cheaper than matching them against regular expressions.
+  bool is_json_float(const NodeRange& n)
+  {
+    return scan_float(n.front()->location().view());
+  }
+
+  bool is_json_int(const NodeRange& n)
+  {
+    return scan_int(n.front()->location().view(), true);
+  }
 
   PassDef from_json_to_dataterm()
   {
@@ -59,10 +68,10 @@ namespace
             return DataTerm << (Scalar << (String << (JSONString ^ _(Key))));
           },
 
-        T(json::Number, FloatRE)[Float] >>
+        T(json::Number)[Float](is_json_float) >>
           [](Match& _) { return DataTerm << (Scalar << (Float ^ _(Float))); },
 
-        T(json::Number, IntRE)[Int] >>
+        T(json::Number)[Int](is_json_int) >>
           [](Match& _) { return DataTerm << (Scalar << (Int ^ _(Int))); },
 
         T(json::True)[True] >>
@@ -102,10 +111,10 @@ namespace
         T(json::Key)[Key] >>
           [](Match& _) { return Term << (Scalar << (JSONString ^ _(Key))); },
 
-        T(json::Number, FloatRE)[Float] >>
+        T(json::Number)[Float](is_json_float) >>
           [](Match& _) { return Term << (Scalar << (Float ^ _(Float))); },
 
-        T(json::Number, IntRE)[Int] >>
+        T(json::Number)[Int](is_json_int) >>
           [](Match& _) { return Term << (Scalar << (Int ^ _(Int))); },
 
         T(json::True)[True] >>
@@ -235,6 +244,292 @@ namespace
           },
       }};
   }
+
+  // Copies a JSON document, keeping only the subtrees at a set of paths and
+  // the objects which lead to them. Members which are not on any of the paths
+  // are scanned over (checking only that their brackets balance) rather than
+  // parsed, so the result is much cheaper to build nodes for than the
+  // original document.
+  class JSONProjector
+  {
+  public:
+    JSONProjector(
+      const std::string_view& json, const std::vector<b::InputPath>& paths) :
+      m_json(json), m_pos(0), m_paths(paths)
+    {
+      m_out.reserve(json.size() / 4);
+    }
+
+    std::optional<std::string> run()
+    {
+      std::vector<const b::InputPath*> candidates;
+      for (const b::InputPath& path : m_paths)
+      {
+        if (path.empty())
+        {
+          return std::string(m_json);
+        }
+
+        candidates.push_back(&path);
+      }
+
+      if (!project(candidates, 0))
+      {
+        return std::nullopt;
+      }
+
+      skip_ws();
+      if (m_pos != m_json.size())
+      {
+        return std::nullopt;
+      }
+
+      return std::move(m_out);
+    }
+
+  private:
+    bool at_end() const
+    {
+      return m_pos >= m_json.size();
+    }
+
+    void skip_ws()
+    {
+      while (!at_end() && is_space(peek()))
+      {
+        m_pos++;
+      }
+    }
+
+    char peek() const
+    {
+      return m_json[m_pos];
+    }
+
+    bool skip_string()
+    {
+      m_pos++;
+      while (!at_end())
+      {
+        char c = m_json[m_pos++];
+        if (c == '\\')
+        {
+          m_pos++;
+        }
+        else if (c == '"')
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool skip_value()
+    {
+      skip_ws();
+      if (at_end())
+      {
+        return false;
+      }
+
+      char c = peek();
+      if (c == '"')
+      {
+        return skip_string();
+      }
+
+      if (c != '{' && c != '[')
+      {
+        size_t start = m_pos;
+        while (!at_end() && !is_delimiter(peek()))
+        {
+          m_pos++;
+        }
+        return m_pos > start;
+      }
+
+      std::string closers;
+      while (!at_end())
+      {
+        c = peek();
+        switch (c)
+        {
+          case '"':
+            if (!skip_string())
+            {
+              return false;
+            }
+            continue;
+
+          case '{':
+            closers.push_back('}');
+            break;
+
+          case '[':
+            closers.push_back(']');
+            break;
+
+          case '}':
+          case ']':
+            if (closers.empty() || closers.back() != c)
+            {
+              return false;
+            }
+            closers.pop_back();
+            break;
+
+          default:
+            break;
+        }
+
+        m_pos++;
+        if (closers.empty())
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    static bool is_space(char c)
+    {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    static bool is_delimiter(char c)
+    {
+      return c == ',' || c == ']' || c == '}' || is_space(c);
+    }
+
+    bool copy_value()
+    {
+      skip_ws();
+      size_t start = m_pos;
+      if (!skip_value())
+      {
+        return false;
+      }
+
+      m_out.append(m_json.substr(start, m_pos - start));
+      return true;
+    }
+
+    // Projects the value at the current position. Each candidate path has
+    // more than `depth` keys, the first `depth` of which lead to the value.
+    bool project(
+      const std::vector<const b::InputPath*>& candidates, size_t depth)
+    {
+      skip_ws();
+      if (at_end() || peek() != '{')
+      {
+        // Only objects are projected
+        return copy_value();
+      }
+
+      m_pos++;
+      m_out.push_back('{');
+      skip_ws();
+      if (!at_end() && peek() == '}')
+      {
+        m_pos++;
+        m_out.push_back('}');
+        return true;
+      }
+
+      bool first = true;
+      std::vector<const b::InputPath*> matches;
+      while (true)
+      {
+        skip_ws();
+        if (at_end() || peek() != '"')
+        {
+          return false;
+        }
+
+        size_t key_start = m_pos;
+        if (!skip_string())
+        {
+          return false;
+        }
+
+        std::string_view raw_key = m_json.substr(key_start, m_pos - key_start);
+        std::string_view key = raw_key.substr(1, raw_key.size() - 2);
+        std::string unescaped;
+        if (key.find('\\') != std::string_view::npos)
+        {
+          unescaped = json::unescape(key);
+          key = unescaped;
+        }
+
+        skip_ws();
+        if (at_end() || peek() != ':')
+        {
+          return false;
+        }
+        m_pos++;
+
+        matches.clear();
+        bool terminal = false;
+        for (const b::InputPath* path : candidates)
+        {
+          if ((*path)[depth] == key)
+          {
+            matches.push_back(path);
+            terminal |= path->size() == depth + 1;
+          }
+        }
+
+        if (matches.empty())
+        {
+          if (!skip_value())
+          {
+            return false;
+          }
+        }
+        else
+        {
+          if (!first)
+          {
+            m_out.push_back(',');
+          }
+          first = false;
+          m_out.append(raw_key);
+          m_out.push_back(':');
+          bool ok = terminal ? copy_value() : project(matches, depth + 1);
+          if (!ok)
+          {
+            return false;
+          }
+        }
+
+        skip_ws();
+        if (at_end())
+        {
+          return false;
+        }
+
+        char c = peek();
+        m_pos++;
+        if (c == '}')
+        {
+          m_out.push_back('}');
+          return true;
+        }
+
+        if (c != ',')
+        {
+          return false;
+        }
+      }
+    }
+
+    std::string_view m_json;
+    size_t m_pos;
+    const std::vector<b::InputPath>& m_paths;
+    std::string m_out;
+  };
 }
 
 namespace rego
@@ -257,4 +552,10 @@ namespace rego
       wf_binding_term,
     };
   }
+
+  std::optional<std::string> project_json(
+    const std::string_view& json, const std::vector<bundle::InputPath>& paths)
+  {
+    return JSONProjector(json, paths).run();
+  }
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include "internal.hh"
 #include "rego.hh"
+#include "trieste/json.h"
+
+#include <fstream>
 
 namespace logging = trieste::logging;
 
@@ -32,8 +35,92 @@ namespace rego
     Node node;
     Nodes expressions;
     std::string value;
+    bool formatted;
+    std::vector<std::string> print_output;
+    size_t statement_count;
   };
 
+  // Joins printed lines, each terminated by a newline.
+  std::string join_lines(const std::vector<std::string>& lines)
+  {
+    std::string joined;
+    for (auto& line : lines)
+    {
+      joined += line;
+      joined.push_back('\n');
+    }
+
+    return joined;
+  }
+
+  // Errors are formatted straight away, so that their message is available
+  // even if the node cannot be walked later. Results are only formatted if
+  // their JSON is asked for, as raw results are often never read that way.
+  regoOutput* new_output(Interpreter* interpreter, const Node& node)
+  {
+    regoOutput* output = new regoOutput();
+    output->node = node;
+    output->print_output = interpreter->print_output();
+    output->statement_count = interpreter->statement_count();
+    output->formatted = node == ErrorSeq;
+    if (output->formatted)
+    {
+      output->value = interpreter->output_to_string(node);
+    }
+
+    return output;
+  }
+
+  const std::string& output_value(regoOutput* output)
+  {
+    if (!output->formatted)
+    {
+      WFContext context(wf_result);
+      output->value = to_key(output->node, true);
+      output->formatted = true;
+    }
+
+    return output->value;
+  }
+
+  // The first value in the output, unwrapped to the node which holds it
+  // (e.g. Int or JSONString), or nullptr if there is none.
+  Node output_scalar(regoOutput* output)
+  {
+    Node node = output->node;
+    if (node == Results)
+    {
+      if (node->empty())
+      {
+        return nullptr;
+      }
+
+      node = node->front() / Terms;
+    }
+
+    if (node == Terms)
+    {
+      if (node->empty())
+      {
+        return nullptr;
+      }
+
+      node = node->front();
+    }
+
+    if (node == Term)
+    {
+      node = node->front();
+    }
+
+    if (node == Scalar)
+    {
+      node = node->front();
+    }
+
+    return node;
+  }
+
   struct regoInput
   {
     Nodes stack;
@@ -95,6 +182,46 @@ namespace rego
       return REGO_ERROR;
     }
   };
+
+  // The input paths of the entrypoint, or null (with the error set) if the
+  // bundle is invalid or has no such entrypoint.
+  const std::vector<bundle::InputPath>* input_paths(
+    regoInterpreter* rego, ::regoBundle* bundle, const char* entrypoint)
+  {
+    regoBundle* rb = reinterpret_cast<regoBundle*>(bundle);
+    if (rb->node_to_bundle(rego) != REGO_OK)
+    {
+      return nullptr;
+    }
+
+    std::string name(entrypoint);
+    auto maybe_index = rb->bundle->find_plan({name});
+    if (!maybe_index.has_value())
+    {
+      setError(rego, "entrypoint not found: " + std::string(entrypoint));
+      return nullptr;
+    }
+
+    return &rb->bundle->plans[*maybe_index].input_paths;
+  }
+
+  std::string input_paths_to_json(
+    const std::vector<bundle::InputPath>& paths)
+  {
+    std::ostringstream buf;
+    buf << "[";
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+      buf << (i > 0 ? ",[" : "[");
+      for (size_t j = 0; j < paths[i].size(); ++j)
+      {
+        buf << (j > 0 ? "," : "") << add_quotes(json::escape(paths[i][j]));
+      }
+      buf << "]";
+    }
+    buf << "]";
+    return buf.str();
+  }
 }
 
 extern "C"
@@ -452,12 +579,15 @@ extern "C"
       auto interpreter = reinterpret_cast<rego::Interpreter*>(rego);
       rego::regoOutput* output = new rego::regoOutput();
       output->node = interpreter->query_node(query_expr);
+      output->print_output = interpreter->print_output();
+      output->statement_count = interpreter->statement_count();
       if (output->node == rego::Term)
       {
         output->node = output->node->front();
       }
 
       output->value = interpreter->output_to_string(output->node);
+      output->formatted = true;
       auto ptr = reinterpret_cast<regoOutput*>(output);
       logging::Debug() << "regoQuery output: " << ptr;
       return ptr;
@@ -484,6 +614,149 @@ extern "C"
       ->strict_errors();
   }
 
+  regoEnum regoSetPrintMode(regoInterpreter* rego, regoEnum mode)
+  {
+    logging::Debug() << "regoSetPrintMode: " << mode;
+    if (mode > REGO_PRINT_DISCARD)
+    {
+      rego::setError(rego, "Invalid print mode");
+      return REGO_ERROR;
+    }
+
+    reinterpret_cast<rego::Interpreter*>(rego)->builtins()->print_mode(
+      static_cast<rego::PrintMode>(mode));
+    return REGO_OK;
+  }
+
+  regoEnum regoGetPrintMode(regoInterpreter* rego)
+  {
+    logging::Debug() << "regoGetPrintMode";
+    return static_cast<regoEnum>(
+      reinterpret_cast<rego::Interpreter*>(rego)->builtins()->print_mode());
+  }
+
+  void regoSetPrintCallback(
+    regoInterpreter* rego, regoPrintCallback callback, void* context)
+  {
+    logging::Debug() << "regoSetPrintCallback";
+    reinterpret_cast<rego::Interpreter*>(rego)->builtins()->print_handler(
+      [callback, context](const std::string& line) {
+        callback(context, line.c_str());
+      });
+  }
+
+  regoSize regoPrintOutputSize(regoInterpreter* rego)
+  {
+    logging::Debug() << "regoPrintOutputSize";
+    std::string output = rego::join_lines(
+      reinterpret_cast<rego::Interpreter*>(rego)->print_output());
+    return static_cast<regoSize>(output.size() + 1);
+  }
+
+  regoEnum regoPrintOutput(regoInterpreter* rego, char* buffer, regoSize size)
+  {
+    logging::Debug() << "regoPrintOutput: " << (void*)buffer << "[" << size
+                     << "]";
+    std::string output = rego::join_lines(
+      reinterpret_cast<rego::Interpreter*>(rego)->print_output());
+
+    if (size < output.size() + 1)
+    {
+      return REGO_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    output.copy(buffer, output.size());
+    buffer[output.size()] = '\0';
+    return REGO_OK;
+  }
+
+  void regoSetRawResults(regoInterpreter* rego, regoBoolean enabled)
+  {
+    logging::Debug() << "regoSetRawResults: " << enabled;
+    reinterpret_cast<rego::Interpreter*>(rego)->raw_results(enabled);
+  }
+
+  regoBoolean regoGetRawResults(regoInterpreter* rego)
+  {
+    logging::Debug() << "regoGetRawResults";
+    return reinterpret_cast<rego::Interpreter*>(rego)->raw_results();
+  }
+
+  void regoSetStatementLimit(regoInterpreter* rego, regoSize limit)
+  {
+    logging::Debug() << "regoSetStatementLimit: " << limit;
+    reinterpret_cast<rego::Interpreter*>(rego)->statement_limit(limit);
+  }
+
+  regoSize regoGetStatementLimit(regoInterpreter* rego)
+  {
+    logging::Debug() << "regoGetStatementLimit";
+    return static_cast<regoSize>(
+      reinterpret_cast<rego::Interpreter*>(rego)->statement_limit());
+  }
+
+  void regoSetTimeLimit(regoInterpreter* rego, regoSize milliseconds)
+  {
+    logging::Debug() << "regoSetTimeLimit: " << milliseconds;
+    reinterpret_cast<rego::Interpreter*>(rego)->time_limit(
+      std::chrono::milliseconds(milliseconds));
+  }
+
+  regoSize regoGetTimeLimit(regoInterpreter* rego)
+  {
+    logging::Debug() << "regoGetTimeLimit";
+    return static_cast<regoSize>(
+      reinterpret_cast<rego::Interpreter*>(rego)->time_limit().count());
+  }
+
+  void regoCancel(regoInterpreter* rego)
+  {
+    // no logging, as this may be called from another thread
+    reinterpret_cast<rego::Interpreter*>(rego)->cancel();
+  }
+
+  regoInt regoGetStatementCount(regoInterpreter* rego)
+  {
+    logging::Debug() << "regoGetStatementCount";
+    return static_cast<regoInt>(
+      reinterpret_cast<rego::Interpreter*>(rego)->statement_count());
+  }
+
+  void regoSetTraceCapacity(regoInterpreter* rego, regoSize capacity)
+  {
+    logging::Debug() << "regoSetTraceCapacity: " << capacity;
+    reinterpret_cast<rego::Interpreter*>(rego)->trace_capacity(capacity);
+  }
+
+  regoSize regoGetTraceCapacity(regoInterpreter* rego)
+  {
+    logging::Debug() << "regoGetTraceCapacity";
+    return static_cast<regoSize>(
+      reinterpret_cast<rego::Interpreter*>(rego)->trace_capacity());
+  }
+
+  regoEnum regoSaveTrace(regoInterpreter* rego, const char* path)
+  {
+    logging::Debug() << "regoSaveTrace: " << path;
+    try
+    {
+      std::ofstream stream(path, std::ios::out | std::ios::binary);
+      if (!stream)
+      {
+        rego::setError(rego, "Unable to open trace file: " + std::string(path));
+        return REGO_ERROR;
+      }
+
+      reinterpret_cast<rego::Interpreter*>(rego)->save_trace(stream);
+      return REGO_OK;
+    }
+    catch (const std::exception& e)
+    {
+      rego::setError(rego, e.what());
+      return REGO_ERROR;
+    }
+  }
+
   regoBoolean regoIsAvailableBuiltIn(regoInterpreter* rego, const char* name)
   {
     logging::Debug() << "regoIsBuiltIn: " << name;
@@ -665,7 +938,10 @@ extern "C"
       auto interpreter = reinterpret_cast<rego::Interpreter*>(rego);
       rego::regoOutput* output = new rego::regoOutput();
       output->node = interpreter->query_bundle(rb->bundle);
+      output->print_output = interpreter->print_output();
+      output->statement_count = interpreter->statement_count();
       output->value = interpreter->output_to_string(output->node);
+      output->formatted = true;
       auto ptr = reinterpret_cast<regoOutput*>(output);
       logging::Debug() << "regoBundleQuery output: " << ptr;
       return ptr;
@@ -691,9 +967,8 @@ extern "C"
       }
 
       auto interpreter = reinterpret_cast<rego::Interpreter*>(rego);
-      rego::regoOutput* output = new rego::regoOutput();
-      output->node = interpreter->query_bundle(rb->bundle, entrypoint);
-      output->value = interpreter->output_to_string(output->node);
+      rego::regoOutput* output = rego::new_output(
+        interpreter, interpreter->query_bundle(rb->bundle, entrypoint));
       auto ptr = reinterpret_cast<regoOutput*>(output);
       logging::Debug() << "regoBundleQueryEntrypoint output: " << ptr;
       return ptr;
@@ -705,6 +980,125 @@ extern "C"
     }
   }
 
+  regoEnum regoBundleQueryEntrypoints(
+    regoInterpreter* rego,
+    regoBundle* bundle,
+    const char** entrypoints,
+    regoSize count,
+    regoOutput** outputs)
+  {
+    logging::Debug() << "regoBundleQueryEntrypoints: rego(" << rego
+                     << ") bundle(" << bundle << ") count(" << count << ")";
+    try
+    {
+      rego::regoBundle* rb = reinterpret_cast<rego::regoBundle*>(bundle);
+      if (rb->node_to_bundle(rego) != REGO_OK)
+      {
+        return REGO_ERROR;
+      }
+
+      auto interpreter = reinterpret_cast<rego::Interpreter*>(rego);
+      std::vector<std::string> names(entrypoints, entrypoints + count);
+      rego::Nodes nodes =
+        interpreter->query_bundle_entrypoints(rb->bundle, names);
+      for (regoSize i = 0; i < count; ++i)
+      {
+        rego::regoOutput* output = rego::new_output(interpreter, nodes[i]);
+        outputs[i] = reinterpret_cast<regoOutput*>(output);
+      }
+
+      return REGO_OK;
+    }
+    catch (const std::exception& e)
+    {
+      rego::setError(rego, e.what());
+      return REGO_ERROR;
+    }
+  }
+
+  regoSize regoBundleInputPathsSize(
+    regoInterpreter* rego, regoBundle* bundle, const char* entrypoint)
+  {
+    logging::Debug() << "regoBundleInputPathsSize: " << entrypoint;
+    try
+    {
+      auto paths = rego::input_paths(rego, bundle, entrypoint);
+      if (paths == nullptr)
+      {
+        return 0;
+      }
+
+      std::string value = rego::input_paths_to_json(*paths);
+      return static_cast<regoSize>(value.size() + 1);
+    }
+    catch (const std::exception& e)
+    {
+      rego::setError(rego, e.what());
+      return 0;
+    }
+  }
+
+  regoEnum regoBundleInputPaths(
+    regoInterpreter* rego,
+    regoBundle* bundle,
+    const char* entrypoint,
+    char* buffer,
+    regoSize size)
+  {
+    logging::Debug() << "regoBundleInputPaths: " << entrypoint << " "
+                     << (void*)buffer << "[" << size << "]";
+    try
+    {
+      auto paths = rego::input_paths(rego, bundle, entrypoint);
+      if (paths == nullptr)
+      {
+        return REGO_ERROR;
+      }
+
+      std::string value = rego::input_paths_to_json(*paths);
+      if (size < value.size() + 1)
+      {
+        return REGO_ERROR_BUFFER_TOO_SMALL;
+      }
+
+      value.copy(buffer, value.size());
+      buffer[value.size()] = '\0';
+      return REGO_OK;
+    }
+    catch (const std::exception& e)
+    {
+      rego::setError(rego, e.what());
+      return REGO_ERROR;
+    }
+  }
+
+  regoEnum regoBundleSetInputJSON(
+    regoInterpreter* rego,
+    regoBundle* bundle,
+    const char* entrypoint,
+    const char* contents)
+  {
+    logging::Debug() << "regoBundleSetInputJSON: " << entrypoint << " "
+                     << contents;
+    try
+    {
+      auto paths = rego::input_paths(rego, bundle, entrypoint);
+      if (paths == nullptr)
+      {
+        return REGO_ERROR;
+      }
+
+      return ok_or_error(
+        reinterpret_cast<rego::Interpreter*>(rego)->set_input_json(
+          contents, *paths));
+    }
+    catch (const std::exception& e)
+    {
+      rego::setError(rego, e.what());
+      return REGO_ERROR;
+    }
+  }
+
   void regoFreeBundle(regoBundle* bundle)
   {
     logging::Debug() << "regoFreeBundle: " << bundle;
@@ -724,18 +1118,51 @@ extern "C"
       rego::ErrorSeq;
   }
 
+  regoEnum regoOutputStatus(regoOutput* output)
+  {
+    logging::Debug() << "regoOutputStatus";
+    if (output == nullptr)
+    {
+      return REGO_ERROR;
+    }
+
+    rego::Node node = reinterpret_cast<rego::regoOutput*>(output)->node;
+    if (node->type() != rego::ErrorSeq)
+    {
+      return REGO_OK;
+    }
+
+    for (const rego::Node& error : *node)
+    {
+      if (
+        error == rego::Error &&
+        (error / rego::ErrorCode)->location().view() == rego::EvalCancelError)
+      {
+        return REGO_ERROR_EVAL_CANCELLED;
+      }
+    }
+
+    return REGO_ERROR;
+  }
+
   regoSize regoOutputSize(regoOutput* output)
   {
     logging::Debug() << "regoOutputSize";
     auto output_ptr = reinterpret_cast<rego::regoOutput*>(output);
     auto node_ptr = reinterpret_cast<trieste::NodeDef*>(output_ptr->node.get());
-    if (node_ptr->type() == rego::ErrorSeq)
+    if (
+      node_ptr->type() == rego::ErrorSeq || node_ptr->type() == rego::Undefined)
     {
       return 0;
     }
 
-    assert(node_ptr->type() == rego::Results);
-    return static_cast<regoSize>(node_ptr->size());
+    if (node_ptr->type() == rego::Results || node_ptr->type() == rego::Terms)
+    {
+      return static_cast<regoSize>(node_ptr->size());
+    }
+
+    // a single raw result (see regoSetRawResults)
+    return 1;
   }
 
   regoNode* regoOutputExpressionsAtIndex(regoOutput* output, regoSize index)
@@ -743,12 +1170,13 @@ extern "C"
     logging::Debug() << "regoOutputExpressionsAtIndex: " << index;
     auto output_ptr = reinterpret_cast<rego::regoOutput*>(output);
     auto node_ptr = reinterpret_cast<trieste::NodeDef*>(output_ptr->node.get());
-    if (node_ptr->type() == rego::ErrorSeq)
+    // errors, undefined and raw results (see regoSetRawResults) have no
+    // per-result expressions or bindings
+    if (node_ptr->type() != rego::Results || index >= node_ptr->size())
     {
       return nullptr;
     }
 
-    assert(node_ptr->type() == rego::Results);
     trieste::WFContext context(rego::wf_result);
 
     for (auto result : *node_ptr)
@@ -773,18 +1201,50 @@ extern "C"
       reinterpret_cast<rego::regoOutput*>(output)->node.get());
   }
 
+  regoSize regoOutputPrintSize(regoOutput* output)
+  {
+    logging::Debug() << "regoOutputPrintSize";
+    auto output_ptr = reinterpret_cast<rego::regoOutput*>(output);
+    return static_cast<regoSize>(
+      rego::join_lines(output_ptr->print_output).size() + 1);
+  }
+
+  regoEnum regoOutputPrint(regoOutput* output, char* buffer, regoSize size)
+  {
+    logging::Debug() << "regoOutputPrint: " << (void*)buffer << "[" << size
+                     << "]";
+    auto output_ptr = reinterpret_cast<rego::regoOutput*>(output);
+    std::string joined = rego::join_lines(output_ptr->print_output);
+    if (size < joined.size() + 1)
+    {
+      return REGO_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    joined.copy(buffer, joined.size());
+    buffer[joined.size()] = '\0';
+    return REGO_OK;
+  }
+
+  regoInt regoOutputStatementCount(regoOutput* output)
+  {
+    logging::Debug() << "regoOutputStatementCount";
+    return static_cast<regoInt>(
+      reinterpret_cast<rego::regoOutput*>(output)->statement_count);
+  }
+
   regoNode* regoOutputBindingAtIndex(
     regoOutput* output, regoSize index, const char* name)
   {
     logging::Debug() << "regoOutputBindingAtIndex: " << name;
     auto output_ptr = reinterpret_cast<rego::regoOutput*>(output);
     auto node_ptr = reinterpret_cast<trieste::NodeDef*>(output_ptr->node.get());
-    if (node_ptr->type() == rego::ErrorSeq)
+    // errors, undefined and raw results (see regoSetRawResults) have no
+    // per-result expressions or bindings
+    if (node_ptr->type() != rego::Results || index >= node_ptr->size())
     {
       return nullptr;
     }
 
-    assert(node_ptr->type() == rego::Results);
     trieste::WFContext context(rego::wf_result);
     auto result = node_ptr->at(index);
     auto defs = result->lookdown({name});
@@ -808,11 +1268,95 @@ extern "C"
     return regoOutputBindingAtIndex(output, 0, name);
   }
 
+  regoEnum regoOutputBoolean(regoOutput* output, regoBoolean* value)
+  {
+    logging::Debug() << "regoOutputBoolean";
+    rego::Node node =
+      rego::output_scalar(reinterpret_cast<rego::regoOutput*>(output));
+    if (node != rego::True && node != rego::False)
+    {
+      return REGO_ERROR;
+    }
+
+    *value = node == rego::True;
+    return REGO_OK;
+  }
+
+  regoEnum regoOutputInt(regoOutput* output, regoInt* value)
+  {
+    logging::Debug() << "regoOutputInt";
+    rego::Node node =
+      rego::output_scalar(reinterpret_cast<rego::regoOutput*>(output));
+    if (node != rego::Int)
+    {
+      return REGO_ERROR;
+    }
+
+    auto maybe_int = rego::get_int(node).to_int();
+    if (!maybe_int.has_value())
+    {
+      return REGO_ERROR;
+    }
+
+    *value = *maybe_int;
+    return REGO_OK;
+  }
+
+  regoEnum regoOutputFloat(regoOutput* output, double* value)
+  {
+    logging::Debug() << "regoOutputFloat";
+    rego::Node node =
+      rego::output_scalar(reinterpret_cast<rego::regoOutput*>(output));
+    if (node != rego::Int && node != rego::Float)
+    {
+      return REGO_ERROR;
+    }
+
+    *value = rego::get_double(node);
+    return REGO_OK;
+  }
+
+  regoSize regoOutputStringSize(regoOutput* output)
+  {
+    logging::Debug() << "regoOutputStringSize";
+    rego::Node node =
+      rego::output_scalar(reinterpret_cast<rego::regoOutput*>(output));
+    if (node != rego::JSONString)
+    {
+      return 0;
+    }
+
+    return static_cast<regoSize>(rego::get_string(node).size() + 1);
+  }
+
+  regoEnum regoOutputString(regoOutput* output, char* buffer, regoSize size)
+  {
+    logging::Debug() << "regoOutputString: " << (void*)buffer << "[" << size
+                     << "]";
+    rego::Node node =
+      rego::output_scalar(reinterpret_cast<rego::regoOutput*>(output));
+    if (node != rego::JSONString)
+    {
+      return REGO_ERROR;
+    }
+
+    std::string value = rego::get_string(node);
+    if (size < value.size() + 1)
+    {
+      return REGO_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    value.copy(buffer, value.size());
+    buffer[value.size()] = '\0';
+    return REGO_OK;
+  }
+
   regoSize regoOutputJSONSize(regoOutput* output)
   {
     logging::Debug() << "regoOutputJSONSize";
     return static_cast<regoSize>(
-      reinterpret_cast<rego::regoOutput*>(output)->value.size() + 1);
+      rego::output_value(reinterpret_cast<rego::regoOutput*>(output)).size() +
+      1);
   }
 
   regoEnum regoOutputJSON(regoOutput* output, char* buffer, regoSize size)
@@ -820,7 +1364,7 @@ extern "C"
     logging::Debug() << "regoOutputJSON: " << (void*)buffer << "[" << size
                      << "]";
     auto output_ptr = reinterpret_cast<rego::regoOutput*>(output);
-    auto& value = output_ptr->value;
+    auto& value = rego::output_value(output_ptr);
     if (size < value.size() + 1)
     {
       return REGO_ERROR_BUFFER_TOO_SMALL;
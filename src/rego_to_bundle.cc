@@ -1695,6 +1695,73 @@ namespace
     return Ref << refhead << args;
   }
 
+  bool is_wildcard(Node expr)
+  {
+    Node term = expr->front();
+    if (term != Term)
+    {
+      return false;
+    }
+
+    Node var = term->front();
+    return var->in({Var, UnifyVar}) &&
+      var->location().view().starts_with("_$");
+  }
+
+  /// Lowers `walk(x, [path, value])` into a scan which binds `path` and `value`
+  /// directly from an iterator over `x`, instead of scanning a materialised
+  /// array of pairs. If the path is a wildcard the iterator will not construct
+  /// paths at all. Returns nullptr if the walk cannot be lowered in this way.
+  Node walk_to_scan(Match& _, Node ref, Node lhs, Node rhs, Node withseq)
+  {
+    if (!(ref / RefHead)->front()->lookup().empty())
+    {
+      // user-defined function which shadows the builtin
+      return nullptr;
+    }
+
+    Node term = lhs->front();
+    if (term != Term || term->front() != Array || term->front()->size() != 2)
+    {
+      return nullptr;
+    }
+
+    Node path = term->front()->front();
+    Node value = term->front()->back();
+    bool with_paths = !is_wildcard(path);
+
+    Location walk_name = _.fresh({"walk"});
+    Location scanpath_name = _.fresh({"scanpath"});
+    Location scanvalue_name = _.fresh({"scanvalue"});
+    Location func(with_paths ? "internal.walk_paths" : "internal.walk_values");
+    Node seq = Seq
+      << (Literal << (ExprAssign
+                      << (AssignVar ^ walk_name)
+                      << (Expr << (ExprCall
+                                   << (Ref << (RefHead << (Var ^ func))
+                                           << RefArgSeq)
+                                   << (ExprSeq << rhs))))
+                  << withseq->clone())
+      << (Literal << (ExprScan << (Expr << (Term << (Var ^ walk_name)))
+                               << (Local << (Ident ^ scanpath_name))
+                               << (Local << (Ident ^ scanvalue_name)))
+                  << withseq->clone());
+
+    if (with_paths)
+    {
+      seq
+        << (Literal << (ExprUnify
+                        << path << (Expr << (Term << (Var ^ scanpath_name))))
+                    << WithSeq);
+    }
+
+    seq
+      << (Literal << (ExprUnify
+                      << value << (Expr << (Term << (Var ^ scanvalue_name))))
+                  << WithSeq);
+    return seq;
+  }
+
   /// Find the implicit scans hiding as refs, and establish the rule-level
   /// locals. This needs to go before the document merge, because that destroys
   /// the file-level imports which can only be resolved after the rule locals
@@ -2056,6 +2123,12 @@ namespace
                        (T(ExprSeq) << (T(Expr)[Rhs] * T(Expr)[Lhs])))) *
                T(WithSeq)[WithSeq]) >>
           [](Match& _) {
+            Node scan = walk_to_scan(_, _(Ref), _(Lhs), _(Rhs), _(WithSeq));
+            if (scan != nullptr)
+            {
+              return scan;
+            }
+
             Location walk_name = _.fresh({"walk"});
             Location scanindex_name = _.fresh({"scanindex"});
             Location scanvalue_name = _.fresh({"scanvalue"});
@@ -2086,6 +2159,12 @@ namespace
                             (T(ExprSeq) << T(Expr)[Rhs]))))) *
                T(WithSeq)[WithSeq]) >>
           [](Match& _) {
+            Node scan = walk_to_scan(_, _(Ref), _(Lhs), _(Rhs), _(WithSeq));
+            if (scan != nullptr)
+            {
+              return scan;
+            }
+
             Location walk_name = _.fresh({"walk"});
             Location scanindex_name = _.fresh({"scanindex"});
             Location scanvalue_name = _.fresh({"scanvalue"});
@@ -3177,17 +3256,300 @@ namespace
     return false;
   }
 
+  // Converts a constant term from the AST into the form in which values are
+  // passed to builtins at runtime.
+  Node constant_to_value(Node expr)
+  {
+    if (expr == Expr)
+    {
+      expr = expr->front();
+    }
+
+    if (expr != Term)
+    {
+      return nullptr;
+    }
+
+    Node value = expr->front();
+    if (value == Scalar)
+    {
+      if (!value->front()->in({JSONString, Int, Float, True, False, Null}))
+      {
+        return nullptr;
+      }
+
+      return Term << value->clone();
+    }
+
+    if (value == Array)
+    {
+      Node array = NodeDef::create(Array);
+      for (Node member : *value)
+      {
+        Node term = constant_to_value(member);
+        if (term == nullptr)
+        {
+          return nullptr;
+        }
+
+        array << term;
+      }
+
+      return Term << array;
+    }
+
+    if (value == Set)
+    {
+      Node members = NodeDef::create(Set);
+      for (Node member : *value)
+      {
+        Node term = constant_to_value(member);
+        if (term == nullptr)
+        {
+          return nullptr;
+        }
+
+        members << term;
+      }
+
+      return Term << Resolver::set(members);
+    }
+
+    if (value == Object)
+    {
+      Node items = NodeDef::create(Object);
+      for (Node item : *value)
+      {
+        Node key = constant_to_value(item / Key);
+        Node val = constant_to_value(item / Val);
+        if (key == nullptr || val == nullptr)
+        {
+          return nullptr;
+        }
+
+        items << key << val;
+      }
+
+      Node object = Resolver::object(items);
+      if (object == Error)
+      {
+        return nullptr;
+      }
+
+      return Term << object;
+    }
+
+    return nullptr;
+  }
+
+  // Converts a value returned by a builtin back into a constant term, so long
+  // as it does not exceed the node budget.
+  Node value_to_constant(Node value, size_t& budget)
+  {
+    if (budget == 0)
+    {
+      return nullptr;
+    }
+
+    budget--;
+
+    if (value == Term)
+    {
+      value = value->front();
+    }
+
+    if (value == Scalar)
+    {
+      value = value->front();
+    }
+
+    if (value->in({JSONString, Int, Float, True, False, Null}))
+    {
+      return Term << (Scalar << value->clone());
+    }
+
+    if (value->in({Array, Set}))
+    {
+      Node collection = NodeDef::create(value->type());
+      for (Node member : *value)
+      {
+        Node term = value_to_constant(member, budget);
+        if (term == nullptr)
+        {
+          return nullptr;
+        }
+
+        collection << (Expr << term);
+      }
+
+      return Term << collection;
+    }
+
+    if (value == Object)
+    {
+      Node object = NodeDef::create(Object);
+      for (Node item : *value)
+      {
+        Node key = value_to_constant(item / Key, budget);
+        if (key == nullptr)
+        {
+          return nullptr;
+        }
+
+        Node val = value_to_constant(item / Val, budget);
+        if (val == nullptr)
+        {
+          return nullptr;
+        }
+
+        object << (ObjectItem << (Expr << key) << (Expr << val));
+      }
+
+      return Term << object;
+    }
+
+    return nullptr;
+  }
+
+  /// Evaluates a call to a pure builtin at build time, if all of its arguments
+  /// are constants. Returns the resulting constant term, or nullptr if the
+  /// call needs to be left for the virtual machine.
+  Node fold_builtin_call(
+    const BuiltIns& builtins,
+    const std::set<std::string>& mocked,
+    Node exprcall)
+  {
+    const size_t max_folded_nodes = 1024;
+
+    Node ref = exprcall / Ref;
+    if (lookup_rule(ref) != nullptr)
+    {
+      return nullptr;
+    }
+
+    auto maybe_name = ref_to_string(ref);
+    if (!maybe_name.has_value() || mocked.contains(maybe_name.value()))
+    {
+      return nullptr;
+    }
+
+    Location name(maybe_name.value());
+    if (!builtins->is_builtin(name) || !builtins->at(name)->pure)
+    {
+      return nullptr;
+    }
+
+    if (name.view() == "numbers.range" || name.view() == "numbers.range_step")
+    {
+      // the virtual machine evaluates ranges lazily, so folding them would
+      // only build (and usually discard) the whole array at build time
+      return nullptr;
+    }
+
+    Nodes args;
+    for (Node expr : *(exprcall / ExprSeq))
+    {
+      Node arg = constant_to_value(expr);
+      if (arg == nullptr)
+      {
+        return nullptr;
+      }
+
+      args.push_back(arg);
+    }
+
+    Node result;
+    try
+    {
+      result = builtins->call(name, {"v1"}, args);
+    }
+    catch (const std::exception& e)
+    {
+      logging::Debug() << "Unable to fold call to " << name.view() << ": "
+                       << e.what();
+      return nullptr;
+    }
+
+    if (result == nullptr || result->in({Error, Undefined}))
+    {
+      // errors and undefined results are left to be reported at runtime
+      return nullptr;
+    }
+
+    size_t budget = max_folded_nodes;
+    Node term = value_to_constant(result, budget);
+    if (term != nullptr)
+    {
+      logging::Debug() << "Folded call to " << name.view();
+    }
+
+    return term;
+  }
+
+  // Finds the names of all functions which are replaced by a `with` somewhere
+  // in the bundle. Calls to these cannot be evaluated at build time.
+  void find_mocked_functions(Node top, std::set<std::string>& mocked)
+  {
+    Nodes frontier({top});
+    while (!frontier.empty())
+    {
+      Node current = frontier.back();
+      frontier.pop_back();
+      if (current == With)
+      {
+        Node target = current->front();
+        if (target == Term)
+        {
+          target = target->front();
+        }
+
+        if (target == Var)
+        {
+          mocked.insert(std::string(target->location().view()));
+        }
+        else if (target == Ref)
+        {
+          auto maybe_name = ref_to_string(target);
+          if (maybe_name.has_value())
+          {
+            mocked.insert(maybe_name.value());
+          }
+        }
+      }
+
+      frontier.insert(frontier.end(), current->begin(), current->end());
+    }
+  }
+
   /// Convert all expressions or Operation/Block pairs.
   PassDef expr_to_opblock(const BuiltIns& builtins)
   {
     auto rule_locals = std::make_shared<NodeMap<Nodes>>();
     auto resultexprs = std::make_shared<Nodes>();
+    auto mocked = std::make_shared<std::set<std::string>>();
     PassDef pass =
       {
         "expr_to_opblock",
         wf_ir_expr_to_opblock,
         dir::bottomup | dir::once,
         {
+          In(Expr, RefHead) *
+              (T(ExprCall)[ExprCall] << (T(Ref) << (T(RefHead) << (T(Var))))) >>
+            [builtins, mocked](Match& _) -> Node {
+            Node term = fold_builtin_call(builtins, *mocked, _(ExprCall));
+            if (term == nullptr)
+            {
+              return NoChange;
+            }
+
+            if (_(ExprCall)->parent() == RefHead)
+            {
+              return ArgVal << term_to_opblock(term);
+            }
+
+            return term;
+          },
+
           In(RefHead) * T(Array)[Array] >>
             [](Match& _) { return ArgVal << array_to_opblock(_(Array)); },
 
@@ -3800,9 +4162,11 @@ namespace
             },
         }};
 
-    pass.pre([rule_locals, resultexprs](Node) {
+    pass.pre([rule_locals, resultexprs, mocked](Node top) {
       rule_locals->clear();
       resultexprs->clear();
+      mocked->clear();
+      find_mocked_functions(top, *mocked);
       return 0;
     });
 
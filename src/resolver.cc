@@ -1,6 +1,10 @@
 #include "internal.hh"
 #include "rego.hh"
 
+#include <algorithm>
+#include <charconv>
+#include <limits>
+
 namespace
 {
   using namespace rego;
@@ -84,10 +88,7 @@ namespace
       return err(op, "unsupported math operation");
     }
 
-    std::ostringstream oss;
-    oss << std::setprecision(std::numeric_limits<double>::max_digits10 - 1)
-        << std::noshowpoint << value;
-    return Float ^ oss.str();
+    return Float ^ format_double(value);
   }
 
   Node do_bool(const Node& op, BigInt lhs, BigInt rhs)
@@ -215,6 +216,268 @@ namespace
       return False ^ "false";
     }
   }
+
+  // The rank of each kind of value in the ordering used for sets, which
+  // follows OPA: null < booleans < numbers < strings < arrays < objects <
+  // sets. Anything else sorts last.
+  int value_rank(const Node& node)
+  {
+    if (node == Null)
+    {
+      return 0;
+    }
+
+    if (node->in({False, True}))
+    {
+      return 1;
+    }
+
+    if (node->in({Int, Float}))
+    {
+      return 2;
+    }
+
+    if (node == JSONString)
+    {
+      return 3;
+    }
+
+    if (node->in({Array, DataArray}))
+    {
+      return 4;
+    }
+
+    if (node->in({Object, DataObject}))
+    {
+      return 5;
+    }
+
+    if (node == Set)
+    {
+      return 6;
+    }
+
+    return 7;
+  }
+
+  Node unwrap_value(Node node)
+  {
+    while (node->in({Term, DataTerm, Scalar}))
+    {
+      node = node->front();
+    }
+
+    return node;
+  }
+
+  double number_value(const Node& node)
+  {
+    std::string_view view = node->location().view();
+    double value = 0;
+    auto [ptr, ec] =
+      std::from_chars(view.data(), view.data() + view.size(), value);
+    if (ec == std::errc::result_out_of_range)
+    {
+      bool negative = !view.empty() && view.front() == '-';
+      return negative ? -std::numeric_limits<double>::infinity() :
+                        std::numeric_limits<double>::infinity();
+    }
+
+    return value;
+  }
+
+  template<typename T>
+  int three_way(const T& lhs, const T& rhs)
+  {
+    if (lhs < rhs)
+    {
+      return -1;
+    }
+
+    return rhs < lhs ? 1 : 0;
+  }
+
+  // Compares the text of two integers by value, which unlike a comparison of
+  // their doubles is exact however large they are.
+  int compare_ints(std::string_view lhs, std::string_view rhs)
+  {
+    bool lhs_negative = !lhs.empty() && lhs.front() == '-';
+    bool rhs_negative = !rhs.empty() && rhs.front() == '-';
+    if (lhs_negative)
+    {
+      lhs.remove_prefix(1);
+    }
+
+    if (rhs_negative)
+    {
+      rhs.remove_prefix(1);
+    }
+
+    while (lhs.size() > 1 && lhs.front() == '0')
+    {
+      lhs.remove_prefix(1);
+    }
+
+    while (rhs.size() > 1 && rhs.front() == '0')
+    {
+      rhs.remove_prefix(1);
+    }
+
+    // -0 and 0 are the same value
+    if (lhs == "0" && rhs == "0")
+    {
+      return 0;
+    }
+
+    if (lhs_negative != rhs_negative)
+    {
+      return lhs_negative ? -1 : 1;
+    }
+
+    int magnitude = lhs.size() != rhs.size() ?
+      three_way(lhs.size(), rhs.size()) :
+      three_way(lhs, rhs);
+    return lhs_negative ? -magnitude : magnitude;
+  }
+
+  int compare_values(const Node& lhs_node, const Node& rhs_node);
+
+  bool value_less(const Node& lhs, const Node& rhs)
+  {
+    return compare_values(lhs, rhs) < 0;
+  }
+
+  // The items of an object in key order, keeping only the first of any
+  // duplicate keys as `to_key` does.
+  Nodes sorted_items(const Node& object)
+  {
+    Nodes items(object->begin(), object->end());
+    auto key_less = [](const Node& lhs, const Node& rhs) {
+      return value_less(lhs / Key, rhs / Key);
+    };
+    if (!std::is_sorted(items.begin(), items.end(), key_less))
+    {
+      std::stable_sort(items.begin(), items.end(), key_less);
+    }
+
+    auto same_key = [](const Node& lhs, const Node& rhs) {
+      return compare_values(lhs / Key, rhs / Key) == 0;
+    };
+    items.erase(std::unique(items.begin(), items.end(), same_key), items.end());
+    return items;
+  }
+
+  // The members of a set in value order. Sets built by the set operations
+  // below are already in this order, so for those this is just a copy of the
+  // member pointers.
+  Nodes sorted_members(const Node& set)
+  {
+    Nodes members(set->begin(), set->end());
+    if (!std::is_sorted(members.begin(), members.end(), value_less))
+    {
+      std::sort(members.begin(), members.end(), value_less);
+    }
+
+    return members;
+  }
+
+  // A total order on values which agrees with `to_key` on equality, so that
+  // sets can be merged without serialising their members. Numbers order by
+  // value, with ties broken by key so that equality is exactly that of
+  // `to_key`. Objects order by their items sorted by key, comparing keys
+  // and then values, and sets by their sorted members.
+  int compare_values(const Node& lhs_node, const Node& rhs_node)
+  {
+    Node lhs = unwrap_value(lhs_node);
+    Node rhs = unwrap_value(rhs_node);
+    int lhs_rank = value_rank(lhs);
+    int rhs_rank = value_rank(rhs);
+    if (lhs_rank != rhs_rank)
+    {
+      return three_way(lhs_rank, rhs_rank);
+    }
+
+    switch (lhs_rank)
+    {
+      case 0:
+        return 0;
+
+      case 1:
+        return three_way(lhs == True, rhs == True);
+
+      case 2: {
+        int result = three_way(number_value(lhs), number_value(rhs));
+        if (result != 0)
+        {
+          return result;
+        }
+
+        if (lhs == Int && rhs == Int)
+        {
+          return compare_ints(lhs->location().view(), rhs->location().view());
+        }
+
+        return three_way(to_key(lhs), to_key(rhs));
+      }
+
+      case 3:
+        return three_way(lhs->location().view(), rhs->location().view());
+
+      case 4: {
+        size_t size = std::min(lhs->size(), rhs->size());
+        for (size_t i = 0; i < size; ++i)
+        {
+          int result = compare_values(lhs->at(i), rhs->at(i));
+          if (result != 0)
+          {
+            return result;
+          }
+        }
+
+        return three_way(lhs->size(), rhs->size());
+      }
+
+      case 5: {
+        Nodes lhs_items = sorted_items(lhs);
+        Nodes rhs_items = sorted_items(rhs);
+        size_t size = std::min(lhs_items.size(), rhs_items.size());
+        for (size_t i = 0; i < size; ++i)
+        {
+          int result = compare_values(lhs_items[i] / Key, rhs_items[i] / Key);
+          if (result == 0)
+          {
+            result = compare_values(lhs_items[i] / Val, rhs_items[i] / Val);
+          }
+
+          if (result != 0)
+          {
+            return result;
+          }
+        }
+
+        return three_way(lhs_items.size(), rhs_items.size());
+      }
+
+      case 6: {
+        Nodes lhs_members = sorted_members(lhs);
+        Nodes rhs_members = sorted_members(rhs);
+        size_t size = std::min(lhs_members.size(), rhs_members.size());
+        for (size_t i = 0; i < size; ++i)
+        {
+          int result = compare_values(lhs_members[i], rhs_members[i]);
+          if (result != 0)
+          {
+            return result;
+          }
+        }
+
+        return three_way(lhs_members.size(), rhs_members.size());
+      }
+
+      default:
+        return three_way(to_key(lhs), to_key(rhs));
+    }
+  }
 }
 
 namespace rego
@@ -226,10 +489,7 @@ namespace rego
 
   Node Resolver::scalar(double value)
   {
-    std::ostringstream oss;
-    oss << std::setprecision(std::numeric_limits<double>::max_digits10 - 1)
-        << std::noshowpoint << value;
-    return Float ^ oss.str();
+    return Float ^ format_double(value);
   }
 
   Node Resolver::scalar()
@@ -418,17 +678,17 @@ namespace rego
   {
     if (value == Term)
     {
-      return value->clone();
+      return adopt(value);
     }
 
     if (value->in({Array, Set, Object, Scalar}))
     {
-      return Term << value->clone();
+      return Term << adopt(value);
     }
 
     if (value->in({Int, Float, JSONString, True, False, Null}))
     {
-      return Term << (Scalar << value->clone());
+      return Term << (Scalar << adopt(value));
     }
 
     return err(value, "Not a term");
@@ -504,7 +764,7 @@ namespace rego
 
   Node Resolver::set(const Node& set_members)
   {
-    std::map<std::string, Node> members;
+    Nodes members;
     for (Node member : *set_members)
     {
       if (member->type() == Expr)
@@ -512,17 +772,18 @@ namespace rego
         throw std::runtime_error("Not implemented");
       }
 
-      std::string repr = to_key(member);
-      if (!members.contains(repr))
-      {
-        members[repr] = to_term(member);
-      }
+      members.push_back(to_term(member));
     }
 
+    // the first occurrence of each value is kept
+    std::stable_sort(members.begin(), members.end(), value_less);
     Node set = NodeDef::create(Set);
-    for (auto [_, member] : members)
+    for (auto& member : members)
     {
-      set->push_back(member);
+      if (set->empty() || compare_values(set->back(), member) != 0)
+      {
+        set->push_back(member);
+      }
     }
     return set;
   }
@@ -539,19 +800,27 @@ namespace rego
       return err(rhs, "intersection: both arguments must be sets");
     }
 
+    Nodes lhs_members = sorted_members(lhs);
+    Nodes rhs_members = sorted_members(rhs);
     Node set = NodeDef::create(Set);
-
-    std::set<std::string> values;
-    for (auto term : *lhs)
-    {
-      values.insert(to_key(term));
-    }
-
-    for (auto term : *rhs)
+    auto l = lhs_members.begin();
+    auto r = rhs_members.begin();
+    while (l != lhs_members.end() && r != rhs_members.end())
     {
-      if (values.contains(to_key(term)))
+      int result = compare_values(*l, *r);
+      if (result < 0)
+      {
+        ++l;
+      }
+      else if (result > 0)
+      {
+        ++r;
+      }
+      else
       {
-        set->push_back(term->clone());
+        set->push_back(adopt(*r));
+        ++l;
+        ++r;
       }
     }
 
@@ -570,26 +839,40 @@ namespace rego
       return err(rhs, "union: both arguments must be sets");
     }
 
+    Nodes lhs_members = sorted_members(lhs);
+    Nodes rhs_members = sorted_members(rhs);
     Node set = NodeDef::create(Set);
-
-    std::map<std::string, Node> members;
-    for (auto term : *lhs)
+    auto l = lhs_members.begin();
+    auto r = rhs_members.begin();
+    while (l != lhs_members.end() || r != rhs_members.end())
     {
-      members[to_key(term)] = term;
-    }
+      int result = 0;
+      if (l == lhs_members.end())
+      {
+        result = 1;
+      }
+      else if (r == rhs_members.end())
+      {
+        result = -1;
+      }
+      else
+      {
+        result = compare_values(*l, *r);
+      }
 
-    for (auto term : *rhs)
-    {
-      std::string key = to_key(term);
-      if (!members.contains(key))
+      if (result > 0)
       {
-        members[key] = term;
+        set->push_back(adopt(*r));
+        ++r;
+        continue;
       }
-    }
 
-    for (auto [_, member] : members)
-    {
-      set->push_back(member->clone());
+      set->push_back(adopt(*l));
+      ++l;
+      if (result == 0)
+      {
+        ++r;
+      }
     }
 
     return set;
@@ -607,18 +890,20 @@ namespace rego
       return err(rhs, "difference: both arguments must be sets");
     }
 
+    Nodes lhs_members = sorted_members(lhs);
+    Nodes rhs_members = sorted_members(rhs);
     Node set = NodeDef::create(Set);
-    std::set<std::string> values;
-    for (auto term : *rhs)
+    auto r = rhs_members.begin();
+    for (auto& member : lhs_members)
     {
-      values.insert(to_key(term));
-    }
+      while (r != rhs_members.end() && compare_values(*r, member) < 0)
+      {
+        ++r;
+      }
 
-    for (auto term : *lhs)
-    {
-      if (!values.contains(to_key(term)))
+      if (r == rhs_members.end() || compare_values(*r, member) != 0)
       {
-        set->push_back(term->clone());
+        set->push_back(adopt(member));
       }
     }
 
@@ -663,26 +948,32 @@ namespace rego
       items = items->front();
     }
 
-    std::vector<std::string> indices;
+    std::string index_str = to_key(index);
+    std::string item_str = to_key(item);
     if (items->type() == Array || items->type() == Set)
     {
-      indices = array_find(items, to_key(item));
-    }
-    else if (items->type() == Object)
-    {
-      indices = object_find(items, to_key(item));
-    }
-    else
-    {
-      return False ^ "false";
+      // only the member at the position named by the index can match
+      std::size_t i = 0;
+      auto [ptr, ec] = std::from_chars(
+        index_str.data(), index_str.data() + index_str.size(), i);
+      if (
+        ec != std::errc() || ptr != index_str.data() + index_str.size() ||
+        std::to_string(i) != index_str || i >= items->size())
+      {
+        return False ^ "false";
+      }
+
+      return Resolver::scalar(to_key(items->at(i)) == item_str);
     }
 
-    std::string index_str = to_key(index);
-    for (auto& i : indices)
+    if (items->type() == Object)
     {
-      if (i == index_str)
+      for (auto& objectitem : *items)
       {
-        return True ^ "true";
+        if (to_key(objectitem / Key) == index_str)
+        {
+          return Resolver::scalar(to_key(objectitem / Val) == item_str);
+        }
       }
     }
 
@@ -697,56 +988,28 @@ namespace rego
       items = items->front();
     }
 
-    std::vector<std::string> indices;
+    std::string item_str = to_key(item);
     if (items->type() == Array || items->type() == Set)
     {
-      indices = array_find(items, to_key(item));
-    }
-    else if (items->type() == Object)
-    {
-      indices = object_find(items, to_key(item));
-    }
-    else
-    {
-      return False ^ "false";
-    }
-
-    if (indices.size() > 0)
-    {
-      return True ^ "True";
-    }
-
-    return False ^ "false";
-  }
-
-  std::vector<std::string> Resolver::array_find(
-    const Node& array, const std::string& search)
-  {
-    std::vector<std::string> indices;
-    for (std::size_t i = 0; i < array->size(); ++i)
-    {
-      Node item = array->at(i);
-      if (to_key(item) == search)
+      for (auto& member : *items)
       {
-        indices.push_back(std::to_string(i));
+        if (to_key(member) == item_str)
+        {
+          return True ^ "true";
+        }
       }
     }
-
-    return indices;
-  }
-
-  std::vector<std::string> Resolver::object_find(
-    const Node& object, const std::string& search)
-  {
-    std::vector<std::string> indices;
-    for (auto& objectitem : *object)
+    else if (items->type() == Object)
     {
-      if (to_key(objectitem / Val) == search)
+      for (auto& objectitem : *items)
       {
-        indices.push_back(to_key(objectitem / Key));
+        if (to_key(objectitem / Val) == item_str)
+        {
+          return True ^ "true";
+        }
       }
     }
 
-    return indices;
+    return False ^ "false";
   }
 }
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "internal.hh"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  using namespace rego;
+
+  // Strings shorter than this are indexed on every call, as scanning them is
+  // cheaper than consulting the cache.
+  const size_t MinCachedRuneIndexSize = 64;
+  // The number of rune indexes kept by the cache.
+  const size_t RuneIndexCacheSize = 16;
+
+  // The number of bytes in the UTF-8 sequence which starts with `lead`.
+  // Stray continuation bytes and invalid lead bytes count as one rune each.
+  size_t sequence_length(unsigned char lead)
+  {
+    if (lead < 0xC0)
+    {
+      return 1;
+    }
+
+    if (lead < 0xE0)
+    {
+      return 2;
+    }
+
+    if (lead < 0xF0)
+    {
+      return 3;
+    }
+
+    if (lead < 0xF8)
+    {
+      return 4;
+    }
+
+    return 1;
+  }
+
+  // The cache is per thread (see IdentityCache), so lookups take no lock.
+  thread_local IdentityCache<RuneIndex> rune_indexes(RuneIndexCacheSize);
+
+  Node string_node(const Node& node)
+  {
+    Node value = node;
+    if (value->type() == Term)
+    {
+      value = value->front();
+    }
+
+    if (value->type() == Scalar)
+    {
+      value = value->front();
+    }
+
+    return value;
+  }
+}
+
+namespace rego
+{
+  bool is_ascii(const std::string_view& str)
+  {
+    // Eight bytes at a time: a string is ASCII if no byte has its high bit
+    // set. Compilers vectorise this loop on targets with SIMD registers.
+    const std::uint64_t high_bits = 0x8080808080808080ULL;
+    const char* data = str.data();
+    size_t size = str.size();
+    size_t i = 0;
+    std::uint64_t acc = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+      std::uint64_t word;
+      std::memcpy(&word, data + i, sizeof(word));
+      acc |= word;
+    }
+
+    if ((acc & high_bits) != 0)
+    {
+      return false;
+    }
+
+    for (; i < size; ++i)
+    {
+      if (static_cast<unsigned char>(data[i]) >= 0x80)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  RuneIndex::RuneIndex(const std::string_view& str) :
+    m_bytes(str.size()), m_ascii(is_ascii(str))
+  {
+    if (m_ascii)
+    {
+      return;
+    }
+
+    auto offsets = std::make_shared<std::vector<std::uint32_t>>();
+    offsets->reserve(str.size());
+    size_t pos = 0;
+    while (pos < str.size())
+    {
+      offsets->push_back(static_cast<std::uint32_t>(pos));
+      size_t length = sequence_length(static_cast<unsigned char>(str[pos]));
+      pos = std::min(pos + length, str.size());
+    }
+
+    offsets->shrink_to_fit();
+    m_offsets = offsets;
+  }
+
+  bool RuneIndex::is_ascii() const
+  {
+    return m_ascii;
+  }
+
+  size_t RuneIndex::size() const
+  {
+    return m_ascii ? m_bytes : m_offsets->size();
+  }
+
+  size_t RuneIndex::byte_offset(size_t rune) const
+  {
+    if (m_ascii)
+    {
+      return std::min(rune, m_bytes);
+    }
+
+    if (rune >= m_offsets->size())
+    {
+      return m_bytes;
+    }
+
+    return (*m_offsets)[rune];
+  }
+
+  size_t RuneIndex::rune_offset(size_t byte) const
+  {
+    if (m_ascii)
+    {
+      return std::min(byte, m_bytes);
+    }
+
+    if (byte >= m_bytes)
+    {
+      return m_offsets->size();
+    }
+
+    auto it = std::upper_bound(
+      m_offsets->begin(), m_offsets->end(), static_cast<std::uint32_t>(byte));
+    return static_cast<size_t>(it - m_offsets->begin()) - 1;
+  }
+
+  std::string_view RuneIndex::substr(
+    const std::string_view& str, size_t pos, size_t count) const
+  {
+    size_t start = byte_offset(pos);
+    size_t end = count > size() - std::min(pos, size()) ?
+      m_bytes :
+      byte_offset(pos + count);
+    return str.substr(start, end - start);
+  }
+
+  RuneIndex rune_index(const Node& node)
+  {
+    Node value = string_node(node);
+    std::string_view str = get_string_view(value);
+    if (str.size() < MinCachedRuneIndexSize)
+    {
+      return RuneIndex(str);
+    }
+
+    const RuneIndex* cached = rune_indexes.find(value);
+    if (cached != nullptr)
+    {
+      return *cached;
+    }
+
+    RuneIndex index(str);
+    rune_indexes.insert(value, index);
+    return index;
+  }
+
+  void clear_rune_indexes()
+  {
+    rune_indexes.clear();
+  }
+}
@@ -1,8 +1,17 @@
 #include "internal.hh"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <charconv>
+#include <exception>
 #include <iterator>
+#include <limits>
 #include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <utility>
 
 namespace
 {
@@ -56,10 +65,280 @@ namespace rego
 {
   namespace b = bundle;
 
-  VirtualMachine::VirtualMachine() : m_int_regex(R"(-?(?:0|[1-9][0-9]*))") {}
+  namespace
+  {
+    // numbers.range and numbers.range_step are evaluated lazily (see
+    // run_call). The local holds a RangeValue whose location records the
+    // first value, the (signed) step and the number of values, and the scan,
+    // Len, Dot and count consumers read it without building the array.
+    struct LazyRange
+    {
+      std::int64_t first;
+      std::int64_t step;
+      std::size_t count;
+    };
+
+    // The value of the "result" item of an entrypoint's result object, or
+    // nullptr if there is not exactly one. This is object_lookdown without
+    // formatting the key of every item.
+    Node result_value(const Node& object)
+    {
+      Node value = nullptr;
+      for (const Node& item : *object)
+      {
+        Node key = item / Key;
+        if (key == Term)
+        {
+          key = key->front();
+        }
+
+        if (key == Scalar)
+        {
+          key = key->front();
+        }
+
+        if (key != JSONString || get_string(key) != "result")
+        {
+          continue;
+        }
+
+        if (value != nullptr)
+        {
+          return nullptr;
+        }
+
+        value = item / Val;
+      }
+
+      return value;
+    }
+
+    std::optional<std::int64_t> range_bound(Node node)
+    {
+      if (node == Term)
+      {
+        node = node->front();
+      }
+
+      if (node == Scalar)
+      {
+        node = node->front();
+      }
+
+      if (node != Int)
+      {
+        return std::nullopt;
+      }
+
+      return BigInt(node->location()).to_int();
+    }
+
+    // Returns nullptr if the range cannot be represented lazily, in which
+    // case the builtin is called (and reports any errors).
+    Node make_range(const Nodes& args, bool has_step)
+    {
+      if (args.size() != (has_step ? 3 : 2))
+      {
+        return nullptr;
+      }
+
+      std::optional<std::int64_t> lhs = range_bound(args[0]);
+      std::optional<std::int64_t> rhs = range_bound(args[1]);
+      std::optional<std::int64_t> step =
+        has_step ? range_bound(args[2]) : std::int64_t(1);
+      if (!lhs.has_value() || !rhs.has_value() || !step.has_value())
+      {
+        return nullptr;
+      }
+
+      if (step.value() < 1)
+      {
+        return nullptr;
+      }
+
+      bool ascending = lhs.value() <= rhs.value();
+      std::uint64_t distance = ascending ?
+        std::uint64_t(rhs.value()) - std::uint64_t(lhs.value()) :
+        std::uint64_t(lhs.value()) - std::uint64_t(rhs.value());
+      std::uint64_t steps = distance / std::uint64_t(step.value());
+      if (steps >= std::numeric_limits<std::size_t>::max())
+      {
+        return nullptr;
+      }
+
+      std::int64_t signed_step = ascending ? step.value() : -step.value();
+      return RangeValue ^
+        (std::to_string(lhs.value()) + "," + std::to_string(signed_step) +
+         "," + std::to_string(steps + 1));
+    }
+
+    LazyRange read_range(const Node& node)
+    {
+      std::string_view view = node->location().view();
+      const char* begin = view.data();
+      const char* end = view.data() + view.size();
+      LazyRange range{0, 0, 0};
+      auto result = std::from_chars(begin, end, range.first);
+      result = std::from_chars(result.ptr + 1, end, range.step);
+      result = std::from_chars(result.ptr + 1, end, range.count);
+      if (result.ec != std::errc())
+      {
+        throw std::runtime_error("Invalid range value");
+      }
+
+      return range;
+    }
+
+    // The element of the range at the index, as a term like the elements of
+    // the array it stands for.
+    Node range_at(const LazyRange& range, std::size_t index)
+    {
+      // every value lies between the bounds, so wrapping arithmetic is exact
+      std::uint64_t value = std::uint64_t(range.first) +
+        std::uint64_t(range.step) * std::uint64_t(index);
+      return Term << (Scalar << (Int ^ std::to_string(std::int64_t(value))));
+    }
+
+    // The type of a value, without building it if it is a view of a
+    // container in compact data (see BundleDef::compact_data).
+    Token value_type(const Bundle& bundle, const Node& value)
+    {
+      if (value == TapeValue)
+      {
+        return bundle->data_tape->type(value);
+      }
+
+      return value->type();
+    }
+
+    Node range_to_array(const Node& node)
+    {
+      LazyRange range = read_range(node);
+      Node array = NodeDef::create(Array);
+      for (std::size_t i = 0; i < range.count; ++i)
+      {
+        poll_eval_limits();
+        array->push_back(range_at(range, i));
+      }
+
+      return array;
+    }
+
+    // The VM checks the limits of an evaluation after this many statements,
+    // and built-ins after this many calls to poll_eval_limits.
+    const std::size_t LimitCheckInterval = 1024;
+    const std::size_t EvalPollInterval = 1024;
+
+    thread_local const EvalLimits* current_eval_limits = nullptr;
+    thread_local const NodeDef* current_data = nullptr;
+    thread_local bundle::DataIndexCache* current_data_indexes = nullptr;
+    thread_local std::size_t eval_polls = 0;
+
+    // Independent scans over fewer items than this are not worth the cost of
+    // forking the state for each worker.
+    const std::size_t ParallelScanThreshold = 1024;
+    const std::size_t ParallelScanChunkSize = 128;
+
+    std::size_t scan_size(const Node& source)
+    {
+      if (source == RangeValue)
+      {
+        return read_range(source).count;
+      }
+
+      if (source->in({Array, Set, Object}))
+      {
+        return source->size();
+      }
+
+      return 0;
+    }
+
+    // Traces are saved as this magic number and a version, followed by the
+    // number of entries and then each entry as little-endian integers.
+    const char TraceMagic[4] = {'R', 'V', 'M', 'T'};
+    const std::uint64_t TraceVersion = 1;
+
+    void write_trace_uint(std::ostream& stream, std::uint64_t value, int bytes)
+    {
+      for (int i = 0; i < bytes; ++i)
+      {
+        stream.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+      }
+    }
+
+    std::uint64_t read_trace_uint(std::istream& stream, int bytes)
+    {
+      std::uint64_t value = 0;
+      for (int i = 0; i < bytes; ++i)
+      {
+        int c = stream.get();
+        if (c == std::char_traits<char>::eof())
+        {
+          throw std::invalid_argument("Truncated VM trace");
+        }
+        value |= static_cast<std::uint64_t>(c & 0xFF) << (8 * i);
+      }
+      return value;
+    }
+
+    const char* code_name(VirtualMachine::Code code)
+    {
+      switch (code)
+      {
+        case VirtualMachine::Code::Break:
+          return "Break";
+        case VirtualMachine::Code::Continue:
+          return "Continue";
+        case VirtualMachine::Code::Undefined:
+          return "Undefined";
+        case VirtualMachine::Code::MultipleOutputs:
+          return "MultipleOutputs";
+        case VirtualMachine::Code::Return:
+          return "Return";
+        case VirtualMachine::Code::Error:
+          return "Error";
+      }
+
+      return "Unknown";
+    }
+
+    // The operator passed to Resolver::boolinfix by Equal and NotEqual. It is
+    // only inspected for its type, so one node serves every comparison.
+    const Node& equals_op()
+    {
+      static const Node op = NodeDef::create(Equals);
+      return op;
+    }
+
+    // Whether the operands are the same shared constant (see
+    // BundleDef::materialize_constants), in which case they are equal
+    // without comparing their values.
+    bool same_constant(const Node& a, const Node& b)
+    {
+      return a == b && a->in({JSONString, True, False, Null});
+    }
+  }
+
+  VirtualMachine::VirtualMachine() :
+    m_scan_workers(1),
+    m_statement_limit(0),
+    m_raw_results(false),
+    m_time_limit(0),
+    m_cancel_epoch(0),
+    m_trace_capacity(0)
+  {}
 
   VirtualMachine& VirtualMachine::bundle(Bundle bundle)
   {
+    if (m_bundle != bundle)
+    {
+      std::lock_guard<std::mutex> lock(m_decisions_mutex);
+      m_decisions_cacheable.clear();
+      m_results_shareable.clear();
+      m_scans_pure.clear();
+    }
+
     m_bundle = bundle;
     return *this;
   }
@@ -71,6 +350,14 @@ namespace rego
 
   VirtualMachine& VirtualMachine::builtins(BuiltIns builtins)
   {
+    if (m_builtins != builtins)
+    {
+      std::lock_guard<std::mutex> lock(m_decisions_mutex);
+      m_decisions_cacheable.clear();
+      m_results_shareable.clear();
+      m_scans_pure.clear();
+    }
+
     m_builtins = builtins;
     return *this;
   }
@@ -80,6 +367,368 @@ namespace rego
     return m_builtins;
   }
 
+  VirtualMachine& VirtualMachine::scan_workers(size_t workers)
+  {
+    workers = std::max<size_t>(workers, 1);
+    if (workers != m_scan_workers)
+    {
+      // scans already running keep the pool they started with
+      std::lock_guard<std::mutex> lock(m_pool_mutex);
+      m_pool = nullptr;
+    }
+
+    m_scan_workers = workers;
+    return *this;
+  }
+
+  size_t VirtualMachine::scan_workers() const
+  {
+    return m_scan_workers;
+  }
+
+  VirtualMachine& VirtualMachine::statement_limit(size_t limit)
+  {
+    m_statement_limit = limit;
+    return *this;
+  }
+
+  size_t VirtualMachine::statement_limit() const
+  {
+    return m_statement_limit;
+  }
+
+  VirtualMachine& VirtualMachine::raw_results(bool raw)
+  {
+    m_raw_results = raw;
+    return *this;
+  }
+
+  bool VirtualMachine::raw_results() const
+  {
+    return m_raw_results;
+  }
+
+  VirtualMachine& VirtualMachine::time_limit(std::chrono::milliseconds limit)
+  {
+    m_time_limit = limit;
+    return *this;
+  }
+
+  std::chrono::milliseconds VirtualMachine::time_limit() const
+  {
+    return m_time_limit;
+  }
+
+  void VirtualMachine::cancel()
+  {
+    ++m_cancel_epoch;
+  }
+
+  VirtualMachine& VirtualMachine::trace_capacity(size_t capacity)
+  {
+    m_trace_capacity = capacity;
+    std::lock_guard<std::mutex> lock(m_trace_mutex);
+    m_trace.clear();
+    m_trace.shrink_to_fit();
+    return *this;
+  }
+
+  size_t VirtualMachine::trace_capacity() const
+  {
+    return m_trace_capacity;
+  }
+
+  std::vector<VirtualMachine::TraceEntry> VirtualMachine::trace() const
+  {
+    std::lock_guard<std::mutex> lock(m_trace_mutex);
+    return m_trace;
+  }
+
+  void VirtualMachine::Trace::record(const TraceEntry& entry)
+  {
+    if (entries.size() < capacity)
+    {
+      entries.push_back(entry);
+    }
+    else
+    {
+      entries[total % capacity] = entry;
+    }
+    total++;
+  }
+
+  std::vector<VirtualMachine::TraceEntry> VirtualMachine::Trace::in_order()
+    const
+  {
+    if (total <= entries.size())
+    {
+      return entries;
+    }
+
+    // the ring has wrapped, so the oldest entry is the next to be replaced
+    size_t oldest = total % entries.size();
+    std::vector<TraceEntry> ordered;
+    ordered.reserve(entries.size());
+    ordered.insert(ordered.end(), entries.begin() + oldest, entries.end());
+    ordered.insert(ordered.end(), entries.begin(), entries.begin() + oldest);
+    return ordered;
+  }
+
+  void VirtualMachine::publish_trace(const State& state) const
+  {
+    Trace* trace = state.trace();
+    if (trace == nullptr)
+    {
+      return;
+    }
+
+    std::vector<TraceEntry> entries = trace->in_order();
+    std::lock_guard<std::mutex> lock(m_trace_mutex);
+    m_trace = std::move(entries);
+  }
+
+  void VirtualMachine::save_trace(std::ostream& stream) const
+  {
+    std::vector<TraceEntry> entries = trace();
+    stream.write(TraceMagic, sizeof(TraceMagic));
+    write_trace_uint(stream, TraceVersion, 4);
+    write_trace_uint(stream, entries.size(), 8);
+    for (const TraceEntry& entry : entries)
+    {
+      write_trace_uint(stream, entry.statement, 4);
+      write_trace_uint(stream, static_cast<std::uint64_t>(entry.type), 1);
+      write_trace_uint(stream, static_cast<std::uint64_t>(entry.code), 1);
+      write_trace_uint(stream, entry.start_ns, 8);
+      write_trace_uint(stream, entry.end_ns, 8);
+    }
+  }
+
+  std::vector<VirtualMachine::TraceEntry> VirtualMachine::load_trace(
+    std::istream& stream)
+  {
+    char magic[sizeof(TraceMagic)];
+    stream.read(magic, sizeof(magic));
+    if (!stream || !std::equal(magic, magic + sizeof(magic), TraceMagic))
+    {
+      throw std::invalid_argument("Not a VM trace");
+    }
+
+    if (read_trace_uint(stream, 4) != TraceVersion)
+    {
+      throw std::invalid_argument("Unsupported VM trace version");
+    }
+
+    std::uint64_t count = read_trace_uint(stream, 8);
+    std::vector<TraceEntry> entries;
+    for (std::uint64_t i = 0; i < count; ++i)
+    {
+      TraceEntry entry;
+      entry.statement = static_cast<std::uint32_t>(read_trace_uint(stream, 4));
+      entry.type = static_cast<b::StatementType>(read_trace_uint(stream, 1));
+      entry.code = static_cast<Code>(read_trace_uint(stream, 1));
+      entry.start_ns = read_trace_uint(stream, 8);
+      entry.end_ns = read_trace_uint(stream, 8);
+      entries.push_back(entry);
+    }
+
+    return entries;
+  }
+
+  void VirtualMachine::print_trace(
+    const BundleDef& bundle,
+    const std::vector<TraceEntry>& trace,
+    std::ostream& stream)
+  {
+    for (const TraceEntry& entry : trace)
+    {
+      stream << entry.start_ns << "ns +" << (entry.end_ns - entry.start_ns)
+             << "ns " << code_name(entry.code) << " ";
+      const b::Statement* stmt = bundle.find_statement(entry.statement);
+      if (stmt == nullptr || stmt->type != entry.type)
+      {
+        stream << "<unknown statement " << entry.statement << ">" << std::endl;
+        continue;
+      }
+
+      stream << *stmt;
+      const Location& loc = stmt->location;
+      if (loc.source != nullptr)
+      {
+        auto [line, col] = loc.linecol();
+        stream << " at " << loc.source->origin() << ":" << line + 1 << ":"
+               << col + 1;
+      }
+      stream << std::endl;
+    }
+  }
+
+  void EvalLimits::check() const
+  {
+    if (
+      (cancelled != nullptr && cancelled->load(std::memory_order_relaxed)) ||
+      (cancel_epoch != nullptr &&
+       cancel_epoch->load(std::memory_order_relaxed) != epoch))
+    {
+      throw EvalInterrupted("evaluation cancelled");
+    }
+
+    if (deadline.has_value() && std::chrono::steady_clock::now() > *deadline)
+    {
+      throw EvalInterrupted("evaluation time limit exceeded");
+    }
+  }
+
+  EvalLimitsScope::EvalLimitsScope(const EvalLimits* limits) :
+    m_previous(current_eval_limits)
+  {
+    current_eval_limits = limits;
+  }
+
+  EvalLimitsScope::~EvalLimitsScope()
+  {
+    current_eval_limits = m_previous;
+  }
+
+  DataIndexScope::DataIndexScope(
+    const Node& data, bundle::DataIndexCache* cache) :
+    m_previous_data(current_data), m_previous_cache(current_data_indexes)
+  {
+    current_data = data.get();
+    current_data_indexes = cache;
+  }
+
+  DataIndexScope::~DataIndexScope()
+  {
+    current_data = m_previous_data;
+    current_data_indexes = m_previous_cache;
+  }
+
+  bundle::DataIndexCache* data_index_cache(const Node& node)
+  {
+    if (current_data == nullptr)
+    {
+      return nullptr;
+    }
+
+    // the data document is never changed, so nothing is adding to or
+    // removing from the tree while this walks up it
+    for (const NodeDef* n = node.get(); n != nullptr; n = n->parent())
+    {
+      if (n == current_data)
+      {
+        return current_data_indexes;
+      }
+    }
+
+    return nullptr;
+  }
+
+  void poll_eval_limits()
+  {
+    if (current_eval_limits != nullptr && ++eval_polls % EvalPollInterval == 0)
+    {
+      current_eval_limits->check();
+    }
+  }
+
+  WorkerPool::WorkerPool(size_t threads) : m_stopping(false)
+  {
+    for (size_t i = 0; i < threads; ++i)
+    {
+      try
+      {
+        m_threads.emplace_back([this]() { loop(); });
+      }
+      catch (const std::system_error&)
+      {
+        // the callers of run will do the work the missing threads would have
+        break;
+      }
+    }
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+
+    m_queued.notify_all();
+    for (std::thread& thread : m_threads)
+    {
+      thread.join();
+    }
+  }
+
+  size_t WorkerPool::size() const
+  {
+    return m_threads.size();
+  }
+
+  void WorkerPool::run(size_t count, const std::function<void(size_t)>& task)
+  {
+    Batch batch{&task, 0};
+    if (count > 1)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for (size_t i = 1; i < count; ++i)
+      {
+        m_queue.emplace_back(&batch, i);
+      }
+    }
+
+    m_queued.notify_all();
+    std::exception_ptr failure;
+    try
+    {
+      task(0);
+    }
+    catch (...)
+    {
+      failure = std::current_exception();
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queue.erase(
+      std::remove_if(
+        m_queue.begin(),
+        m_queue.end(),
+        [&batch](const auto& entry) { return entry.first == &batch; }),
+      m_queue.end());
+    m_finished.wait(lock, [&batch]() { return batch.running == 0; });
+    lock.unlock();
+
+    if (failure != nullptr)
+    {
+      std::rethrow_exception(failure);
+    }
+  }
+
+  void WorkerPool::loop()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+      m_queued.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+      if (m_stopping)
+      {
+        return;
+      }
+
+      auto [batch, index] = m_queue.front();
+      m_queue.pop_front();
+      ++batch->running;
+      lock.unlock();
+      (*batch->task)(index);
+      lock.lock();
+      if (--batch->running == 0)
+      {
+        m_finished.notify_all();
+      }
+    }
+  }
+
   bool VirtualMachine::State::is_in_call_stack(const Location& func_name) const
   {
     auto it = std::find(m_call_stack.begin(), m_call_stack.end(), func_name);
@@ -106,6 +755,11 @@ namespace rego
     m_function_cache[func_name] = result;
   }
 
+  void VirtualMachine::State::hold(Node holder)
+  {
+    m_held.push_back(holder);
+  }
+
   Node VirtualMachine::State::get_function_result(
     const Location& func_name) const
   {
@@ -155,6 +809,34 @@ namespace rego
     m_break_count--;
   }
 
+  std::vector<std::string>& VirtualMachine::State::print_output()
+  {
+    return m_print_output;
+  }
+
+  Node VirtualMachine::State::push_walk(Node root, bool with_paths)
+  {
+    Node iterator = NodeDef::create(WalkIterator);
+    m_walks.push_back({iterator, root, with_paths});
+    return iterator;
+  }
+
+  std::optional<VirtualMachine::State::Walk> VirtualMachine::State::pop_walk(
+    const Node& iterator)
+  {
+    for (auto it = m_walks.begin(); it != m_walks.end(); ++it)
+    {
+      if (it->iterator.get() == iterator.get())
+      {
+        Walk walk = *it;
+        m_walks.erase(it);
+        return walk;
+      }
+    }
+
+    return std::nullopt;
+  }
+
   std::string_view VirtualMachine::State::root_function_name() const
   {
     if (m_call_stack.empty())
@@ -177,6 +859,14 @@ namespace rego
     return name;
   }
 
+  void VirtualMachine::State::next_plan()
+  {
+    // the function cache is kept, as the plans see the same input and data
+    std::fill(m_frame.begin() + 2, m_frame.end(), nullptr);
+    m_result_set.clear();
+    m_errors.clear();
+  }
+
   void VirtualMachine::State::add_result(Node node)
   {
     m_result_set.push_back(node);
@@ -218,16 +908,80 @@ namespace rego
     return m_errors;
   }
 
+  size_t VirtualMachine::State::slot(size_t key) const
+  {
+    // input and data are shared by every frame
+    if (key < 2)
+    {
+      return key;
+    }
+
+    return m_frame_base + key;
+  }
+
+  void VirtualMachine::State::push_frame(size_t num_locals)
+  {
+    m_frames.push_back({m_frame_base, m_frame_end});
+    m_frame_base = m_frame_end - 2;
+    m_frame_end = m_frame_base + std::max<size_t>(num_locals, 2);
+    if (m_frame.size() < m_frame_end)
+    {
+      m_frame.resize(m_frame_end, nullptr);
+    }
+  }
+
+  void VirtualMachine::State::pop_frame()
+  {
+    assert(!m_frames.empty());
+    // the next call which uses these slots expects to find them empty
+    std::fill(
+      m_frame.begin() + m_frame_base + 2,
+      m_frame.begin() + m_frame_end,
+      nullptr);
+    std::tie(m_frame_base, m_frame_end) = m_frames.back();
+    m_frames.pop_back();
+  }
+
   Node VirtualMachine::State::read_local(size_t key) const
   {
-    if (m_frame[key] != nullptr)
+    return materialize(peek_local(key));
+  }
+
+  Node VirtualMachine::State::materialize(const Node& value) const
+  {
+    if (value == RangeValue)
+    {
+      // the range is escaping into something which needs a real array
+      return range_to_array(value);
+    }
+
+    if (value == TapeValue)
+    {
+      // likewise for a container in the compact data document, which is
+      // kept for the rest of the evaluation so that later reads of it are
+      // the same node
+      Node& built = m_materialized[m_tape->offset(value)];
+      if (built == nullptr)
+      {
+        built = m_tape->materialize(value);
+      }
+
+      return built;
+    }
+
+    return value;
+  }
+
+  Node VirtualMachine::State::peek_local(size_t key) const
+  {
+    const Node& value = m_frame[slot(key)];
+    if (value != nullptr)
     {
-      logging::Trace() << "frame[" << key << "]" << " -> "
-                       << DebugKey(m_frame[key]);
-      return m_frame[key];
+      VM_LOG(Trace) << "frame[" << key << "]" << " -> " << DebugKey(value);
+      return value;
     }
 
-    logging::Trace() << "frame[" << key << "]" << " -> " << "<missing>";
+    VM_LOG(Trace) << "frame[" << key << "]" << " -> " << "<missing>";
     return Undefined;
   }
 
@@ -235,84 +989,271 @@ namespace rego
   {
     if (value == Term)
     {
-      value = value->front();
+      value = value->front();
+    }
+
+    if (value == Scalar)
+    {
+      value = value->front();
+    }
+
+    if (value == Undefined)
+    {
+      return reset_local(key);
+    }
+
+    if (value == nullptr)
+    {
+      logging::Error() << "Attempting to write null value to local: " << key;
+      throw std::runtime_error("Cannot write null value to local variable");
+    }
+
+    m_frame[slot(key)] = value;
+    VM_LOG(Trace) << DebugKey(value) << " -> frame[" << key << "]";
+  }
+
+  bool VirtualMachine::State::is_defined(size_t key) const
+  {
+    const Node& value = m_frame[slot(key)];
+    if (value == nullptr || value == Undefined)
+    {
+      VM_LOG(Trace) << "frame[" << key << "]" << " -> " << "<missing>";
+      return false;
+    }
+
+    VM_LOG(Trace) << "frame[" << key << "]" << " -> " << DebugKey(value);
+    return true;
+  }
+
+  void VirtualMachine::State::reset_local(size_t key)
+  {
+    VM_LOG(Debug) << "reset frame[" << key << "]";
+    m_frame[slot(key)] = nullptr;
+  }
+
+  Node VirtualMachine::unpack_operand(
+    const State& state, const b::Operand& operand) const
+  {
+    switch (operand.type)
+    {
+      case b::OperandType::Local:
+        return state.read_local(operand.index);
+
+      case b::OperandType::String:
+        return m_bundle->string_values[operand.index];
+
+      case b::OperandType::False:
+        return m_bundle->false_value;
+
+      case b::OperandType::True:
+        return m_bundle->true_value;
+
+      case b::OperandType::Index:
+      case b::OperandType::Value:
+        throw std::runtime_error("Unpacking raw operand");
+
+      case b::OperandType::None:
+        throw std::runtime_error("Uninitialized operand");
+    }
+
+    throw std::runtime_error("Invalid operand");
+  }
+
+  Node VirtualMachine::unpack_lazy_operand(
+    const State& state, const b::Operand& operand) const
+  {
+    if (operand.type == b::OperandType::Local)
+    {
+      return state.peek_local(operand.index);
+    }
+
+    return unpack_operand(state, operand);
+  }
+
+  Node VirtualMachine::unpack_view_operand(
+    const State& state, const b::Operand& operand) const
+  {
+    // views of the compact data document are immutable, so they can be
+    // copied between locals without building the values they refer to
+    Node value = unpack_lazy_operand(state, operand);
+    if (value == TapeValue)
+    {
+      return value;
+    }
+
+    return state.materialize(value);
+  }
+
+  VirtualMachine::State::State(
+    Node input,
+    Node data,
+    size_t num_locals,
+    std::shared_ptr<const DataTape> tape) :
+    m_frame_base(0),
+    m_frame_end(std::max<size_t>(num_locals, 2)),
+    m_with_count(0),
+    m_break_count(0),
+    m_worker(false),
+    m_statements(0),
+    m_next_check(std::numeric_limits<size_t>::max()),
+    m_tape(tape)
+  {
+    m_frame.resize(m_frame_end, nullptr);
+    write_local(0, input->front());
+    write_local(1, data);
+  }
+
+  void VirtualMachine::State::limit(std::shared_ptr<EvalLimits> limits)
+  {
+    m_limits = limits;
+    m_statements = 0;
+    m_next_check = LimitCheckInterval;
+    if (m_limits->max_statements > 0)
+    {
+      m_next_check = std::min(m_next_check, m_limits->max_statements + 1);
+    }
+  }
+
+  const EvalLimits* VirtualMachine::State::limits() const
+  {
+    return m_limits.get();
+  }
+
+  void VirtualMachine::State::trace(std::shared_ptr<Trace> trace)
+  {
+    m_trace = trace;
+  }
+
+  VirtualMachine::Trace* VirtualMachine::State::trace() const
+  {
+    return m_trace.get();
+  }
+
+  void VirtualMachine::State::step()
+  {
+    if (++m_statements >= m_next_check)
+    {
+      check_limits();
+    }
+  }
+
+  void VirtualMachine::State::check_limits()
+  {
+    size_t total =
+      m_limits->statements.fetch_add(m_statements) + m_statements;
+    m_statements = 0;
+    m_next_check = LimitCheckInterval;
+    size_t max_statements = m_limits->max_statements;
+    if (max_statements > 0)
+    {
+      if (total > max_statements)
+      {
+        throw EvalInterrupted("evaluation statement limit exceeded");
+      }
+
+      // stop exactly at the limit when evaluating on a single thread
+      m_next_check = std::min(m_next_check, max_statements - total + 1);
+    }
+
+    m_limits->check();
+  }
+
+  void VirtualMachine::State::flush_statements()
+  {
+    if (m_limits != nullptr)
+    {
+      m_limits->statements += m_statements;
+    }
+
+    m_statements = 0;
+  }
+
+  void VirtualMachine::State::seal()
+  {
+    // Workers read the values they fork from concurrently, and any of them
+    // which had no parent would be adopted (see adopt) by each worker which
+    // added it to a collection. Giving them a parent first means the workers
+    // copy them instead. Input and data are skipped, as they belong to the
+    // interpreter and the bundle.
+    if (m_sealed == nullptr)
+    {
+      m_sealed = NodeDef::create(Seq);
     }
 
-    if (value == Scalar)
+    auto seal_value = [this](const Node& value) {
+      if (value != nullptr && value->parent() == nullptr)
+      {
+        m_sealed << value;
+      }
+    };
+
+    std::for_each(m_frame.begin() + 2, m_frame.end(), seal_value);
+    for (auto& [_, result] : m_function_cache)
     {
-      value = value->front();
+      seal_value(result);
     }
 
-    if (value == Undefined)
+    for (const Walk& walk : m_walks)
     {
-      return reset_local(key);
+      seal_value(walk.root);
     }
 
-    if (value == nullptr)
+    for (auto& [_, value] : m_materialized)
     {
-      logging::Error() << "Attempting to write null value to local: " << key;
-      throw std::runtime_error("Cannot write null value to local variable");
+      seal_value(value);
     }
-
-    m_frame[key] = value;
-    logging::Trace() << DebugKey(value) << " -> frame[" << key << "]";
   }
 
-  bool VirtualMachine::State::is_defined(size_t key) const
+  VirtualMachine::State VirtualMachine::State::fork(
+    const std::vector<size_t>& collectors) const
   {
-    if (m_frame[key] == nullptr || m_frame[key] == Undefined)
+    State worker = *this;
+    worker.m_worker = true;
+    worker.m_errors.clear();
+    worker.m_result_set.clear();
+    worker.m_collectors.clear();
+    worker.m_statements = 0;
+    // workers are not traced
+    worker.m_trace = nullptr;
+    for (size_t key : collectors)
     {
-      logging::Trace() << "frame[" << key << "]" << " -> " << "<missing>";
-      return false;
+      worker.m_collectors.insert(slot(key));
     }
-
-    logging::Trace() << "frame[" << key << "]" << " -> "
-                     << DebugKey(m_frame[key]);
-    return true;
+    return worker;
   }
 
-  void VirtualMachine::State::reset_local(size_t key)
+  bool VirtualMachine::State::is_worker() const
   {
-    logging::Debug() << "reset frame[" << key << "]";
-    m_frame[key] = nullptr;
+    return m_worker;
   }
 
-  Node VirtualMachine::unpack_operand(
-    const State& state, const b::Operand& operand) const
+  bool VirtualMachine::State::is_collector(size_t key) const
   {
-    switch (operand.type)
-    {
-      case b::OperandType::Local:
-        return state.read_local(operand.index);
-
-      case b::OperandType::String:
-        return JSONString ^ m_bundle->strings[operand.index];
-
-      case b::OperandType::False:
-        return False ^ "false";
-
-      case b::OperandType::True:
-        return True ^ "true";
+    return m_worker && m_collectors.contains(slot(key));
+  }
 
-      case b::OperandType::Index:
-      case b::OperandType::Value:
-        throw std::runtime_error("Unpacking raw operand");
+  void VirtualMachine::State::add_effect(
+    const b::Statement& stmt, Node key, Node value)
+  {
+    m_effects.push_back({&stmt, key, value, {}, Code::Continue});
+  }
 
-      case b::OperandType::None:
-        throw std::runtime_error("Uninitialized operand");
+  void VirtualMachine::State::end_iteration(Code code)
+  {
+    if (!m_errors.empty() || code == Code::Error)
+    {
+      m_effects.push_back({nullptr, nullptr, nullptr, m_errors, code});
+      m_errors.clear();
     }
-
-    throw std::runtime_error("Invalid operand");
   }
 
-  VirtualMachine::State::State(Node input, Node data, size_t num_locals)
+  std::vector<VirtualMachine::State::Effect> VirtualMachine::State::
+    take_effects()
   {
-    m_frame.resize(num_locals, nullptr);
-    write_local(0, input->front());
-    write_local(1, data);
+    return std::exchange(m_effects, {});
   }
 
-  Node VirtualMachine::run_query(Node input) const
+  Node VirtualMachine::run_query(Node input, EvalContext* context) const
   {
     logging::Debug() << "Input: " << input;
 
@@ -324,8 +1265,9 @@ namespace rego
                Line ^ Location("<query>"), "query plan not found");
     }
 
-    State state(input, m_bundle->data, m_bundle->local_count);
-    run_plan(m_bundle->plans[*maybe_index], state);
+    const b::Plan& plan = m_bundle->plans[*maybe_index];
+    State state(input, m_bundle->data, plan.local_count, m_bundle->data_tape);
+    run_plan(plan, state, context);
 
     if (!state.errors().empty())
     {
@@ -397,7 +1339,7 @@ namespace rego
   }
 
   Node VirtualMachine::run_entrypoint(
-    const Location& entrypoint, Node input) const
+    const Location& entrypoint, Node input, EvalContext* context) const
   {
     auto maybe_index = m_bundle->find_plan(entrypoint);
     if (!maybe_index.has_value())
@@ -415,21 +1357,93 @@ namespace rego
 
     logging::Debug() << "Input: " << input;
 
-    State state(input, m_bundle->data, m_bundle->local_count);
-    run_plan(m_bundle->plans[*maybe_index], state);
+    const b::Plan& plan = m_bundle->plans[*maybe_index];
+    const auto& cache = m_bundle->decision_cache;
+    bool use_cache = cache != nullptr && decisions_cacheable(plan, *cache);
+    if (use_cache)
+    {
+      auto cached = cache->find(entrypoint, input, m_bundle->data);
+      if (cached.has_value())
+      {
+        return entrypoint_results(*cached);
+      }
+    }
+
+    State state(input, m_bundle->data, plan.local_count, m_bundle->data_tape);
+    run_plan(plan, state, context);
+    if (use_cache && state.errors().empty())
+    {
+      cache->insert(entrypoint, input, m_bundle->data, state.result_set());
+    }
+
+    return entrypoint_results(state);
+  }
+
+  Nodes VirtualMachine::run_entrypoints(
+    const std::vector<Location>& entrypoints,
+    Node input,
+    EvalContext* context) const
+  {
+    Nodes outputs(entrypoints.size());
+    if (input != Input)
+    {
+      logging::Error() << "Input node is not of type Input: " << input;
+      for (Node& output : outputs)
+      {
+        output = ErrorSeq << err(input, "Invalid input node");
+      }
+      return outputs;
+    }
+
+    logging::Debug() << "Input: " << input;
+
+    std::vector<const b::Plan*> plans;
+    std::vector<size_t> positions;
+    size_t local_count = 2;
+    for (size_t i = 0; i < entrypoints.size(); ++i)
+    {
+      auto maybe_index = m_bundle->find_plan(entrypoints[i]);
+      if (!maybe_index.has_value())
+      {
+        logging::Error() << "Plan not found for entrypoint: "
+                         << entrypoints[i].view();
+        outputs[i] =
+          ErrorSeq << err(Line ^ entrypoints[i], "entrypoint not found");
+        continue;
+      }
+
+      plans.push_back(&m_bundle->plans[*maybe_index]);
+      positions.push_back(i);
+      local_count = std::max(local_count, plans.back()->local_count);
+    }
+
+    // the plans run one after another in the same root frame
+    State state(input, m_bundle->data, local_count, m_bundle->data_tape);
+    run_plans(plans, state, context, [&](size_t index) {
+      outputs[positions[index]] = entrypoint_results(state);
+    });
+    return outputs;
+  }
 
+  Node VirtualMachine::entrypoint_results(const State& state) const
+  {
     if (!state.errors().empty())
     {
       return ErrorSeq << state.errors();
     }
 
-    if (state.result_set().empty())
+    return entrypoint_results(state.result_set());
+  }
+
+  Node VirtualMachine::entrypoint_results(const Nodes& result_set) const
+  {
+    if (result_set.empty())
     {
       return Undefined;
     }
 
-    Node results = NodeDef::create(Results);
-    for (Node result : state.result_set())
+    Nodes values;
+    for (Node result : result_set)
     {
       auto maybe_object = unwrap(result, Object);
       if (!maybe_object.success)
@@ -437,14 +1451,30 @@ namespace rego
         return ErrorSeq << err(result, "Expected a result object");
       }
 
-      Nodes values = Resolver::object_lookdown(maybe_object.node, "\"result\"");
-      if (values.size() != 1)
+      Node value = result_value(maybe_object.node);
+      if (value == nullptr)
       {
         return ErrorSeq << err(
                  maybe_object.node, "No result values in result object");
       }
 
-      results << (Result << (Terms << values.front()) << Bindings);
+      values.push_back(value);
+    }
+
+    if (m_raw_results)
+    {
+      if (values.size() == 1)
+      {
+        return values.front();
+      }
+
+      return Terms << values;
+    }
+
+    Node results = NodeDef::create(Results);
+    for (Node value : values)
+    {
+      results << (Result << (Terms << value) << Bindings);
     }
 
     Node ast = Top << results;
@@ -455,30 +1485,122 @@ namespace rego
     return results;
   }
 
-  void VirtualMachine::run_plan(const b::Plan& plan, State& state) const
+  void VirtualMachine::run_plan(
+    const b::Plan& plan, State& state, EvalContext* context) const
+  {
+    run_plans({&plan}, state, context, [](size_t) {});
+  }
+
+  void VirtualMachine::run_plans(
+    const std::vector<const b::Plan*>& plans,
+    State& state,
+    EvalContext* context,
+    const std::function<void(size_t)>& done) const
   {
     WFContext ctx({&wf_bundle, &wf_result});
     m_builtins->clear();
 
-    for (b::Block block : plan.blocks)
+    auto limits = std::make_shared<EvalLimits>();
+    limits->max_statements = m_statement_limit;
+    if (m_time_limit.count() > 0)
+    {
+      limits->deadline = std::chrono::steady_clock::now() + m_time_limit;
+    }
+    limits->cancelled = context == nullptr ? nullptr : &context->cancelled;
+    limits->cancel_epoch = &m_cancel_epoch;
+    limits->epoch = m_cancel_epoch;
+    limits->statements = 0;
+    state.limit(limits);
+    EvalLimitsScope scope(limits.get());
+    PrintOutputScope print_scope(&state.print_output());
+    DataIndexScope index_scope(m_bundle->data, m_bundle->data_indexes.get());
+
+    if (m_trace_capacity > 0)
+    {
+      auto trace = std::make_shared<Trace>();
+      trace->capacity = m_trace_capacity;
+      trace->entries.reserve(m_trace_capacity);
+      trace->total = 0;
+      trace->start = std::chrono::steady_clock::now();
+      state.trace(trace);
+    }
+
+    bool interrupted = false;
+    for (size_t i = 0; i < plans.size(); ++i)
     {
-      if (run_block(state, block) != Code::Continue)
+      const b::Plan& plan = *plans[i];
+      if (i > 0)
       {
-        break;
+        state.next_plan();
+      }
+
+      if (interrupted)
+      {
+        // the limits which stopped the previous plan apply to this one too
+        state.add_error(
+          err(Line ^ plan.name, "evaluation interrupted", EvalCancelError));
+        done(i);
+        continue;
+      }
+
+      try
+      {
+        if (i == 0)
+        {
+          // picks up a cancellation of the context requested before the
+          // evaluation started
+          limits->check();
+        }
+
+        for (const b::Block& block : plan.blocks)
+        {
+          if (run_block(state, block) != Code::Continue)
+          {
+            break;
+          }
+        }
       }
+      catch (const EvalInterrupted& e)
+      {
+        logging::Debug() << "Evaluation interrupted: " << e.what();
+        state.add_error(err(Line ^ plan.name, e.what(), EvalCancelError));
+        interrupted = true;
+      }
+      catch (...)
+      {
+        // the trace of a failed evaluation is the most useful of all
+        publish_trace(state);
+        throw;
+      }
+
+      done(i);
+    }
+
+    state.flush_statements();
+    if (context != nullptr)
+    {
+      context->statement_count = limits->statements;
+      context->print_output = std::move(state.print_output());
     }
+
+    publish_trace(state);
   }
 
   VirtualMachine::Code VirtualMachine::run_block(
     State& state, const b::Block& block) const
   {
     Code code = Code::Continue;
-    logging::Debug() << BlockIndent();
+    VM_LOG(Debug) << BlockIndent();
     {
+#ifndef REGOCPP_STRIP_VM_LOGGING
       logging::LocalIndent indent;
+#endif
+      bool traced = state.trace() != nullptr;
       for (size_t i = 0; i < block.size(); ++i)
       {
-        code = run_stmt(state, i, block[i]);
+        state.step();
+        code = traced ? run_traced(state, i, block[i]) :
+                        run_stmt(state, i, block[i]);
         switch (code)
         {
           case Code::Continue:
@@ -503,7 +1625,26 @@ namespace rego
         break;
       }
     }
-    logging::Debug() << BlockUndent();
+    VM_LOG(Debug) << BlockUndent();
+    return code;
+  }
+
+  VirtualMachine::Code VirtualMachine::run_traced(
+    State& state, size_t index, const b::Statement& stmt) const
+  {
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    Code code = run_stmt(state, index, stmt);
+    auto end = steady_clock::now();
+
+    Trace* trace = state.trace();
+    TraceEntry entry;
+    entry.statement = stmt.id;
+    entry.type = stmt.type;
+    entry.code = code;
+    entry.start_ns = duration_cast<nanoseconds>(start - trace->start).count();
+    entry.end_ns = duration_cast<nanoseconds>(end - trace->start).count();
+    trace->record(entry);
     return code;
   }
 
@@ -520,6 +1661,61 @@ namespace rego
         std::string(state.root_function_name()));
     }
 
+    if (
+      func.view() == "internal.walk_paths" ||
+      func.view() == "internal.walk_values")
+    {
+      // these are only emitted by the compiler as the source of a scan, so
+      // instead of materialising the walk we hand the scan an iterator.
+      Node root = unpack_operand(state, args[0]);
+      if (root == Undefined)
+      {
+        state.write_local(target, root);
+        return Code::Continue;
+      }
+
+      bool with_paths = func.view() == "internal.walk_paths";
+      state.write_local(target, state.push_walk(root, with_paths));
+      return Code::Continue;
+    }
+
+    if (
+      (func.view() == "numbers.range" || func.view() == "numbers.range_step") &&
+      m_builtins->is_builtin(func))
+    {
+      Nodes arg_values;
+      for (auto& arg : args)
+      {
+        arg_values.push_back(unpack_operand(state, arg));
+      }
+
+      Node range =
+        make_range(arg_values, func.view() == "numbers.range_step");
+      if (range != nullptr)
+      {
+        state.write_local(target, range);
+        return Code::Continue;
+      }
+    }
+
+    if (func.view() == "count" && args.size() == 1)
+    {
+      Node source = unpack_lazy_operand(state, args[0]);
+      if (source == RangeValue)
+      {
+        Node len = Int ^ std::to_string(read_range(source).count);
+        state.write_local(target, len);
+        return Code::Continue;
+      }
+
+      if (source == TapeValue)
+      {
+        Node len = Int ^ std::to_string(m_bundle->data_tape->size(source));
+        state.write_local(target, len);
+        return Code::Continue;
+      }
+    }
+
     if (m_builtins->is_builtin(func))
     {
       Nodes arg_values;
@@ -527,7 +1723,7 @@ namespace rego
         args.begin(),
         args.end(),
         std::back_inserter(arg_values),
-        [this, state](const b::Operand& arg) {
+        [this, &state](const b::Operand& arg) {
           return unpack_operand(state, arg);
         });
 
@@ -562,12 +1758,36 @@ namespace rego
       return Code::Continue;
     }
 
+    // results of data-only functions are shared between evaluations, but only
+    // while the data document has not been replaced by a With statement
+    bool shared =
+      function.data_only && !state.in_with() && results_shareable(function);
+    if (shared)
+    {
+      Node holder = m_bundle->result_cache->find(function.name, m_bundle->data);
+      if (holder != nullptr)
+      {
+        // the result is read in place, not copied (see bundle::ResultCache)
+        state.hold(holder);
+        state.write_local(target, holder->front());
+        return Code::Continue;
+      }
+    }
+
+    // the arguments are read from the caller's frame and then written into
+    // a fresh frame for the callee
+    Nodes arg_values;
     for (size_t i = 2; i < function.parameters.size(); ++i)
     {
-      state.write_local(function.parameters[i], unpack_operand(state, args[i]));
+      arg_values.push_back(unpack_view_operand(state, args[i]));
     }
 
     state.push_function(func, function.arity);
+    state.push_frame(function.local_count);
+    for (size_t i = 2; i < function.parameters.size(); ++i)
+    {
+      state.write_local(function.parameters[i], arg_values[i - 2]);
+    }
 
     Code code;
 
@@ -591,17 +1811,28 @@ namespace rego
       }
     }
 
+    Node value;
+    if (code == Code::Return)
+    {
+      value = state.read_local(function.result);
+    }
+
+    state.pop_frame();
     state.pop_function(func);
 
     if (code == Code::Return)
     {
-      Node value = state.read_local(function.result);
       state.write_local(target, value);
       if (function.cacheable && !state.in_with())
       {
         state.put_function_result(function.name, value);
       }
 
+      if (shared && value != Error)
+      {
+        m_bundle->result_cache->insert(function.name, m_bundle->data, value);
+      }
+
       if (value == Error)
       {
         state.add_error(value);
@@ -622,7 +1853,7 @@ namespace rego
   VirtualMachine::Code VirtualMachine::run_stmt(
     State& state, size_t index, const b::Statement& stmt) const
   {
-    logging::Debug() << DebugIdx(index) << stmt;
+    VM_LOG(Debug) << DebugIdx(index) << stmt;
     switch (stmt.type)
     {
       case b::StatementType::MakeObject:
@@ -638,12 +1869,12 @@ namespace rego
         break;
 
       case b::StatementType::MakeNull:
-        state.write_local(stmt.target, NodeDef::create(Null));
+        state.write_local(stmt.target, m_bundle->null_value);
         break;
 
       case b::StatementType::MakeNumberRef: {
         const Location& num_value = m_bundle->strings[stmt.op0.index];
-        if (RE2::FullMatch(num_value.view(), m_int_regex))
+        if (scan_int(num_value.view(), false))
         {
           state.write_local(stmt.target, Int ^ num_value);
         }
@@ -681,32 +1912,48 @@ namespace rego
         break;
 
       case b::StatementType::Len: {
-        Node source = unpack_operand(state, stmt.op0);
-        Node len = Int ^ std::to_string(source->size());
+        Node source = unpack_lazy_operand(state, stmt.op0);
+        size_t size = source->size();
+        if (source == RangeValue)
+        {
+          size = read_range(source).count;
+        }
+        else if (source == TapeValue)
+        {
+          size = m_bundle->data_tape->size(source);
+        }
+        Node len = Int ^ std::to_string(size);
         state.write_local(stmt.target, Term << (Scalar << len));
       }
       break;
 
-      case b::StatementType::IsObject:
-        if (unpack_operand(state, stmt.op0) != Object)
+      case b::StatementType::IsObject: {
+        Node source = unpack_lazy_operand(state, stmt.op0);
+        if (value_type(m_bundle, source) != Object)
         {
           return Code::Undefined;
         }
-        break;
+      }
+      break;
 
-      case b::StatementType::IsArray:
-        if (unpack_operand(state, stmt.op0) != Array)
+      case b::StatementType::IsArray: {
+        Node source = unpack_lazy_operand(state, stmt.op0);
+        Token type = value_type(m_bundle, source);
+        if (type != Array && type != RangeValue)
         {
           return Code::Undefined;
         }
-        break;
+      }
+      break;
 
-      case b::StatementType::IsSet:
-        if (unpack_operand(state, stmt.op0) != Set)
+      case b::StatementType::IsSet: {
+        Node source = unpack_lazy_operand(state, stmt.op0);
+        if (value_type(m_bundle, source) != Set)
         {
           return Code::Undefined;
         }
-        break;
+      }
+      break;
 
       case b::StatementType::ResetLocal:
         state.reset_local(stmt.target);
@@ -754,10 +2001,10 @@ namespace rego
       case b::StatementType::Not:
         if (run_block(state, stmt.ext->block()) != Code::Undefined)
         {
-          logging::Debug() << DebugIdx(index) << "NotStmt() -> Undefined";
+          VM_LOG(Debug) << DebugIdx(index) << "NotStmt() -> Undefined";
           return Code::Undefined;
         }
-        logging::Debug() << DebugIdx(index) << "NotStmt() -> Continue";
+        VM_LOG(Debug) << DebugIdx(index) << "NotStmt() -> Continue";
         break;
 
       case b::StatementType::ReturnLocal:
@@ -769,7 +2016,11 @@ namespace rego
         Node object = state.read_local(stmt.target);
         if (object != nullptr)
         {
-          if (insert_into_object(object, key, value, false))
+          if (state.is_collector(stmt.target))
+          {
+            state.add_effect(stmt, key, value);
+          }
+          else if (insert_into_object(object, key, value, false))
           {
             state.add_error_object_insert(Line ^ stmt.location);
             return Code::Error;
@@ -784,7 +2035,11 @@ namespace rego
         Node object = state.read_local(stmt.target);
         if (object != nullptr)
         {
-          if (insert_into_object(object, key, value, true))
+          if (state.is_collector(stmt.target))
+          {
+            state.add_effect(stmt, key, value);
+          }
+          else if (insert_into_object(object, key, value, true))
           {
             state.add_error_object_insert(Line ^ stmt.location);
             return Code::Error;
@@ -811,7 +2066,14 @@ namespace rego
             return Code::Undefined;
           }
 
-          array << to_term(value);
+          if (state.is_collector(stmt.target))
+          {
+            state.add_effect(stmt, nullptr, value);
+          }
+          else
+          {
+            array << to_term(value);
+          }
         }
       }
       break;
@@ -826,6 +2088,12 @@ namespace rego
             return Code::Undefined;
           }
 
+          if (state.is_collector(stmt.target))
+          {
+            state.add_effect(stmt, nullptr, value);
+            break;
+          }
+
           // TODO need a better intermediate representation for sets
           std::set<std::string> members;
           std::transform(
@@ -842,14 +2110,28 @@ namespace rego
       break;
 
       case b::StatementType::Dot: {
-        Node source = unpack_operand(state, stmt.op0);
+        if (stmt.ext != nullptr && !state.in_with())
+        {
+          // a constant path into the base data document, resolved when the
+          // bundle was optimized
+          const Node& resolved = stmt.ext->data_ref().value;
+          if (resolved == nullptr)
+          {
+            return Code::Undefined;
+          }
+
+          state.write_local(stmt.target, resolved);
+          break;
+        }
+
+        Node source = unpack_lazy_operand(state, stmt.op0);
         Node key = unpack_operand(state, stmt.op1);
         Node value = dot(source, key);
         if (value == nullptr)
         {
-          logging::Warn() << "Dot operation returned null for source: "
-                          << source->location().view()
-                          << ", key: " << key->location().view();
+          VM_LOG(Warn) << "Dot operation returned null for source: "
+                       << source->location().view()
+                       << ", key: " << key->location().view();
           return Code::Undefined;
         }
 
@@ -858,14 +2140,21 @@ namespace rego
       break;
 
       case b::StatementType::AssignVar:
-        state.write_local(stmt.target, unpack_operand(state, stmt.op0));
+        state.write_local(stmt.target, unpack_view_operand(state, stmt.op0));
         break;
 
       case b::StatementType::ResultSetAdd: {
         Node value = state.read_local(stmt.target);
         if (value != nullptr)
         {
-          state.add_result(value);
+          if (state.is_worker())
+          {
+            state.add_effect(stmt, nullptr, value);
+          }
+          else
+          {
+            state.add_result(value);
+          }
         }
       }
       break;
@@ -873,7 +2162,12 @@ namespace rego
       case b::StatementType::Equal: {
         Node a = unpack_operand(state, stmt.op0);
         Node b = unpack_operand(state, stmt.op1);
-        Node result = Resolver::boolinfix(NodeDef::create(Equals), a, b);
+        if (same_constant(a, b))
+        {
+          break;
+        }
+
+        Node result = Resolver::boolinfix(equals_op(), a, b);
         if (result == False)
         {
           return Code::Undefined;
@@ -888,7 +2182,11 @@ namespace rego
         {
           return Code::Undefined;
         }
-        Node result = Resolver::boolinfix(NodeDef::create(Equals), a, b);
+        if (same_constant(a, b))
+        {
+          return Code::Undefined;
+        }
+        Node result = Resolver::boolinfix(equals_op(), a, b);
         if (result == True)
         {
           return Code::Undefined;
@@ -916,7 +2214,7 @@ namespace rego
           if (m_bundle->is_function(path_buf.str()))
           {
             func = path_buf.str();
-            logging::Trace() << "dynamic path: " << func.view();
+            VM_LOG(Trace) << "dynamic path: " << func.view();
             valid_index = i;
           }
         }
@@ -975,8 +2273,80 @@ namespace rego
     return result;
   }
 
-  Node VirtualMachine::dot(const Node& node, const Node& key) const
-  {
+  Node VirtualMachine::dot(const Node& node, const Node& key) const
+  {
+    if (node == RangeValue)
+    {
+      LazyRange range = read_range(node);
+      auto maybe_index = unwrap(key, {Int, Float});
+      if (!maybe_index.success)
+      {
+        VM_LOG(Trace) << "Invalid index for range dot operation: " << key;
+        return nullptr;
+      }
+
+      try
+      {
+        std::size_t index = to_size(maybe_index.node);
+        if (index < range.count)
+        {
+          return range_at(range, index);
+        }
+
+        VM_LOG(Trace) << "Index out of bounds for range dot operation: "
+                      << index;
+        return nullptr;
+      }
+      catch (std::invalid_argument&)
+      {
+        VM_LOG(Trace) << "Invalid index for range dot operation: "
+                      << key->location().view();
+        return nullptr;
+      }
+    }
+
+    if (node == TapeValue)
+    {
+      const DataTape& tape = *m_bundle->data_tape;
+      Token type = tape.type(node);
+      if (type == Object)
+      {
+        return tape.find(node, key);
+      }
+
+      if (type == Array)
+      {
+        auto maybe_index = unwrap(key, {Int, Float});
+        if (!maybe_index.success)
+        {
+          VM_LOG(Trace) << "Invalid index for array dot operation: " << key;
+          return nullptr;
+        }
+
+        try
+        {
+          std::uint32_t index = to_uint32(maybe_index.node);
+          if (index < tape.size(node))
+          {
+            return tape.at(node, index);
+          }
+
+          VM_LOG(Trace) << "Index out of bounds for array dot operation: "
+                        << index;
+          return nullptr;
+        }
+        catch (std::invalid_argument&)
+        {
+          VM_LOG(Trace) << "Invalid index for array dot operation: "
+                        << key->location().view();
+          return nullptr;
+        }
+      }
+
+      // sets cannot be written in JSON, so this is not worth a fast path
+      return dot(tape.materialize(node), key);
+    }
+
     auto maybe_source = unwrap(node, {Object, Array, Set});
     if (!maybe_source.success)
     {
@@ -1019,7 +2389,7 @@ namespace rego
       auto maybe_index = unwrap(key, {Int, Float});
       if (!maybe_index.success)
       {
-        logging::Trace() << "Invalid index for array dot operation: " << key;
+        VM_LOG(Trace) << "Invalid index for array dot operation: " << key;
         return nullptr;
       }
 
@@ -1031,14 +2401,14 @@ namespace rego
           return source->at(index);
         }
 
-        logging::Trace() << "Index out of bounds for array dot operation: "
-                         << index;
+        VM_LOG(Trace) << "Index out of bounds for array dot operation: "
+                      << index;
         return nullptr;
       }
       catch (std::invalid_argument&)
       {
-        logging::Trace() << "Invalid index for array dot operation: "
-                         << key->location().view();
+        VM_LOG(Trace) << "Invalid index for array dot operation: "
+                      << key->location().view();
         return nullptr;
       }
     }
@@ -1053,7 +2423,52 @@ namespace rego
   VirtualMachine::Code VirtualMachine::run_scan(
     State& state, const b::Statement& stmt) const
   {
-    Node source = state.read_local(stmt.target);
+    Node source = state.peek_local(stmt.target);
+    if (source == TapeValue)
+    {
+      // one level of the container is built for the scan, with views in
+      // place of the containers inside it
+      source = m_bundle->data_tape->expand(source);
+    }
+
+    if (source == WalkIterator)
+    {
+      auto maybe_walk = state.pop_walk(source);
+      if (!maybe_walk.has_value())
+      {
+        logging::Error() << "Walk iterator has already been consumed";
+        throw std::runtime_error("Invalid walk iterator");
+      }
+
+      return run_walk(state, stmt, maybe_walk.value());
+    }
+
+    if (
+      stmt.ext->independent && m_scan_workers > 1 && !state.is_worker() &&
+      scan_size(source) >= ParallelScanThreshold && scan_pure(stmt))
+    {
+      return run_parallel_scan(state, stmt, source);
+    }
+
+    if (source == RangeValue)
+    {
+      LazyRange range = read_range(source);
+      for (size_t i = 0; i < range.count; ++i)
+      {
+        VM_LOG(Trace) << "ScanStmt(range=" << i << ")";
+        state.write_local(
+          stmt.op0.index, Term << (Scalar << (Int ^ std::to_string(i))));
+        state.write_local(stmt.op1.index, range_at(range, i));
+        Code code = run_block(state, stmt.ext->block());
+        if (code == Code::Error)
+        {
+          return code;
+        }
+      }
+
+      return Code::Continue;
+    }
+
     if (source->in({Int, Float, JSONString, True, False, Null}))
     {
       // non-iterable domain
@@ -1063,7 +2478,7 @@ namespace rego
 
     for (size_t i = 0; i < source->size(); ++i)
     {
-      logging::Trace() << "ScanStmt(index=" << i << ")";
+      VM_LOG(Trace) << "ScanStmt(index=" << i << ")";
       if (source == Object)
       {
         Node item = source->at(i);
@@ -1098,10 +2513,464 @@ namespace rego
     return Code::Continue;
   }
 
+  VirtualMachine::Code VirtualMachine::run_parallel_scan(
+    State& state, const b::Statement& stmt, const Node& source) const
+  {
+    std::optional<LazyRange> range;
+    size_t size = source->size();
+    if (source == RangeValue)
+    {
+      range = read_range(source);
+      size = range->count;
+    }
+
+    // the pool is held for the whole scan, in case scan_workers replaces it
+    std::shared_ptr<WorkerPool> pool = worker_pool();
+    size_t num_chunks =
+      (size + ParallelScanChunkSize - 1) / ParallelScanChunkSize;
+    size_t num_workers = std::min(pool->size() + 1, num_chunks);
+    std::vector<std::vector<State::Effect>> chunks(num_chunks);
+    std::vector<std::exception_ptr> failures(num_workers);
+    std::atomic<size_t> next_chunk = 0;
+    std::atomic<bool> stopped = false;
+
+    auto bind = [&](State& worker, size_t i) {
+      if (range.has_value())
+      {
+        worker.write_local(
+          stmt.op0.index, Term << (Scalar << (Int ^ std::to_string(i))));
+        worker.write_local(stmt.op1.index, range_at(*range, i));
+      }
+      else if (source == Object)
+      {
+        Node item = source->at(i);
+        worker.write_local(stmt.op0.index, item / Key);
+        worker.write_local(stmt.op1.index, item / Val);
+      }
+      else if (source == Array)
+      {
+        worker.write_local(
+          stmt.op0.index, Term << (Scalar << (Int ^ std::to_string(i))));
+        worker.write_local(stmt.op1.index, source->at(i));
+      }
+      else
+      {
+        worker.write_local(stmt.op0.index, source->at(i));
+        worker.write_local(stmt.op1.index, source->at(i));
+      }
+    };
+
+    // Each worker evaluates its iterations against a private copy of the
+    // state, and records (rather than makes) any change to the collectors or
+    // to the result set. Chunks are claimed in order, so when an iteration
+    // fails every chunk before it has already been claimed and will be
+    // finished, and the effects can be applied as though the scan were
+    // serial.
+    auto work = [&](size_t id) {
+      State worker = state.fork(stmt.ext->collectors);
+      try
+      {
+        while (!stopped)
+        {
+          size_t chunk = next_chunk++;
+          if (chunk >= num_chunks)
+          {
+            break;
+          }
+
+          size_t end = std::min(size, (chunk + 1) * ParallelScanChunkSize);
+          for (size_t i = chunk * ParallelScanChunkSize; i < end; ++i)
+          {
+            bind(worker, i);
+            Code code = run_block(worker, stmt.ext->block());
+            worker.end_iteration(code);
+            if (code == Code::Error)
+            {
+              stopped = true;
+              break;
+            }
+          }
+
+          chunks[chunk] = worker.take_effects();
+        }
+      }
+      catch (...)
+      {
+        failures[id] = std::current_exception();
+        stopped = true;
+      }
+
+      worker.flush_statements();
+    };
+
+    logging::Debug() << "ScanStmt(parallel=" << size << ", workers="
+                     << num_workers << ")";
+    state.seal();
+    pool->run(num_workers, [this, &work, &state](size_t id) {
+      if (id == 0)
+      {
+        work(id);
+        return;
+      }
+
+      auto log_level = logging::local_log_level<logging::None>();
+      EvalLimitsScope limits(state.limits());
+      DataIndexScope indexes(m_bundle->data, m_bundle->data_indexes.get());
+      work(id);
+    });
+
+    for (const std::exception_ptr& failure : failures)
+    {
+      if (failure != nullptr)
+      {
+        std::rethrow_exception(failure);
+      }
+    }
+
+    std::map<size_t, std::set<std::string>> set_members;
+    for (const std::vector<State::Effect>& effects : chunks)
+    {
+      for (const State::Effect& effect : effects)
+      {
+        Code code = apply_effect(state, effect, set_members);
+        if (code == Code::Error)
+        {
+          return code;
+        }
+      }
+    }
+
+    return Code::Continue;
+  }
+
+  VirtualMachine::Code VirtualMachine::apply_effect(
+    State& state,
+    const State::Effect& effect,
+    std::map<size_t, std::set<std::string>>& set_members) const
+  {
+    if (effect.stmt == nullptr)
+    {
+      for (const Node& error : effect.errors)
+      {
+        state.add_error(error);
+      }
+
+      return effect.code;
+    }
+
+    const b::Statement& stmt = *effect.stmt;
+    switch (stmt.type)
+    {
+      case b::StatementType::ArrayAppend: {
+        Node array = state.read_local(stmt.target);
+        array << to_term(effect.value);
+      }
+      break;
+
+      case b::StatementType::SetAdd: {
+        Node set = state.read_local(stmt.target);
+        auto [it, inserted] = set_members.try_emplace(stmt.target);
+        if (inserted)
+        {
+          std::transform(
+            set->begin(),
+            set->end(),
+            std::inserter(it->second, it->second.end()),
+            [](const Node& item) { return to_key(item); });
+        }
+
+        if (it->second.insert(to_key(effect.value)).second)
+        {
+          set << to_term(effect.value);
+        }
+      }
+      break;
+
+      case b::StatementType::ObjectInsert:
+      case b::StatementType::ObjectInsertOnce: {
+        Node object = state.read_local(stmt.target);
+        bool once = stmt.type == b::StatementType::ObjectInsertOnce;
+        if (insert_into_object(object, effect.key, effect.value, once))
+        {
+          state.add_error_object_insert(Line ^ stmt.location);
+          return Code::Error;
+        }
+      }
+      break;
+
+      case b::StatementType::ResultSetAdd:
+        state.add_result(effect.value);
+        break;
+
+      default:
+        throw std::runtime_error("Invalid scan effect");
+    }
+
+    return Code::Continue;
+  }
+
+  bool VirtualMachine::scan_pure(const b::Statement& stmt) const
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_decisions_mutex);
+      auto it = m_scans_pure.find(&stmt);
+      if (it != m_scans_pure.end())
+      {
+        return it->second;
+      }
+    }
+
+    std::set<std::string> visited;
+    bool pure = calls_are_pure(stmt.ext->block(), visited);
+    std::lock_guard<std::mutex> lock(m_decisions_mutex);
+    m_scans_pure[&stmt] = pure;
+    return pure;
+  }
+
+  std::shared_ptr<WorkerPool> VirtualMachine::worker_pool() const
+  {
+    std::lock_guard<std::mutex> lock(m_pool_mutex);
+    if (m_pool == nullptr)
+    {
+      // the thread running the scan is the first of its workers
+      m_pool = std::make_shared<WorkerPool>(m_scan_workers - 1);
+    }
+
+    return m_pool;
+  }
+
+  bool VirtualMachine::results_shareable(const b::Function& function) const
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_decisions_mutex);
+      auto it = m_results_shareable.find(function.name);
+      if (it != m_results_shareable.end())
+      {
+        return it->second;
+      }
+    }
+
+    // whether a built-in is pure depends on this VM's built-ins, which
+    // another VM sharing the bundle (and so the cache) may not have, so this
+    // is checked here rather than by the optimizer
+    bool shareable = true;
+    std::set<std::string> visited;
+    for (const b::Block& block : function.blocks)
+    {
+      if (!calls_are_pure(block, visited))
+      {
+        shareable = false;
+        break;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(m_decisions_mutex);
+    m_results_shareable[function.name] = shareable;
+    return shareable;
+  }
+
+  bool VirtualMachine::decisions_cacheable(
+    const b::Plan& plan, const b::DecisionCache& cache) const
+  {
+    // a decision which reads the clock may be reused for as long as the
+    // cache allows results to live
+    bool allow_clock = cache.ttl().count() > 0;
+    auto key = std::make_pair(plan.name, allow_clock);
+    {
+      std::lock_guard<std::mutex> lock(m_decisions_mutex);
+      auto it = m_decisions_cacheable.find(key);
+      if (it != m_decisions_cacheable.end())
+      {
+        return it->second;
+      }
+    }
+
+    // purity depends on this VM's built-ins, which another VM sharing the
+    // bundle (and so the cache) may not have
+    bool cacheable = true;
+    std::set<std::string> visited;
+    for (const b::Block& block : plan.blocks)
+    {
+      if (!calls_are_pure(block, visited, allow_clock))
+      {
+        cacheable = false;
+        break;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(m_decisions_mutex);
+    m_decisions_cacheable[key] = cacheable;
+    return cacheable;
+  }
+
+  bool VirtualMachine::calls_are_pure(
+    const b::Block& block,
+    std::set<std::string>& visited,
+    bool allow_clock) const
+  {
+    for (const b::Statement& stmt : block)
+    {
+      switch (stmt.type)
+      {
+        case b::StatementType::Call: {
+          const Location& func = stmt.ext->call().func;
+          if (m_builtins->is_builtin(func))
+          {
+            if (
+              !m_builtins->at(func)->pure &&
+              !(allow_clock && func.view() == "time.now_ns"))
+            {
+              return false;
+            }
+            break;
+          }
+
+          if (!visited.insert(std::string(func.view())).second)
+          {
+            break;
+          }
+
+          auto maybe_index = m_bundle->find_function(func);
+          if (!maybe_index.has_value())
+          {
+            return false;
+          }
+
+          const b::Function& function = m_bundle->functions[*maybe_index];
+          for (const b::Block& body : function.blocks)
+          {
+            if (!calls_are_pure(body, visited, allow_clock))
+            {
+              return false;
+            }
+          }
+        }
+        break;
+
+        case b::StatementType::CallDynamic:
+          return false;
+
+        case b::StatementType::Block:
+          for (const b::Block& nested : stmt.ext->blocks())
+          {
+            if (!calls_are_pure(nested, visited, allow_clock))
+            {
+              return false;
+            }
+          }
+          break;
+
+        case b::StatementType::Not:
+        case b::StatementType::Scan:
+          if (!calls_are_pure(stmt.ext->block(), visited, allow_clock))
+          {
+            return false;
+          }
+          break;
+
+        case b::StatementType::With:
+          if (!calls_are_pure(
+                stmt.ext->with().block, visited, allow_clock))
+          {
+            return false;
+          }
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    return true;
+  }
+
+  VirtualMachine::Code VirtualMachine::run_walk(
+    State& state, const b::Statement& stmt, const State::Walk& walk) const
+  {
+    // Visits the nodes in the same breadth-first order as the `walk` builtin,
+    // but binds the values in place rather than cloning them into pairs. Each
+    // step only records how it was reached, so that a path is assembled when
+    // (and only if) the scan binds it.
+    struct Step
+    {
+      size_t parent;
+      size_t index;
+      Node key;
+      Node value;
+    };
+
+    std::vector<Step> steps;
+    steps.push_back({0, 0, nullptr, walk.root});
+    for (size_t i = 0; i < steps.size(); ++i)
+    {
+      VM_LOG(Trace) << "ScanStmt(walk=" << i << ")";
+      Node current = steps[i].value;
+      if (walk.with_paths)
+      {
+        Nodes path_nodes;
+        for (size_t j = i; j != 0; j = steps[j].parent)
+        {
+          if (steps[j].key == nullptr)
+          {
+            path_nodes.push_back(Resolver::term(BigInt(steps[j].index)));
+          }
+          else
+          {
+            path_nodes.push_back(Resolver::to_term(steps[j].key));
+          }
+        }
+
+        Node path = NodeDef::create(Array);
+        for (auto it = path_nodes.rbegin(); it != path_nodes.rend(); ++it)
+        {
+          path->push_back(*it);
+        }
+
+        state.write_local(stmt.op0.index, path);
+      }
+
+      state.write_local(stmt.op1.index, current);
+
+      Code code = run_block(state, stmt.ext->block());
+      if (code == Code::Error)
+      {
+        return code;
+      }
+
+      auto maybe_node = unwrap(current, {Array, Set, Object});
+      if (!maybe_node.success)
+      {
+        continue;
+      }
+
+      Node collection = maybe_node.node;
+      for (size_t j = 0; j < collection->size(); ++j)
+      {
+        Node child = collection->at(j);
+        if (collection == Array)
+        {
+          steps.push_back({i, j, nullptr, child});
+        }
+        else if (collection == Set)
+        {
+          steps.push_back({i, j, child, child});
+        }
+        else
+        {
+          steps.push_back({i, j, child / Key, child / Val});
+        }
+      }
+    }
+
+    return Code::Continue;
+  }
+
   Node VirtualMachine::write_and_swap(
     State& state, size_t key, const std::vector<size_t>& path, Node value) const
   {
-    Node old_source = state.read_local(key);
+    // the old value is restored as it was, so that a view of the compact
+    // data document is not replaced by a copy of the whole document
+    Node old_source = state.peek_local(key);
 
     if (path.size() == 0)
     {
@@ -1116,7 +2985,13 @@ namespace rego
     }
     else
     {
-      source = old_source->clone();
+      source = state.materialize(old_source);
+      if (source == old_source || old_source == TapeValue)
+      {
+        // a container built from the compact data document is kept by the
+        // evaluation (see State::materialize)
+        source = source->clone();
+      }
     }
 
     Node current = source;
@@ -1310,6 +3185,10 @@ namespace rego
 
   Node VirtualMachine::to_term(const Node& value) const
   {
+    // values which are not yet part of a tree are adopted rather than copied.
+    // A node has a single parent, so one which already belongs to a tree (an
+    // element of another collection, the data document) is still copied in
+    // full: collections cannot share subtrees (see adopt)
     if (value == Error)
     {
       return value;
@@ -1317,17 +3196,17 @@ namespace rego
 
     if (value->in({Term}))
     {
-      return value->clone();
+      return adopt(value);
     }
 
     if (value->in({Array, Set, Object, Scalar}))
     {
-      return Term << value->clone();
+      return Term << adopt(value);
     }
 
     if (value->in({Int, Float, JSONString, True, False, Null}))
     {
-      return Term << (Scalar << value->clone());
+      return Term << (Scalar << adopt(value));
     }
 
     return err(value, "Not a term");
@@ -1,6 +1,7 @@
 #include <rego/rego_c.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 const char* OBJECTS = R"(package objects
 
@@ -91,9 +92,12 @@ int main()
   regoInput* input = NULL;
   regoInterpreter* rego = regoNew();
   regoSize size = 0;
+  regoInt value = 0;
   char* buf = NULL;
   const char* bundle_dir = "c_api_bundle";
   const char* bundle_path = "c_api.rbb";
+  const char* entrypoints[] = {"objects/sites", "objects/e"};
+  regoOutput* outputs[2] = {NULL, NULL};
 
   regoSetDebugEnabled(rego, true);
   regoSetDebugPath(rego, "test");
@@ -158,6 +162,12 @@ int main()
   free(buf);
   buf = NULL;
 
+  if (regoOutputBindingAtIndex(output, regoOutputSize(output), "x") != NULL)
+  {
+    printf("Expected no binding past the last result\n");
+    goto error;
+  }
+
   node = regoNodeGet(node, 1); // index
   if (node == NULL)
   {
@@ -184,7 +194,94 @@ int main()
   regoFreeOutput(output);
   output = NULL;
 
-  goto exit;
+  err = regoSetPrintMode(rego, REGO_PRINT_BUFFER);
+  if (err != REGO_OK)
+  {
+    goto error;
+  }
+
+  output = regoQuery(rego, "x := data.one.baz; print(x)");
+  if (output == NULL)
+  {
+    goto error;
+  }
+
+  size = regoPrintOutputSize(rego);
+  buf = (char*)malloc(size);
+  err = regoPrintOutput(rego, buf, size);
+  if (err != REGO_OK)
+  {
+    goto error;
+  }
+
+  if (strcmp(buf, "5\n") != 0)
+  {
+    printf("Unexpected print output: `%s`\n", buf);
+    goto error;
+  }
+
+  printf("print output = `%s`\n", buf);
+  free(buf);
+  buf = NULL;
+
+  // the lines stay with the output they were printed by
+  outputs[0] = regoQuery(rego, "print(\"other\")");
+  if (outputs[0] == NULL)
+  {
+    goto error;
+  }
+
+  size = regoOutputPrintSize(output);
+  buf = (char*)malloc(size);
+  err = regoOutputPrint(output, buf, size);
+  if (err != REGO_OK || strcmp(buf, "5\n") != 0)
+  {
+    printf("Expected the print output to stay with its query\n");
+    goto error;
+  }
+
+  free(buf);
+  buf = NULL;
+  regoFreeOutput(outputs[0]);
+  outputs[0] = NULL;
+
+  regoFreeOutput(output);
+  output = NULL;
+  regoSetPrintMode(rego, REGO_PRINT_STDOUT);
+
+  output = regoQuery(rego, "data.one.baz");
+  if (output == NULL)
+  {
+    goto error;
+  }
+
+  err = regoOutputInt(output, &value);
+  if (err != REGO_OK || value != 5)
+  {
+    printf("Expected data.one.baz to be 5\n");
+    goto error;
+  }
+
+  regoFreeOutput(output);
+  output = NULL;
+
+  // a cancel only stops the queries which are running when it is made
+  regoCancel(rego);
+  output = regoQuery(rego, "data.one.baz");
+  if (output == NULL)
+  {
+    goto error;
+  }
+
+  err = regoOutputInt(output, &value);
+  if (err != REGO_OK || value != 5)
+  {
+    printf("Expected a cancel made before the query not to stop it\n");
+    goto error;
+  }
+
+  regoFreeOutput(output);
+  output = NULL;
 
   err = regoSetQuery(rego, "[data.one, input.b, data.objects.sites[1]] = x");
 
@@ -200,6 +297,13 @@ int main()
     goto error;
   }
 
+  err = regoAddEntrypoint(rego, "objects/e");
+
+  if (err != REGO_OK)
+  {
+    goto error;
+  }
+
   bundle = regoBuild(rego);
 
   if (!regoBundleOk(bundle))
@@ -214,6 +318,7 @@ int main()
     goto error;
   }
 
+  regoFreeBundle(bundle);
   bundle = regoBundleLoad(rego, bundle_dir);
 
   if (bundle == NULL || !regoBundleOk(bundle))
@@ -228,6 +333,7 @@ int main()
     goto error;
   }
 
+  regoFreeBundle(bundle);
   bundle = regoBundleLoadBinary(rego, bundle_path);
 
   if (bundle == NULL || !regoBundleOk(bundle))
@@ -270,6 +376,7 @@ int main()
   }
 
   regoFreeOutput(output);
+  output = NULL;
 
   output = regoBundleQueryEntrypoint(rego, bundle, "objects/sites");
   if (output == NULL)
@@ -283,6 +390,65 @@ int main()
     goto error;
   }
 
+  regoFreeOutput(output);
+  output = NULL;
+
+  err = regoBundleQueryEntrypoints(rego, bundle, entrypoints, 2, outputs);
+  if (err != REGO_OK)
+  {
+    goto error;
+  }
+
+  err = print_output("Bundle Query Endpoints[0]", outputs[0]);
+  if (err == REGO_OK)
+  {
+    err = print_output("Bundle Query Endpoints[1]", outputs[1]);
+  }
+
+  regoFreeOutput(outputs[0]);
+  regoFreeOutput(outputs[1]);
+  if (err != REGO_OK)
+  {
+    goto error;
+  }
+
+  regoSetStatementLimit(rego, 100);
+  output = regoQuery(
+    rego, "x := count([y | some y in numbers.range(1, 100000); y % 3 == 0])");
+  if (output == NULL)
+  {
+    goto error;
+  }
+
+  if (regoOutputStatus(output) != REGO_ERROR_EVAL_CANCELLED)
+  {
+    printf("Expected the statement limit to stop the query\n");
+    goto error;
+  }
+
+  if (
+    regoOutputExpressions(output) != NULL ||
+    regoOutputBinding(output, "x") != NULL)
+  {
+    printf("Expected no expressions or bindings on an error output\n");
+    goto error;
+  }
+
+  if (
+    regoOutputStatementCount(output) <= 100 ||
+    regoOutputStatementCount(output) != regoGetStatementCount(rego))
+  {
+    printf("Expected the statement count to come with the output\n");
+    goto error;
+  }
+
+  printf(
+    "Statement limit: stopped after %lld statements\n",
+    (long long)regoOutputStatementCount(output));
+  regoFreeOutput(output);
+  output = NULL;
+  regoSetStatementLimit(rego, 0);
+
   goto exit;
 
 error:
@@ -329,6 +495,11 @@ exit:
     regoFreeBundle(bundle);
   }
 
+  if (input != NULL)
+  {
+    regoFreeInput(input);
+  }
+
   if (rego != NULL)
   {
     regoFree(rego);
@@ -2,6 +2,8 @@
 #include "trieste/logging.h"
 
 #include <CLI/CLI.hpp>
+#include <atomic>
+#include <thread>
 #include <type_traits>
 
 const std::string Green = "\x1b[32m";
@@ -53,6 +55,39 @@ void load_testcase_dir(
   }
 }
 
+// Logs whether one of the tests below passed, which it did if there is no
+// error, and how long it took since it started.
+int report_test(
+  const std::string& note,
+  std::chrono::steady_clock::time_point start,
+  const std::string& error,
+  const std::string& expected = "",
+  const std::string& actual = "")
+{
+  auto end = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed = end - start;
+  if (error.empty())
+  {
+    logging::Output() << Green << "  PASS: " << Reset << note << std::fixed
+                      << std::setw(62 - note.length()) << std::internal
+                      << std::setprecision(3) << elapsed.count() << " sec";
+    return 0;
+  }
+
+  logging::Error err;
+  err << Red << "  FAIL: " << Reset << note << std::fixed
+      << std::setw(62 - note.length()) << std::internal << std::setprecision(3)
+      << elapsed.count() << " sec" << std::endl
+      << "  " << error << std::endl;
+  if (!expected.empty() || !actual.empty())
+  {
+    err << "  Expected: " << expected << std::endl
+        << "  Actual: " << actual << std::endl;
+  }
+
+  return 1;
+}
+
 int manual_construction_test()
 {
   auto input = rego::object({
@@ -71,25 +106,378 @@ int manual_construction_test()
   auto start = std::chrono::steady_clock::now();
   rego.set_input(input);
   std::string actual = rego.query(query);
-  auto end = std::chrono::steady_clock::now();
-  const std::chrono::duration<double> elapsed = end - start;
-  std::string note = "manual construction test";
+  std::string error = actual == expected ? "" : "Result does not match";
+  return report_test(
+    "manual construction test", start, error, expected, actual);
+}
 
-  if (actual == expected)
+// Evaluates one bundle from several threads at once, each with its own
+// interpreter, and checks every result against a single-threaded evaluation.
+// The threads share the bundle (its data, constants and cached rule values),
+// and also split the large comprehension between parallel scan workers, so
+// this is most useful in a build with REGOCPP_SANITIZE=thread.
+int threaded_evaluation_test()
+{
+  const size_t num_threads = 4;
+  const size_t num_runs = 50;
+  const std::string module = R"(package threads
+
+roles := [r | some r, _ in data.roles]
+
+scaled := [x |
+  user := {"name": input.user, "roles": roles}
+  some i in numbers.range(1, 3000)
+  x := [i, user]
+]
+
+perms contains p if {
+  some user in data.users
+  user.name == input.user
+  some p in data.roles[user.role]
+}
+
+result := {
+  "roles": roles,
+  "perms": perms,
+  "sorted": sort(data.roles.admin),
+  "joined": array.concat(data.roles.admin, data.roles.viewer),
+  "reversed": array.reverse(data.roles.viewer),
+  "union": object.union(data.roles, {"guest": []}),
+  "keys": object.keys(data.roles),
+  "names": [u.name | some u in data.users],
+  "users": data.users,
+  "allowed": input.host in data.allowlist,
+  "paths": [p | walk(data.roles, [p, _])],
+  "scaled": [count(scaled), scaled[0], scaled[2999]],
+})";
+  const std::string data = R"({
+    "roles": {"admin": ["write", "read", "delete"], "viewer": ["read"]},
+    "users": [
+      {"name": "alice", "role": "admin"},
+      {"name": "bob", "role": "viewer"}
+    ],
+    "allowlist": ["a.example.com", "b.example.com", "c.example.com"]
+  })";
+  const std::string input = R"({"user": "alice", "host": "b.example.com"})";
+  const std::string entrypoint = "threads/result";
+  std::string note = "threaded evaluation test";
+
+  auto start = std::chrono::steady_clock::now();
+  rego::Interpreter rego;
+  rego.add_module("threads.rego", module);
+  rego.add_data_json(data);
+  rego.entrypoints({entrypoint});
+  rego::Node bundle_node = rego.build();
+  if (bundle_node == rego::ErrorSeq)
   {
-    logging::Output() << Green << "  PASS: " << Reset << note << std::fixed
-                      << std::setw(62 - note.length()) << std::internal
-                      << std::setprecision(3) << elapsed.count() << " sec";
-    return 0;
+    std::ostringstream error;
+    error << "Error when bundling: " << bundle_node;
+    return report_test(note, start, error.str());
   }
 
-  logging::Error() << Red << "  FAIL: " << Reset << note << std::fixed
-                   << std::setw(62 - note.length()) << std::internal
-                   << std::setprecision(3) << elapsed.count() << " sec"
-                   << std::endl
-                   << "  Expected: " << expected << std::endl
-                   << "  Actual: " << actual << std::endl;
-  return 1;
+  rego::Bundle bundle = rego::BundleDef::from_node(bundle_node);
+  auto evaluate = [&](size_t scan_workers) {
+    rego::Interpreter interpreter;
+    interpreter.scan_workers(scan_workers);
+    interpreter.set_input_json(input);
+    return interpreter.output_to_string(
+      interpreter.query_bundle(bundle, entrypoint));
+  };
+
+  std::string expected = evaluate(1);
+  std::vector<std::string> actuals(num_threads);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; ++i)
+  {
+    threads.emplace_back([&, i]() {
+      for (size_t run = 0; run < num_runs; ++run)
+      {
+        std::string actual = evaluate(2);
+        if (actual != expected)
+        {
+          actuals[i] = actual;
+          return;
+        }
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  for (const std::string& actual : actuals)
+  {
+    if (!actual.empty())
+    {
+      return report_test(
+        note, start, "A threaded result differs", expected, actual);
+    }
+  }
+
+  return report_test(note, start, "");
+}
+
+// Saves the execution trace of an evaluation, loads it back and checks that
+// it decodes to the same text as the trace held by the interpreter.
+int trace_round_trip_test()
+{
+  const size_t capacity = 8;
+  const std::string module = R"(package trace
+
+names := [n | some n in ["prod", "smoke", "dev"]; n != "smoke"]
+
+result := {"names": names, "count": count(names)})";
+  const std::string entrypoint = "trace/result";
+  std::string note = "trace round trip test";
+
+  auto start = std::chrono::steady_clock::now();
+  rego::Interpreter rego;
+  rego.add_module("trace.rego", module);
+  rego.entrypoints({entrypoint});
+  rego::Node bundle_node = rego.build();
+  std::string error;
+  std::string expected;
+  std::string actual;
+  if (bundle_node == rego::ErrorSeq)
+  {
+    error = "Error when bundling";
+  }
+  else
+  {
+    rego::Bundle bundle = rego::BundleDef::from_node(bundle_node);
+    rego.trace_capacity(capacity);
+    rego.query_bundle(bundle, entrypoint);
+
+    std::ostringstream printed;
+    rego.print_trace(printed);
+    expected = printed.str();
+
+    std::stringstream saved;
+    rego.save_trace(saved);
+    auto entries = rego::VirtualMachine::load_trace(saved);
+    std::ostringstream decoded;
+    rego::VirtualMachine::print_trace(*bundle, entries, decoded);
+    actual = decoded.str();
+
+    if (entries.size() != capacity)
+    {
+      // the evaluation executes more statements than the trace can hold
+      error = "Expected a full trace of " + std::to_string(capacity) +
+        " entries but got " + std::to_string(entries.size());
+    }
+    else if (expected != actual)
+    {
+      error = "Decoded trace does not match";
+    }
+    else if (actual.find("trace.rego:") == std::string::npos)
+    {
+      error = "Trace has no source locations";
+    }
+  }
+
+  return report_test(note, start, error, expected, actual);
+}
+
+// Exercises the decision cache: hits, misses, eviction, expiry, the bypass
+// for entrypoints which call an impure built-in of the evaluating VM, and
+// use from several threads at once.
+int decision_cache_test()
+{
+  namespace bi = rego::builtins;
+  using namespace std::chrono_literals;
+  using Stats = rego::bundle::DecisionCache::Stats;
+  const std::string module = R"(package decisions
+
+allow if input.user in data.admins
+
+ticked := tick(input.user))";
+  const std::string data = R"({"admins": ["alice", "carol"]})";
+  const std::vector<std::string> users = {"alice", "bob", "carol"};
+  std::string note = "decision cache test";
+
+  std::atomic<size_t> ticks = 0;
+  rego::Node tick_decl =
+    bi::Decl << (bi::ArgSeq
+                 << (bi::Arg << (bi::Name ^ "x") << bi::Description
+                             << (bi::Type << bi::Any)))
+             << (bi::Result << (bi::Name ^ "count") << bi::Description
+                            << (bi::Type << bi::Number));
+  auto make_tick = [&](bool pure) {
+    rego::BuiltIn tick = bi::BuiltInDef::create(
+      rego::Location("tick"), tick_decl, [&](const rego::Nodes&) {
+        return rego::scalar(rego::BigInt(++ticks));
+      });
+    tick->pure = pure;
+    return tick;
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  rego::Interpreter rego;
+  rego.builtins()->register_builtin(make_tick(false));
+  rego.add_module("decisions.rego", module);
+  rego.add_data_json(data);
+  rego.entrypoints({"decisions/allow", "decisions/ticked"});
+  rego::Node bundle_node = rego.build();
+  std::string error;
+  if (bundle_node == rego::ErrorSeq)
+  {
+    error = "Error when bundling";
+  }
+
+  rego::Bundle bundle;
+  if (error.empty())
+  {
+    bundle = rego::BundleDef::from_node(bundle_node);
+    bundle->decision_cache =
+      std::make_shared<rego::bundle::DecisionCache>(2, 0ms, 1);
+  }
+
+  auto evaluate = [&](
+                    rego::Interpreter& interpreter,
+                    const std::string& entrypoint,
+                    const std::string& user) {
+    interpreter.set_input_json(R"({"user": ")" + user + R"("})");
+    return interpreter.output_to_string(
+      interpreter.query_bundle(bundle, entrypoint));
+  };
+
+  auto expect = [&](
+                  const std::string& step,
+                  size_t hits,
+                  size_t misses,
+                  size_t evictions,
+                  size_t size) {
+    if (!error.empty())
+    {
+      return;
+    }
+
+    Stats stats = bundle->decision_cache->stats();
+    if (
+      stats.hits != hits || stats.misses != misses ||
+      stats.evictions != evictions || stats.size != size)
+    {
+      error = step + ": expected " + std::to_string(hits) + " hits, " +
+        std::to_string(misses) + " misses, " + std::to_string(evictions) +
+        " evictions and size " + std::to_string(size) + " but got " +
+        std::to_string(stats.hits) + ", " + std::to_string(stats.misses) +
+        ", " + std::to_string(stats.evictions) + " and " +
+        std::to_string(stats.size);
+    }
+  };
+
+  std::map<std::string, std::string> expected;
+  if (error.empty())
+  {
+    expected["alice"] = evaluate(rego, "decisions/allow", "alice");
+    if (evaluate(rego, "decisions/allow", "alice") != expected["alice"])
+    {
+      error = "A hit gave a different decision";
+    }
+  }
+  expect("hit", 1, 1, 0, 1);
+
+  if (error.empty())
+  {
+    expected["bob"] = evaluate(rego, "decisions/allow", "bob");
+    expected["carol"] = evaluate(rego, "decisions/allow", "carol");
+  }
+  // alice was the least recently used, so bob's result stays
+  expect("eviction", 1, 3, 1, 2);
+  if (error.empty())
+  {
+    evaluate(rego, "decisions/allow", "bob");
+  }
+  expect("after eviction", 2, 3, 1, 2);
+
+  if (error.empty())
+  {
+    // the same entrypoint on the same bundle is cacheable for a VM whose
+    // tick is pure, and must not be for one whose tick is impure
+    rego::Interpreter pure;
+    pure.builtins()->register_builtin(make_tick(true));
+    std::string first = evaluate(pure, "decisions/ticked", "alice");
+    if (evaluate(pure, "decisions/ticked", "alice") != first || ticks != 1)
+    {
+      error = "A pure entrypoint was not cached";
+    }
+  }
+  expect("pure", 3, 4, 2, 2);
+
+  if (error.empty())
+  {
+    rego::Interpreter impure;
+    impure.builtins()->register_builtin(make_tick(false));
+    std::string first = evaluate(impure, "decisions/ticked", "alice");
+    if (evaluate(impure, "decisions/ticked", "alice") == first || ticks != 3)
+    {
+      error = "An impure entrypoint was cached";
+    }
+  }
+  expect("impure", 3, 4, 2, 2);
+
+  if (error.empty())
+  {
+    bundle->decision_cache =
+      std::make_shared<rego::bundle::DecisionCache>(2, 10ms, 1);
+    evaluate(rego, "decisions/allow", "alice");
+    std::this_thread::sleep_for(30ms);
+    if (evaluate(rego, "decisions/allow", "alice") != expected["alice"])
+    {
+      error = "An expired decision was recomputed wrongly";
+    }
+  }
+  expect("ttl", 0, 2, 0, 1);
+
+  const size_t num_threads = 4;
+  const size_t num_runs = 100;
+  if (error.empty())
+  {
+    bundle->decision_cache = std::make_shared<rego::bundle::DecisionCache>(4);
+    std::vector<std::string> failures(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+      threads.emplace_back([&, i]() {
+        rego::Interpreter interpreter;
+        for (size_t run = 0; run < num_runs; ++run)
+        {
+          const std::string& user = users[(i + run) % users.size()];
+          if (
+            evaluate(interpreter, "decisions/allow", user) !=
+            expected.at(user))
+          {
+            failures[i] = "A decision for " + user + " differed in a thread";
+            return;
+          }
+        }
+      });
+    }
+
+    for (std::thread& thread : threads)
+    {
+      thread.join();
+    }
+
+    for (const std::string& failure : failures)
+    {
+      if (!failure.empty())
+      {
+        error = failure;
+        break;
+      }
+    }
+
+    Stats stats = bundle->decision_cache->stats();
+    if (error.empty() && stats.hits + stats.misses != num_threads * num_runs)
+    {
+      error = "Expected every threaded evaluation to consult the cache";
+    }
+  }
+
+  return report_test(note, start, error);
 }
 
 int main(int argc, char** argv)
@@ -124,7 +512,8 @@ int main(int argc, char** argv)
     "Note (or note substring) of specific test to run");
 
   std::string roundtrip_str = "none";
-  std::set<std::string> roundtrip_values({"none", "json", "binary"});
+  std::set<std::string> roundtrip_values(
+    {"none", "json", "binary", "partial", "compact"});
   app
     .add_option(
       "-r,--roundtrip",
@@ -150,10 +539,18 @@ int main(int argc, char** argv)
   {
     roundtrip = rego_test::RoundTrip::JSON;
   }
-  else
+  else if (roundtrip_str == "binary")
   {
     roundtrip = rego_test::RoundTrip::Binary;
   }
+  else if (roundtrip_str == "partial")
+  {
+    roundtrip = rego_test::RoundTrip::BinaryPartial;
+  }
+  else
+  {
+    roundtrip = rego_test::RoundTrip::Compact;
+  }
 
   rego::LogLevel log_level = rego::LogLevel::Output;
   if (!log_level_str.empty())
@@ -196,6 +593,33 @@ int main(int argc, char** argv)
     }
   }
 
+  if (note_match == "threads")
+  {
+    total++;
+    if (threaded_evaluation_test() != 0)
+    {
+      failures++;
+    }
+  }
+
+  if (note_match == "trace")
+  {
+    total++;
+    if (trace_round_trip_test() != 0)
+    {
+      failures++;
+    }
+  }
+
+  if (note_match == "decisions")
+  {
+    total++;
+    if (decision_cache_test() != 0)
+    {
+      failures++;
+    }
+  }
+
   for (auto& [category, cat_cases] : all_testcases)
   {
     logging::Output() << White << category << std::endl;
@@ -78,6 +78,23 @@ namespace
                              << (bi::Type << bi::Number)))
              << (bi::Result << (bi::Name ^ "void") << bi::Description
                             << (bi::Type << bi::Boolean));
+
+  std::string input_paths_to_json(const std::vector<bundle::InputPath>& paths)
+  {
+    std::ostringstream buf;
+    buf << "[";
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+      buf << (i > 0 ? ",[" : "[");
+      for (size_t j = 0; j < paths[i].size(); ++j)
+      {
+        buf << (j > 0 ? "," : "") << '"' << json::escape(paths[i][j]) << '"';
+      }
+      buf << "]";
+    }
+    buf << "]";
+    return buf.str();
+  }
 }
 
 namespace rego_test
@@ -216,6 +233,8 @@ namespace rego_test
     m_want_defined(false),
     m_sort_bindings(false),
     m_strict_error(false),
+    m_parallel_scans(false),
+    m_project_input(false),
     m_broken(false)
   {}
 
@@ -610,7 +629,10 @@ namespace rego_test
         .want_error_code(get_string(test_case_obj, "want_error_code"))
         .want_error(get_string(test_case_obj, "want_error"))
         .sort_bindings(get_bool(test_case_obj, "sort_bindings"))
-        .strict_error(get_bool(test_case_obj, "strict_error"));
+        .strict_error(get_bool(test_case_obj, "strict_error"))
+        .parallel_scans(get_bool(test_case_obj, "parallel_scans"))
+        .project_input(get_bool(test_case_obj, "project_input"))
+        .want_input_paths(get_string(test_case_obj, "want_input_paths"));
 
       // --- Special Cases --- //
       // these test cases require some modification due to differences between
@@ -691,6 +713,10 @@ namespace rego_test
       .debug_enabled(!debug_path.empty())
       .debug_path(debug_path)
       .log_level(log_level);
+    if (m_parallel_scans)
+    {
+      interpreter.scan_workers(4);
+    }
 
     std::ostringstream error;
     Node actual;
@@ -759,11 +785,55 @@ namespace rego_test
       bundle = BundleDef::load(temp_path);
       std::filesystem::remove(temp_path);
     }
+    else if (roundtrip == RoundTrip::BinaryPartial)
+    {
+      std::filesystem::path temp_path =
+        std::filesystem::temp_directory_path() / "test.rbb";
+      bundle->save(temp_path);
+      std::vector<std::string> entrypoints;
+      if (bundle->query_plan.has_value())
+      {
+        entrypoints.push_back(
+          std::string(bundle->plans[*bundle->query_plan].name.view()));
+      }
+      bundle = BundleDef::load(temp_path, entrypoints);
+      std::filesystem::remove(temp_path);
+    }
+    else if (roundtrip == RoundTrip::Compact)
+    {
+      // documents which cannot be compacted are evaluated as they are
+      bundle->compact_data();
+    }
+
+    const std::vector<bundle::InputPath>* input_paths = nullptr;
+    if (bundle->query_plan.has_value())
+    {
+      input_paths = &bundle->plans[*bundle->query_plan].input_paths;
+    }
+
+    if (m_want_input_paths.size() > 0)
+    {
+      if (input_paths == nullptr)
+      {
+        return {false, "no query plan for input paths"};
+      }
+
+      std::string actual_paths = input_paths_to_json(*input_paths);
+      if (!compare(actual_paths, m_want_input_paths, error))
+      {
+        return {false, error.str()};
+      }
+    }
 
     if (m_input_term.size() > 0)
     {
       actual = interpreter.set_input_term(m_input_term);
     }
+    else if (m_input != nullptr && m_project_input && input_paths != nullptr)
+    {
+      actual =
+        interpreter.set_input_json(json::to_string(m_input), *input_paths);
+    }
     else if (m_input != nullptr)
     {
       actual = interpreter.set_input(m_input);
@@ -1061,6 +1131,39 @@ namespace rego_test
     return *this;
   }
 
+  bool TestCase::parallel_scans() const
+  {
+    return m_parallel_scans;
+  }
+
+  TestCase& TestCase::parallel_scans(bool parallel_scans)
+  {
+    m_parallel_scans = parallel_scans;
+    return *this;
+  }
+
+  bool TestCase::project_input() const
+  {
+    return m_project_input;
+  }
+
+  TestCase& TestCase::project_input(bool project_input)
+  {
+    m_project_input = project_input;
+    return *this;
+  }
+
+  const std::string& TestCase::want_input_paths() const
+  {
+    return m_want_input_paths;
+  }
+
+  TestCase& TestCase::want_input_paths(const std::string& want_input_paths)
+  {
+    m_want_input_paths = want_input_paths;
+    return *this;
+  }
+
   bool TestCase::broken() const
   {
     return m_broken;
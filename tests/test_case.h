@@ -20,6 +20,8 @@ namespace rego_test
     None,
     JSON,
     Binary,
+    BinaryPartial,
+    Compact,
   };
 
   class TestCase
@@ -93,6 +95,18 @@ namespace rego_test
     bool strict_error() const;
     TestCase& strict_error(bool strict_error);
 
+    /// evaluate independent scans over large collections on several threads
+    bool parallel_scans() const;
+    TestCase& parallel_scans(bool parallel_scans);
+
+    /// set the input from JSON projected to the input paths of the query
+    bool project_input() const;
+    TestCase& project_input(bool project_input);
+
+    /// the input paths of the query plan, as a JSON array of key arrays
+    const std::string& want_input_paths() const;
+    TestCase& want_input_paths(const std::string& want_input_paths);
+
     /// indicates that the test is broken and should be skipped
     bool broken() const;
     TestCase& broken(bool broken);
@@ -138,6 +152,9 @@ namespace rego_test
     std::string m_want_error;
     bool m_sort_bindings;
     bool m_strict_error;
+    bool m_parallel_scans;
+    bool m_project_input;
+    std::string m_want_input_paths;
     bool m_broken;
   };
 
@@ -2,11 +2,14 @@
 
 #include <CLI/CLI.hpp>
 #include <chrono>
+#include <fstream>
 #include <rego/rego.hh>
 #include <sstream>
 #include <trieste/json.h>
 #include <trieste/logging.h>
 
+const size_t TraceCapacity = 1 << 16;
+
 class Timer
 {
 private:
@@ -91,6 +94,16 @@ int main(int argc, char** argv)
   run->add_option("-f,--format", bundle_format, "Bundle format")
     ->check(CLI::IsMember({"json", "binary"}));
 
+  std::filesystem::path trace_path;
+  run->add_option(
+    "--trace", trace_path, "Path to write a binary statement trace to");
+
+  std::filesystem::path decode_trace_path;
+  run->add_option(
+    "--decode-trace",
+    decode_trace_path,
+    "Print a binary statement trace written against the bundle and exit");
+
   std::string log_level;
   eval->add_option("-l,--log_level", log_level, "Set Log Level")
     ->check(CLI::IsMember(
@@ -295,7 +308,8 @@ int main(int argc, char** argv)
       if (bundle_format == "binary")
       {
         Timer timer("Load bundle (binary)", timing);
-        bundle = rego::BundleDef::load(bundle_path);
+        // when only entrypoints are evaluated, nothing else needs decoding
+        bundle = rego::BundleDef::load(bundle_path, entrypoints);
       }
       else
       {
@@ -309,6 +323,28 @@ int main(int argc, char** argv)
         bundle = rego::BundleDef::from_node(bundle_node);
       }
 
+      if (!decode_trace_path.empty())
+      {
+        std::ifstream stream(decode_trace_path, std::ios::binary);
+        if (!stream)
+        {
+          trieste::logging::Error()
+            << "Unable to open trace " << decode_trace_path << std::endl;
+          return 1;
+        }
+
+        std::ostringstream buf;
+        rego::VirtualMachine::print_trace(
+          *bundle, rego::VirtualMachine::load_trace(stream), buf);
+        trieste::logging::Output() << buf.str();
+        return 0;
+      }
+
+      if (!trace_path.empty())
+      {
+        interpreter->trace_capacity(TraceCapacity);
+      }
+
       trieste::Node result;
       if (entrypoints.empty())
       {
@@ -331,6 +367,13 @@ int main(int argc, char** argv)
           trieste::logging::Output() << rego::to_key(result, true) << std::endl;
         }
       }
+
+      if (!trace_path.empty())
+      {
+        // the trace covers the most recent query
+        std::ofstream stream(trace_path, std::ios::binary);
+        interpreter->save_trace(stream);
+      }
     }
     return 0;
   }
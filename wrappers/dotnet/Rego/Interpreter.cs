@@ -18,7 +18,8 @@ internal enum RegoCode
   // REGO_ERROR_MANUAL_TZDATA_NOT_SUPPORTED 4 deprecated
   REGO_ERROR_INPUT_NULL = 5,
   REGO_ERROR_INPUT_MISSING_ARGUMENTS = 6,
-  REGO_ERROR_INPUT_OBJECT_ITEM = 7
+  REGO_ERROR_INPUT_OBJECT_ITEM = 7,
+  REGO_ERROR_EVAL_CANCELLED = 8
 }
 
 /// <summary>
@@ -89,6 +90,14 @@ public sealed partial class RegoOutputHandle : SafeHandle
   {
   }
 
+  /// <summary>
+  /// Takes ownership of a native output pointer
+  /// </summary>
+  internal RegoOutputHandle(IntPtr ptr) : base(IntPtr.Zero, true)
+  {
+    SetHandle(ptr);
+  }
+
   /// <summary>
   /// Indicates whether the handle is invalid
   /// </summary>
@@ -338,6 +347,24 @@ public partial class Interpreter
   [LibraryImport("rego_shared")]
   private static partial uint regoGetStrictBuiltInErrors(RegoHandle ptr);
 
+  [LibraryImport("rego_shared")]
+  private static partial void regoSetStatementLimit(RegoHandle ptr, uint limit);
+
+  [LibraryImport("rego_shared")]
+  private static partial uint regoGetStatementLimit(RegoHandle ptr);
+
+  [LibraryImport("rego_shared")]
+  private static partial void regoSetTimeLimit(RegoHandle ptr, uint milliseconds);
+
+  [LibraryImport("rego_shared")]
+  private static partial uint regoGetTimeLimit(RegoHandle ptr);
+
+  [LibraryImport("rego_shared")]
+  private static partial void regoCancel(RegoHandle ptr);
+
+  [LibraryImport("rego_shared")]
+  private static partial long regoGetStatementCount(RegoHandle ptr);
+
   [LibraryImport("rego_shared", StringMarshalling = StringMarshalling.Utf8)]
   private static partial byte regoIsAvailableBuiltIn(RegoHandle ptr, string name);
 
@@ -380,6 +407,9 @@ public partial class Interpreter
   [LibraryImport("rego_shared", StringMarshalling = StringMarshalling.Utf8)]
   private static partial RegoOutputHandle regoBundleQueryEntrypoint(RegoHandle ptr, RegoBundleHandle bundle_ptr, string endpoint);
 
+  [LibraryImport("rego_shared", StringMarshalling = StringMarshalling.Utf8)]
+  private static partial uint regoBundleQueryEntrypoints(RegoHandle ptr, RegoBundleHandle bundle_ptr, string[] endpoints, uint count, [Out] IntPtr[] outputs);
+
   [LibraryImport("rego_shared")]
   private static partial uint regoSetLogLevel(RegoHandle ptr, uint level);
 
@@ -708,6 +738,63 @@ public partial class Interpreter
     }
   }
 
+  /// <summary>
+  /// Gets or sets the maximum number of statements a query may execute.
+  /// </summary>
+  /// <remarks>
+  /// A query which exceeds this limit (or the time limit, or which is cancelled)
+  /// produces an output for which <see cref="Output.Cancelled"/> is true. The
+  /// default of 0 means no limit.
+  /// </remarks>
+  public uint StatementLimit
+  {
+    get
+    {
+      return regoGetStatementLimit(m_handle);
+    }
+    set
+    {
+      regoSetStatementLimit(m_handle, value);
+    }
+  }
+
+  /// <summary>
+  /// Gets or sets the maximum time the evaluation of a query may take.
+  /// </summary>
+  /// <remarks>
+  /// The limit has millisecond resolution. The default of zero means no limit.
+  /// </remarks>
+  public TimeSpan TimeLimit
+  {
+    get
+    {
+      return TimeSpan.FromMilliseconds(regoGetTimeLimit(m_handle));
+    }
+    set
+    {
+      regoSetTimeLimit(m_handle, (uint)value.TotalMilliseconds);
+    }
+  }
+
+  /// <summary>
+  /// Cancels the query being evaluated on another thread.
+  /// </summary>
+  public void Cancel()
+  {
+    regoCancel(m_handle);
+  }
+
+  /// <summary>
+  /// The number of statements executed by the most recent query.
+  /// </summary>
+  public long StatementCount
+  {
+    get
+    {
+      return regoGetStatementCount(m_handle);
+    }
+  }
+
   /// <summary>
   /// Gets or sets the log level for the interpreter.
   /// </summary>
@@ -968,4 +1055,25 @@ public partial class Interpreter
 
     return new Output(ptr);
   }
+
+  /// <summary>
+  /// Executes queries against several entrypoints of the specified bundle in a single pass, so that
+  /// rules shared by the entrypoints are only evaluated once. This requires that <see cref="Build"/>
+  /// was provided with each of the entrypoints when this bundle was built.
+  /// </summary>
+  /// <param name="bundle">The bundle to query</param>
+  /// <param name="entrypoints">The entrypoints to use for the queries</param>
+  /// <returns>The output of each query, in the order of <paramref name="entrypoints"/></returns>
+  /// <exception cref="RegoException"></exception>
+  public Output[] QueryBundle(Bundle bundle, string[] entrypoints)
+  {
+    var ptrs = new IntPtr[entrypoints.Length];
+    var result = (RegoCode)regoBundleQueryEntrypoints(m_handle, bundle.Handle, entrypoints, (uint)entrypoints.Length, ptrs);
+    if (result != RegoCode.REGO_OK)
+    {
+      throw new RegoException(getError());
+    }
+
+    return ptrs.Select(ptr => new Output(new RegoOutputHandle(ptr))).ToArray();
+  }
 }
@@ -10,6 +10,9 @@ public partial class Output
   [LibraryImport("rego_shared")]
   private static partial byte regoOutputOk(RegoOutputHandle ptr);
 
+  [LibraryImport("rego_shared")]
+  private static partial uint regoOutputStatus(RegoOutputHandle ptr);
+
   [LibraryImport("rego_shared")]
   private static partial uint regoOutputSize(RegoOutputHandle ptr);
 
@@ -65,6 +68,17 @@ public partial class Output
     }
   }
 
+  /// <summary>
+  /// Indicates whether the evaluation was stopped by a limit or by cancellation.
+  /// </summary>
+  public bool Cancelled
+  {
+    get
+    {
+      return regoOutputStatus(m_handle) == (uint)RegoCode.REGO_ERROR_EVAL_CANCELLED;
+    }
+  }
+
   /// <summary>
   /// The number of results in the output.
   /// </summary>
@@ -3,12 +3,13 @@
 from .interpreter import Bundle, BundleFormat, Input, Interpreter
 from .node import Node, NodeKind
 from .output import Output
-from .rego_shared import LogLevel, RegoError, rego_version
+from .rego_shared import Code, LogLevel, RegoError, rego_version
 
 __version__ = rego_version()
 
 __all__ = [
-    "Bundle", "BundleFormat", "Input", "Interpreter", "RegoError", "LogLevel",
+    "Bundle", "BundleFormat", "Code", "Input", "Interpreter", "RegoError",
+    "LogLevel",
     "Output",
     "Node", "NodeKind"
 ]
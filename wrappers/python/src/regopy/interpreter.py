@@ -2,7 +2,7 @@
 
 from enum import Enum
 import json
-from typing import Any, Optional, Sequence
+from typing import Any, List, Optional, Sequence
 
 from .node import Node
 from .output import Output
@@ -19,6 +19,12 @@ from .rego_shared import (
     rego_set_wf_checks_enabled,
     rego_get_strict_builtin_errors,
     rego_set_strict_builtin_errors,
+    rego_get_statement_limit,
+    rego_set_statement_limit,
+    rego_get_time_limit,
+    rego_set_time_limit,
+    rego_cancel,
+    rego_get_statement_count,
     rego_get_log_level,
     rego_set_log_level,
     rego_set_query,
@@ -32,6 +38,9 @@ from .rego_shared import (
     rego_bundle_save_binary,
     rego_bundle_query,
     rego_bundle_query_entrypoint,
+    rego_bundle_query_entrypoints,
+    rego_bundle_input_paths,
+    rego_bundle_set_input_json,
     rego_bundle_node,
     rego_bundle_ok,
     rego_free_bundle,
@@ -353,6 +362,41 @@ class Interpreter:
     def strict_built_in_errors(self, value: bool):
         rego_set_strict_builtin_errors(self._impl, value)
 
+    @property
+    def statement_limit(self) -> int:
+        """The maximum number of statements a query may execute.
+
+        A query which exceeds this limit (or the time limit, or which is
+        cancelled) produces an output whose status is `Code.ERROR_EVAL_CANCELLED`.
+        The default of 0 means no limit.
+        """
+        return rego_get_statement_limit(self._impl)
+
+    @statement_limit.setter
+    def statement_limit(self, value: int):
+        rego_set_statement_limit(self._impl, value)
+
+    @property
+    def time_limit(self) -> int:
+        """The maximum time in milliseconds the evaluation of a query may take.
+
+        The default of 0 means no limit.
+        """
+        return rego_get_time_limit(self._impl)
+
+    @time_limit.setter
+    def time_limit(self, value: int):
+        rego_set_time_limit(self._impl, value)
+
+    def cancel(self):
+        """Cancels the query being evaluated on another thread."""
+        rego_cancel(self._impl)
+
+    @property
+    def statement_count(self) -> int:
+        """The number of statements executed by the most recent query."""
+        return rego_get_statement_count(self._impl)
+
     def is_builtin(self, name: str) -> bool:
         """Returns whether the given name is a built-in function.
 
@@ -597,6 +641,62 @@ class Interpreter:
         """
         return Output(rego_bundle_query_entrypoint(self._impl, bundle._impl, entrypoint))
 
+    def query_bundle_entrypoints(self, bundle: Bundle, entrypoints: List[str]) -> List[Output]:
+        """Performs queries against several entrypoints of the bundle.
+
+        Args:
+            bundle (Bundle): The bundle to execute
+            entrypoints (List[str]): The entrypoints to execute
+
+        Returns:
+            outputs (List[Output]): The result of each query, in the order
+            of `entrypoints`
+
+        Raises:
+            RegoError: If an error occurs during execution
+
+        The entrypoints are evaluated in a single pass, so rules which they
+        share are only evaluated once.
+        """
+        outputs = rego_bundle_query_entrypoints(self._impl, bundle._impl, entrypoints)
+        return [Output(output) for output in outputs]
+
+    def bundle_input_paths(self, bundle: Bundle, entrypoint: str) -> List[List[str]]:
+        """Returns the paths into the input which an entrypoint can read.
+
+        Args:
+            bundle (Bundle): The compiled bundle
+            entrypoint (str): The entrypoint
+
+        Returns:
+            paths (List[List[str]]): The object keys leading to each subtree
+            of the input which the entrypoint may read. An empty path means
+            that it may read the whole input.
+
+        Raises:
+            RegoError: If the entrypoint does not exist
+
+        Callers can use these paths to trim the input before sending it.
+        """
+        return json.loads(rego_bundle_input_paths(self._impl, bundle._impl, entrypoint))
+
+    def set_bundle_input_json(self, bundle: Bundle, entrypoint: str, contents: str):
+        """Sets the input from JSON, keeping only what an entrypoint can read.
+
+        Args:
+            bundle (Bundle): The compiled bundle
+            entrypoint (str): The entrypoint which will be queried
+            contents (str): The JSON input document
+
+        Raises:
+            RegoError: If the entrypoint does not exist or the document is invalid
+
+        The parts of the document which are not on any of the paths returned
+        by :func:`~regopy.Interpreter.bundle_input_paths` are skipped rather
+        than parsed.
+        """
+        rego_bundle_set_input_json(self._impl, bundle._impl, entrypoint, contents)
+
     def __repr__(self) -> str:
         """Returns a string representation of the interpreter."""
         return "Interpreter({})".format(self._impl)
@@ -5,11 +5,13 @@ from typing import Union
 from .node import Node
 from .rego_shared import (
     rego_output_ok,
+    rego_output_status,
     rego_output_string,
     rego_output_node,
     rego_output_expressions_at_index,
     rego_output_binding_at_index,
-    rego_free_output
+    rego_free_output,
+    Code
 )
 
 
@@ -160,3 +162,12 @@ class Output:
         it is ok.
         """
         return rego_output_ok(self._impl)
+
+    def status(self) -> Code:
+        """Returns the status of the output.
+
+        This is `Code.OK` if the output is ok, `Code.ERROR_EVAL_CANCELLED` if the
+        evaluation was stopped by a limit or by cancellation, and `Code.ERROR`
+        otherwise.
+        """
+        return rego_output_status(self._impl)
@@ -2,7 +2,7 @@ from collections.abc import Mapping, Sequence, Set
 import ctypes
 from enum import IntEnum
 import os
-from typing import Any
+from typing import Any, List
 
 
 class LogLevel(IntEnum):
@@ -23,6 +23,7 @@ class Code(IntEnum):
     ERROR_INPUT_NULL = 5
     ERROR_INPUT_MISSING_ARGUMENTS = 6
     ERROR_INPUT_OBJECT_ITEM = 7
+    ERROR_EVAL_CANCELLED = 8
 
 
 class NodeKind(IntEnum):
@@ -288,6 +289,54 @@ def rego_get_strict_builtin_errors(impl: ctypes.c_void_p) -> bool:
     return rego.regoGetStrictBuiltInErrors(impl)
 
 
+rego.regoSetStatementLimit.restype = None
+rego.regoSetStatementLimit.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+
+
+def rego_set_statement_limit(impl: ctypes.c_void_p, limit: int):
+    rego.regoSetStatementLimit(impl, limit)
+
+
+rego.regoGetStatementLimit.restype = ctypes.c_uint32
+rego.regoGetStatementLimit.argtypes = [ctypes.c_void_p]
+
+
+def rego_get_statement_limit(impl: ctypes.c_void_p) -> int:
+    return rego.regoGetStatementLimit(impl)
+
+
+rego.regoSetTimeLimit.restype = None
+rego.regoSetTimeLimit.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+
+
+def rego_set_time_limit(impl: ctypes.c_void_p, milliseconds: int):
+    rego.regoSetTimeLimit(impl, milliseconds)
+
+
+rego.regoGetTimeLimit.restype = ctypes.c_uint32
+rego.regoGetTimeLimit.argtypes = [ctypes.c_void_p]
+
+
+def rego_get_time_limit(impl: ctypes.c_void_p) -> int:
+    return rego.regoGetTimeLimit(impl)
+
+
+rego.regoCancel.restype = None
+rego.regoCancel.argtypes = [ctypes.c_void_p]
+
+
+def rego_cancel(impl: ctypes.c_void_p):
+    rego.regoCancel(impl)
+
+
+rego.regoGetStatementCount.restype = ctypes.c_int64
+rego.regoGetStatementCount.argtypes = [ctypes.c_void_p]
+
+
+def rego_get_statement_count(impl: ctypes.c_void_p) -> int:
+    return rego.regoGetStatementCount(impl)
+
+
 rego.regoIsAvailableBuiltIn.restype = ctypes.c_bool
 rego.regoIsAvailableBuiltIn.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
 
@@ -417,6 +466,57 @@ def rego_bundle_query_entrypoint(impl: ctypes.c_void_p, bundle: ctypes.c_void_p,
     return p_output
 
 
+rego.regoBundleQueryEntrypoints.restype = ctypes.c_uint32
+rego.regoBundleQueryEntrypoints.argtypes = [ctypes.c_void_p, ctypes.c_void_p,
+                                            ctypes.POINTER(ctypes.c_char_p), ctypes.c_uint32,
+                                            ctypes.POINTER(ctypes.c_void_p)]
+
+
+def rego_bundle_query_entrypoints(impl: ctypes.c_void_p, bundle: ctypes.c_void_p,
+                                  entrypoints: List[str]) -> List[ctypes.c_void_p]:
+    count = len(entrypoints)
+    p_entrypoints = (ctypes.c_char_p * count)(*[e.encode("utf-8") for e in entrypoints])
+    p_outputs = (ctypes.c_void_p * count)()
+    res = rego.regoBundleQueryEntrypoints(impl, bundle, p_entrypoints, count, p_outputs)
+    if res != Code.OK:
+        raise RegoError(rego_get_error(impl))
+
+    return list(p_outputs)
+
+
+rego.regoBundleInputPathsSize.restype = ctypes.c_uint32
+rego.regoBundleInputPathsSize.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p]
+rego.regoBundleInputPaths.restype = ctypes.c_uint32
+rego.regoBundleInputPaths.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p,
+                                      ctypes.POINTER(ctypes.c_char), ctypes.c_uint32]
+
+
+def rego_bundle_input_paths(impl: ctypes.c_void_p, bundle: ctypes.c_void_p, entrypoint: str) -> str:
+    p_entrypoint = ctypes.create_string_buffer(entrypoint.encode("utf-8"))
+    size = rego.regoBundleInputPathsSize(impl, bundle, p_entrypoint)
+    if size == 0:
+        raise RegoError(rego_get_error(impl))
+
+    buf = ctypes.create_string_buffer(size)
+    res = rego.regoBundleInputPaths(impl, bundle, p_entrypoint, buf, size)
+    if res != Code.OK:
+        raise RegoError(rego_get_error(impl), res)
+
+    return buf.value.decode("utf-8")
+
+
+rego.regoBundleSetInputJSON.restype = ctypes.c_uint32
+rego.regoBundleSetInputJSON.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+
+
+def rego_bundle_set_input_json(impl: ctypes.c_void_p, bundle: ctypes.c_void_p, entrypoint: str, contents: str):
+    p_entrypoint = ctypes.create_string_buffer(entrypoint.encode("utf-8"))
+    p_contents = ctypes.create_string_buffer(contents.encode("utf-8"))
+    res = rego.regoBundleSetInputJSON(impl, bundle, p_entrypoint, p_contents)
+    if res != Code.OK:
+        raise RegoError(rego_get_error(impl), res)
+
+
 # Output functions
 
 rego.regoOutputOk.restype = ctypes.c_bool
@@ -427,6 +527,14 @@ def rego_output_ok(impl: ctypes.c_void_p) -> bool:
     return rego.regoOutputOk(impl)
 
 
+rego.regoOutputStatus.restype = ctypes.c_uint32
+rego.regoOutputStatus.argtypes = [ctypes.c_void_p]
+
+
+def rego_output_status(impl: ctypes.c_void_p) -> Code:
+    return Code(rego.regoOutputStatus(impl))
+
+
 rego.regoOutputJSONSize.restype = ctypes.c_uint32
 rego.regoOutputJSONSize.argtypes = [ctypes.c_void_p]
 rego.regoOutputJSON.restype = ctypes.c_uint32
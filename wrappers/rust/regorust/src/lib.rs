@@ -961,6 +961,48 @@ impl Interpreter {
         c_enabled == 1
     }
 
+    /// Sets the maximum number of statements a query may execute.
+    ///
+    /// A query which exceeds this limit (or the time limit, or which is
+    /// cancelled) produces an output whose status is `REGO_ERROR_EVAL_CANCELLED`.
+    /// The default of 0 means no limit.
+    pub fn set_statement_limit(&self, limit: u32) {
+        unsafe {
+            regoSetStatementLimit(self.c_ptr, limit);
+        }
+    }
+
+    /// Returns the maximum number of statements a query may execute.
+    pub fn get_statement_limit(&self) -> u32 {
+        unsafe { regoGetStatementLimit(self.c_ptr) }
+    }
+
+    /// Sets the maximum time in milliseconds the evaluation of a query may take.
+    ///
+    /// The default of 0 means no limit.
+    pub fn set_time_limit(&self, milliseconds: u32) {
+        unsafe {
+            regoSetTimeLimit(self.c_ptr, milliseconds);
+        }
+    }
+
+    /// Returns the maximum time in milliseconds the evaluation of a query may take.
+    pub fn get_time_limit(&self) -> u32 {
+        unsafe { regoGetTimeLimit(self.c_ptr) }
+    }
+
+    /// Cancels the query being evaluated on another thread.
+    pub fn cancel(&self) {
+        unsafe {
+            regoCancel(self.c_ptr);
+        }
+    }
+
+    /// Returns the number of statements executed by the most recent query.
+    pub fn get_statement_count(&self) -> i64 {
+        unsafe { regoGetStatementCount(self.c_ptr) }
+    }
+
     /// Returns whether the interpreter has a built-in with the given name.
     ///
     /// # Example
@@ -1215,6 +1257,41 @@ impl Interpreter {
         }
     }
 
+    /// Performs queries against several entrypoints of the bundle.
+    ///
+    /// The entrypoints are evaluated in a single pass, so rules which they
+    /// share are only evaluated once. The outputs are returned in the same
+    /// order as `entrypoints`.
+    pub fn query_bundle_entrypoints(
+        &self,
+        bundle: &Bundle,
+        entrypoints: &[&str],
+    ) -> Result<Vec<Output>, String> {
+        let entrypoint_cstrs: Vec<CString> = entrypoints
+            .iter()
+            .map(|entrypoint| CString::new(*entrypoint).unwrap())
+            .collect();
+        let mut entrypoint_ptrs: Vec<*const std::os::raw::c_char> =
+            entrypoint_cstrs.iter().map(|cstr| cstr.as_ptr()).collect();
+        let mut output_ptrs: Vec<*mut regoOutput> =
+            vec![std::ptr::null_mut(); entrypoints.len()];
+        let result = unsafe {
+            regoBundleQueryEntrypoints(
+                self.c_ptr,
+                bundle.c_ptr,
+                entrypoint_ptrs.as_mut_ptr(),
+                entrypoints.len() as regoSize,
+                output_ptrs.as_mut_ptr(),
+            )
+        };
+
+        if result == REGO_OK {
+            Ok(output_ptrs.into_iter().map(Output::new).collect())
+        } else {
+            Err(self.get_error())
+        }
+    }
+
     /// Performs a query using the compiled policy in the bundle.
     ///
     /// This method requires that a query was provided to [`Interpreter::build()`].
@@ -1269,6 +1346,15 @@ impl Output {
         c_ok == 1
     }
 
+    /// Returns the status of the output.
+    ///
+    /// This is `REGO_OK` if the output is ok, `REGO_ERROR_EVAL_CANCELLED` if the
+    /// evaluation was stopped by a limit or by cancellation, and `REGO_ERROR`
+    /// otherwise.
+    pub fn status(&self) -> regoEnum {
+        unsafe { regoOutputStatus(self.c_ptr) }
+    }
+
     /// Returns the output as a JSON-encoded string.
     ///
     /// If the result of [`Self::ok()`] is false, the result will be an string